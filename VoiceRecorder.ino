@@ -4,18 +4,23 @@
 #include "power_management.h"
 #include "led_control.h"
 #include "sd_manager.h"
+#include "file_pool.h"
+#include "upload_queue.h"
+#include "retention.h"
+#include "duty_cycle.h"
+#include "metrics.h"
 #include "wifi_sync.h"
+#include "warm_boot.h"
+#include "audio_pipeline.h"
+#include "system_events.h"
 #include <WiFi.h>
-#include <SD.h>
-#include <SPI.h>
-#include <driver/i2s.h>
 #include <esp_sleep.h>
+#include <esp_timer.h>
 
 typedef enum {
   STATE_IDLE,
   STATE_LISTENING,
   STATE_RECORDING,
-  STATE_UPLOADING,
   STATE_LOW_BATTERY,
   STATE_ERROR
 } system_state_t;
@@ -25,15 +30,28 @@ bool usbConnected = false;
 unsigned long lastActivityTime = 0;
 unsigned long recordingStartTime = 0;
 String currentRecordingFile = "";
+bool bootTimingReported = false;
+bool recoveryScheduled = false;
 
 void setup() {
+  bool warm = detectWarmBoot();
+  
   Serial.begin(115200);
-  delay(1000);
+  if (!warm) {
+    // Time to attach a monitor; a timer wakeup has nobody waiting
+    delay(1000);
+  }
   
   Serial.println("XIAO ESP32S3 Voice Recorder v1.0");
+  if (warm) {
+    Serial.printf("Warm boot (wake %lu)\n", getWarmBootState()->wakeCount);
+  }
   Serial.println("Initializing...");
   
-  if (!initializeSystem()) {
+  // Before anything else can fail: error recovery runs off its timer
+  initializeSystemEvents();
+  
+  if (!initializeSystem(warm)) {
     Serial.println("System initialization failed!");
     currentState = STATE_ERROR;
     return;
@@ -44,8 +62,15 @@ void setup() {
   setLEDMode(LED_LISTENING);
 }
 
+// loop() runs once per event instead of every 10 ms. While listening or
+// recording that is once per audio block, which bounds state transitions
+// to one block; otherwise it sleeps until a timer or USB change wakes it.
 void loop() {
-  usbConnected = isUSBConnected();
+  uint32_t events = waitForSystemEvents(loopWakeEvents(), loopWaitMs());
+  int64_t iterationStart = esp_timer_get_time();
+  usbConnected = isUSBPresent();
+  handleSerialCommands();
+  reportBootTiming();
   
   switch (currentState) {
     case STATE_LISTENING:
@@ -53,11 +78,7 @@ void loop() {
       break;
       
     case STATE_RECORDING:
-      handleRecordingState();
-      break;
-      
-    case STATE_UPLOADING:
-      handleUploadingState();
+      handleRecordingState(events);
       break;
       
     case STATE_LOW_BATTERY:
@@ -65,7 +86,7 @@ void loop() {
       break;
       
     case STATE_ERROR:
-      handleErrorState();
+      handleErrorState(events);
       break;
       
     case STATE_IDLE:
@@ -74,33 +95,92 @@ void loop() {
       break;
   }
   
-  updateLED();
+  // Uploads run in the background service; loop() only sets the policy
+  setUploadsEnabled(usbConnected);
+  setUploadRecordingActive(currentState == STATE_RECORDING);
   
-  if (usbConnected && currentState != STATE_UPLOADING && currentState != STATE_RECORDING) {
-    if (shouldStartUpload()) {
-      currentState = STATE_UPLOADING;
-      setLEDMode(LED_UPLOADING);
-    }
+  if (currentState == STATE_LISTENING) {
+    setLEDMode(isUploadInProgress() ? LED_UPLOADING : LED_LISTENING);
   }
   
-  if (getBatteryPercentage() < LOW_BATTERY_THRESHOLD && !usbConnected) {
+  updatePowerProfile();
+  updatePowerStatus();
+  
+  if (isBatteryLow() && !usbConnected) {
     currentState = STATE_LOW_BATTERY;
     setLEDMode(LED_LOW_BATTERY);
   }
   
-  delay(10);
+  recordMetric(METRIC_LOOP_ITERATION, (uint32_t)(esp_timer_get_time() - iterationStart));
+}
+
+// Audio blocks only matter while the VAD or the recorder consumes them
+uint32_t loopWakeEvents() {
+  uint32_t events = SYSTEM_EVENT_ALL & ~SYSTEM_EVENT_AUDIO_BLOCK;
+  if (currentState == STATE_LISTENING || currentState == STATE_RECORDING) {
+    events |= SYSTEM_EVENT_AUDIO_BLOCK;
+  }
+  return events;
+}
+
+// Duty-cycled listening sleeps inside runDutyCycleListen() and idle moves
+// straight on, so neither waits here
+uint32_t loopWaitMs() {
+  if (currentState == STATE_IDLE || (currentState == STATE_LISTENING && useDutyCycle())) {
+    return 0;
+  }
+  return UINT32_MAX;
+}
+
+void handleSerialCommands() {
+  while (Serial.available() > 0) {
+    switch (Serial.read()) {
+      case 'm':
+        printMetrics();
+        break;
+      case 'r':
+        resetMetrics();
+        Serial.println("Metrics reset");
+        break;
+    }
+  }
+}
+
+// Once per boot: how long until audio was flowing
+void reportBootTiming() {
+  if (bootTimingReported || getFirstCaptureTimeUs() == 0) {
+    return;
+  }
+  
+  int64_t firstSampleUs = getFirstCaptureTimeUs() - (int64_t)PIPELINE_BLOCK_SAMPLES * 1000000 / SAMPLE_RATE;
+  Serial.printf("First sample captured %lu ms after boot (%s)\n",
+                (uint32_t)(firstSampleUs / 1000), isWarmBoot() ? "warm" : "cold");
+  bootTimingReported = true;
 }
 
-bool initializeSystem() {
+// A warm boot resumes from state saved before deep sleep: the last good SD
+// mode, the upload queue cursor and the VAD calibration
+bool initializeSystem(bool warm) {
+  const warm_boot_state_t* saved = getWarmBootState();
+  
   initializeLED();
   setLEDMode(LED_SOLID);
   
-  if (!initializeSDCard()) {
+  if (!(warm ? resumeSDCard(saved->storageMode) : initializeSDCard())) {
     Serial.println("SD card initialization failed");
     setLEDMode(LED_ERROR);
     return false;
   }
   
+  bool queueReady = warm && saved->queueValid ? resumeUploadQueue(&saved->queue) : initializeUploadQueue();
+  if (!queueReady) {
+    Serial.println("Upload queue unavailable, recordings will not be uploaded");
+  }
+  
+  if (!initializeFilePool()) {
+    Serial.println("File pool unavailable, recordings will allocate on the fly");
+  }
+  
   if (!initializeAudio()) {
     Serial.println("Audio initialization failed");
     setLEDMode(LED_ERROR);
@@ -113,14 +193,40 @@ bool initializeSystem() {
     return false;
   }
   
-  initializeVAD();
+  initializeVAD(warm ? &saved->vad : NULL);
+  
+  if (!startUploadService()) {
+    Serial.println("Upload service failed to start");
+  }
   
   Serial.println("All systems initialized successfully");
   return true;
 }
 
+// A quiet room lowers the clock; on battery the idle profile also
+// duty-cycles capture (see useDutyCycle())
+void updatePowerProfile() {
+  if (currentState == STATE_RECORDING) {
+    setPowerProfile(POWER_PROFILE_RECORDING);
+  } else if (isUploadInProgress()) {
+    setPowerProfile(POWER_PROFILE_UPLOADING);
+  } else if (currentState == STATE_LISTENING && millis() - lastActivityTime > SLEEP_TIMEOUT_MS) {
+    setPowerProfile(POWER_PROFILE_IDLE);
+  } else {
+    setPowerProfile(POWER_PROFILE_LISTENING);
+  }
+}
+
+// On battery with nothing happening, sample the room in short bursts
+bool useDutyCycle() {
+  return DUTY_CYCLE_ENABLED && !usbConnected && !isUploadInProgress() &&
+         getPowerProfile() == POWER_PROFILE_IDLE;
+}
+
 void handleListeningState() {
-  if (detectVoiceActivity()) {
+  bool voiceDetected = useDutyCycle() ? runDutyCycleListen() : detectVoiceActivity();
+  
+  if (voiceDetected) {
     Serial.println("Voice detected, starting recording");
     currentRecordingFile = generateRecordingFilename();
     
@@ -135,14 +241,21 @@ void handleListeningState() {
       setLEDMode(LED_ERROR);
     }
   } else {
-    if (millis() - lastActivityTime > SLEEP_TIMEOUT_MS) {
-      enterLightSleep();
-      lastActivityTime = millis();
+    // Deferred while the upload task holds the storage lock
+    if (!maintainStorage()) {
+      Serial.println("Storage lost, no working SD mode left");
+      currentState = STATE_ERROR;
+      setLEDMode(LED_ERROR);
+      return;
     }
+    
+    maintainFilePool();
+    maintainRetention();
+    maintainUploadQueue();
   }
 }
 
-void handleRecordingState() {
+void handleRecordingState(uint32_t events) {
   if (!continueRecording()) {
     Serial.println("Recording error occurred");
     stopRecording();
@@ -151,10 +264,16 @@ void handleRecordingState() {
     return;
   }
   
+  // Each closed segment is queued, so start sending it while we keep recording
+  if (events & SYSTEM_EVENT_SEGMENT) {
+    requestUpload();
+  }
+  
   if (millis() - recordingStartTime > MAX_RECORDING_DURATION_MS) {
     Serial.println("Maximum recording duration reached");
     stopRecording();
     Serial.printf("Recording saved: %s\n", currentRecordingFile.c_str());
+    requestUpload();
     currentState = STATE_LISTENING;
     setLEDMode(LED_LISTENING);
     return;
@@ -167,8 +286,12 @@ void handleRecordingState() {
       silenceStartTime = millis();
     } else if (millis() - silenceStartTime > SILENCE_TIMEOUT_MS) {
       Serial.println("Silence detected, stopping recording");
+      if (silenceStartTime - recordingStartTime < METRICS_FALSE_TRIGGER_MS) {
+        incrementMetricCounter(METRIC_FALSE_TRIGGERS);
+      }
       stopRecording();
       Serial.printf("Recording saved: %s\n", currentRecordingFile.c_str());
+      requestUpload();
       currentState = STATE_LISTENING;
       setLEDMode(LED_LISTENING);
       silenceStartTime = 0;
@@ -178,54 +301,36 @@ void handleRecordingState() {
   }
 }
 
-void handleUploadingState() {
-  if (!usbConnected) {
-    Serial.println("USB disconnected, stopping upload");
-    currentState = STATE_LISTENING;
-    setLEDMode(LED_LISTENING);
-    return;
-  }
-  
-  if (performUpload()) {
-    Serial.println("Upload completed successfully");
-    currentState = STATE_LISTENING;
-    setLEDMode(LED_LISTENING);
-  } else {
-    Serial.println("Upload failed, will retry later");
-    currentState = STATE_LISTENING;
-    setLEDMode(LED_LISTENING);
-  }
-}
-
 void handleLowBatteryState() {
-  if (usbConnected) {
-    Serial.println("USB connected, exiting low battery mode");
+  if (usbConnected || !isBatteryLow()) {
+    Serial.println(usbConnected ? "USB connected, exiting low battery mode" : "Battery recovered, exiting low battery mode");
     currentState = STATE_LISTENING;
     setLEDMode(LED_LISTENING);
     return;
   }
   
-  if (getBatteryPercentage() < CRITICAL_BATTERY_THRESHOLD) {
+  if (isBatteryCritical()) {
     Serial.println("Critical battery level, entering deep sleep");
     enterDeepSleep();
   }
-  
-  delay(5000);
 }
 
-void handleErrorState() {
-  Serial.println("System in error state");
-  
-  if (millis() % 10000 == 0) {
-    Serial.println("Attempting system recovery...");
-    if (initializeSystem()) {
-      Serial.println("System recovery successful");
-      currentState = STATE_LISTENING;
-      setLEDMode(LED_LISTENING);
+void handleErrorState(uint32_t events) {
+  if (!(events & SYSTEM_EVENT_RECOVERY)) {
+    if (!recoveryScheduled) {
+      Serial.println("System in error state");
+      recoveryScheduled = scheduleRecoveryEvent(ERROR_RECOVERY_INTERVAL_MS);
     }
+    return;
   }
   
-  delay(1000);
+  recoveryScheduled = false;
+  Serial.println("Attempting system recovery...");
+  if (initializeSystem(false)) {
+    Serial.println("System recovery successful");
+    currentState = STATE_LISTENING;
+    setLEDMode(LED_LISTENING);
+  }
 }
 
 void handleIdleState() {
@@ -0,0 +1,164 @@
+#include "audio_encoder.h"
+#include <string.h>
+
+#if AUDIO_CODEC == CODEC_OPUS
+#error "CODEC_OPUS needs libopus and an Ogg muxer, neither is bundled; use CODEC_IMA_ADPCM"
+#endif
+
+static_assert(ADPCM_BLOCK_ALIGN % 4 == 0 && ADPCM_BLOCK_ALIGN >= 64, "ADPCM_BLOCK_ALIGN must be a multiple of 4");
+
+static const int16_t adpcmStepTable[89] = {
+  7, 8, 9, 10, 11, 12, 13, 14, 16, 17, 19, 21, 23, 25, 28, 31, 34, 37, 41, 45,
+  50, 55, 60, 66, 73, 80, 88, 97, 107, 118, 130, 143, 157, 173, 190, 209, 230,
+  253, 279, 307, 337, 371, 408, 449, 494, 544, 598, 658, 724, 796, 876, 963,
+  1060, 1166, 1282, 1411, 1552, 1707, 1878, 2066, 2272, 2499, 2749, 3024, 3327,
+  3660, 4026, 4428, 4871, 5358, 5894, 6484, 7132, 7845, 8630, 9493, 10442,
+  11487, 12635, 13899, 15289, 16818, 18500, 20350, 22385, 24623, 27086, 29794,
+  32767
+};
+
+static const int8_t adpcmIndexTable[16] = {
+  -1, -1, -1, -1, 2, 4, 6, 8,
+  -1, -1, -1, -1, 2, 4, 6, 8
+};
+
+static inline uint8_t encodeADPCMSample(audio_encoder_t* encoder, int32_t sample) {
+  int32_t step = adpcmStepTable[encoder->stepIndex];
+  int32_t diff = sample - encoder->predictor;
+  uint8_t nibble = 0;
+
+  if (diff < 0) {
+    nibble = 8;
+    diff = -diff;
+  }
+
+  // Reconstruct exactly as the decoder will so both sides stay in lockstep
+  int32_t delta = step >> 3;
+  if (diff >= step) {
+    nibble |= 4;
+    diff -= step;
+    delta += step;
+  }
+  step >>= 1;
+  if (diff >= step) {
+    nibble |= 2;
+    diff -= step;
+    delta += step;
+  }
+  step >>= 1;
+  if (diff >= step) {
+    nibble |= 1;
+    delta += step;
+  }
+
+  encoder->predictor += (nibble & 8) ? -delta : delta;
+  if (encoder->predictor > 32767) {
+    encoder->predictor = 32767;
+  } else if (encoder->predictor < -32768) {
+    encoder->predictor = -32768;
+  }
+
+  encoder->stepIndex += adpcmIndexTable[nibble];
+  if (encoder->stepIndex < 0) {
+    encoder->stepIndex = 0;
+  } else if (encoder->stepIndex > 88) {
+    encoder->stepIndex = 88;
+  }
+
+  return nibble;
+}
+
+static inline void appendADPCMSample(audio_encoder_t* encoder, int16_t sample) {
+  uint8_t* block = encoder->block;
+
+  if (encoder->blockSamples == 0) {
+    // The block header stores the first sample verbatim
+    encoder->predictor = sample;
+    block[0] = (uint8_t)(sample & 0xFF);
+    block[1] = (uint8_t)((sample >> 8) & 0xFF);
+    block[2] = (uint8_t)encoder->stepIndex;
+    block[3] = 0;
+  } else {
+    size_t n = encoder->blockSamples - 1;
+    uint8_t nibble = encodeADPCMSample(encoder, sample);
+    if (n & 1) {
+      block[4 + (n >> 1)] |= (uint8_t)(nibble << 4);
+    } else {
+      block[4 + (n >> 1)] = nibble;
+    }
+  }
+
+  encoder->blockSamples++;
+}
+
+void encoderBegin(audio_encoder_t* encoder, uint8_t codec) {
+  memset(encoder, 0, sizeof(*encoder));
+  encoder->codec = codec;
+}
+
+size_t encoderProcess(audio_encoder_t* encoder, const int16_t* samples, size_t count,
+                      uint8_t* output, size_t capacity) {
+  if (encoder->codec == CODEC_PCM) {
+    size_t bytes = count * sizeof(int16_t);
+    if (bytes > capacity) {
+      return 0;
+    }
+    memcpy(output, samples, bytes);
+    encoder->samplesEncoded += count;
+    return bytes;
+  }
+
+  size_t produced = 0;
+  for (size_t i = 0; i < count; i++) {
+    appendADPCMSample(encoder, samples[i]);
+
+    if (encoder->blockSamples == ADPCM_SAMPLES_PER_BLOCK) {
+      if (produced + ADPCM_BLOCK_ALIGN > capacity) {
+        return produced;
+      }
+      memcpy(output + produced, encoder->block, ADPCM_BLOCK_ALIGN);
+      produced += ADPCM_BLOCK_ALIGN;
+      encoder->blockSamples = 0;
+    }
+  }
+
+  encoder->samplesEncoded += count;
+  return produced;
+}
+
+// Pads the last block by holding the final sample; the fact chunk carries the
+// true sample count so players trim the padding
+size_t encoderFinish(audio_encoder_t* encoder, uint8_t* output, size_t capacity) {
+  if (encoder->codec == CODEC_PCM || encoder->blockSamples == 0) {
+    return 0;
+  }
+
+  if (capacity < ADPCM_BLOCK_ALIGN) {
+    return 0;
+  }
+
+  int16_t hold = (int16_t)encoder->predictor;
+  while (encoder->blockSamples < ADPCM_SAMPLES_PER_BLOCK) {
+    appendADPCMSample(encoder, hold);
+  }
+
+  memcpy(output, encoder->block, ADPCM_BLOCK_ALIGN);
+  encoder->blockSamples = 0;
+  return ADPCM_BLOCK_ALIGN;
+}
+
+size_t encoderMaxOutputBytes(uint8_t codec, size_t sampleCount) {
+  if (codec == CODEC_PCM) {
+    return sampleCount * sizeof(int16_t);
+  }
+  return (sampleCount / ADPCM_SAMPLES_PER_BLOCK + 1) * ADPCM_BLOCK_ALIGN;
+}
+
+const char* encoderContentType(uint8_t codec) {
+  switch (codec) {
+    case CODEC_IMA_ADPCM:
+      return "audio/vnd.wave; codec=11";
+    default:
+      return "audio/wav";
+  }
+}
@@ -0,0 +1,27 @@
+#ifndef AUDIO_ENCODER_H
+#define AUDIO_ENCODER_H
+
+#include "config.h"
+#include <stddef.h>
+#include <stdint.h>
+
+// Mono IMA-ADPCM block: 4 byte header carrying the first sample, then 4 bits per sample
+#define ADPCM_SAMPLES_PER_BLOCK ((ADPCM_BLOCK_ALIGN - 4) * 2 + 1)
+
+typedef struct {
+  uint8_t codec;
+  int32_t predictor;
+  int32_t stepIndex;
+  uint8_t block[ADPCM_BLOCK_ALIGN];
+  size_t blockSamples;
+  uint32_t samplesEncoded;
+} audio_encoder_t;
+
+void encoderBegin(audio_encoder_t* encoder, uint8_t codec);
+size_t encoderProcess(audio_encoder_t* encoder, const int16_t* samples, size_t count,
+                      uint8_t* output, size_t capacity);
+size_t encoderFinish(audio_encoder_t* encoder, uint8_t* output, size_t capacity);
+size_t encoderMaxOutputBytes(uint8_t codec, size_t sampleCount);
+const char* encoderContentType(uint8_t codec);
+
+#endif // AUDIO_ENCODER_H
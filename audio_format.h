@@ -0,0 +1,27 @@
+#ifndef AUDIO_FORMAT_H
+#define AUDIO_FORMAT_H
+
+#include "config.h"
+#include <stdint.h>
+
+// Stream format as a type, so sizes and rates derived from it are
+// compile-time constants wherever the format is known
+template <uint32_t Rate, uint16_t Bits, uint16_t Channels>
+struct audio_format {
+  static_assert(Rate % 1000 == 0, "Sample rate must be a whole number of kHz");
+  static_assert(Bits == 16, "The pipeline carries 16-bit samples");
+
+  static constexpr uint32_t sampleRate = Rate;
+  static constexpr uint16_t bitsPerSample = Bits;
+  static constexpr uint16_t channels = Channels;
+  static constexpr uint16_t frameBytes = Channels * (Bits / 8);
+  static constexpr uint32_t byteRate = Rate * frameBytes;
+  static constexpr uint32_t samplesPerMs = Rate / 1000;
+};
+
+typedef audio_format<SAMPLE_RATE, BITS_PER_SAMPLE, CHANNELS> device_audio_format;
+
+static_assert(SAMPLE_RATE == 8000 || SAMPLE_RATE == 16000 || SAMPLE_RATE == 32000,
+              "Supported builds are 8, 16 and 32 kHz");
+
+#endif // AUDIO_FORMAT_H
@@ -0,0 +1,539 @@
+#include "audio_pipeline.h"
+#include "audio_ring.h"
+#include "audio_preprocess.h"
+#include "power_management.h"
+#include "metrics.h"
+#include "system_events.h"
+#include "config.h"
+#include <atomic>
+#include <freertos/FreeRTOS.h>
+#include <freertos/task.h>
+#include <esp_heap_caps.h>
+#include <esp_timer.h>
+#include <esp_idf_version.h>
+
+// IDF 5 cores get the PDM RX channel driver, whose receive callback hands
+// over each finished DMA buffer by reference. IDF 4.4 cores fall back to the
+// legacy driver in PDM mode.
+#if ESP_IDF_VERSION_MAJOR >= 5
+#define CAPTURE_PDM_CHANNEL 1
+#include <driver/i2s_pdm.h>
+#include <freertos/queue.h>
+#else
+#define CAPTURE_PDM_CHANNEL 0
+#include <driver/i2s.h>
+#endif
+
+#define RING_MASK (PIPELINE_RING_BLOCKS - 1)
+
+static_assert((PIPELINE_RING_BLOCKS & RING_MASK) == 0, "PIPELINE_RING_BLOCKS must be a power of two");
+static_assert(PIPELINE_RING_BLOCKS >= 4, "PIPELINE_RING_BLOCKS too small");
+static_assert(PREROLL_BLOCKS < PIPELINE_RING_BLOCKS / 2, "Ring must hold the pre-roll plus SD stall headroom");
+
+// Each DMA buffer is exactly one pipeline block. The reference queue is two
+// shorter than the descriptor ring and always holds the newest buffers, so
+// a queued buffer stays intact until it is copied: the hardware fills one
+// and the task is copying another.
+#define DMA_BUFFER_SAMPLES PIPELINE_BLOCK_SAMPLES
+#define DMA_LATENCY_BUFFERS ((CAPTURE_DMA_LATENCY_MS * (SAMPLE_RATE / 1000) + DMA_BUFFER_SAMPLES - 1) / DMA_BUFFER_SAMPLES)
+#define DMA_BUFFER_COUNT (DMA_LATENCY_BUFFERS + 2)
+
+static_assert(PIPELINE_BLOCK_SAMPLES <= 1024, "A pipeline block must fit one DMA buffer");
+static_assert(DMA_BUFFER_COUNT <= 128, "CAPTURE_DMA_LATENCY_MS needs more DMA buffers than the driver allows");
+
+// Single producer (capture task) publishes blocks by advancing ringHead.
+// Consumers never block the producer; a consumer that falls a full ring
+// behind loses the oldest blocks and has them counted as dropped.
+// The ring doubles as the pre-roll store, so it lives in PSRAM when present.
+static int16_t (*ringSamples)[PIPELINE_BLOCK_SAMPLES] = NULL;
+static uint16_t ringLengths[PIPELINE_RING_BLOCKS];
+static uint32_t ringGaps[PIPELINE_RING_BLOCKS];
+static std::atomic<uint32_t> ringHead(0);
+
+static uint32_t consumerCursor[PIPELINE_CONSUMER_COUNT];
+static uint32_t consumerDropped[PIPELINE_CONSUMER_COUNT];
+
+static TaskHandle_t captureTaskHandle = NULL;
+static bool pipelineInitialized = false;
+static uint32_t captureReadErrors = 0;
+static capture_overrun_stats_t overrunStats;
+static audio_preprocess_t preprocessState;
+static int64_t firstCaptureUs = 0;
+
+// Pause handshake: the requester waits for capturePaused before stopping I2S,
+// so the task is never waiting on the hardware when the peripheral goes down
+static std::atomic<bool> pauseRequested(false);
+static std::atomic<bool> capturePaused(false);
+static std::atomic<uint32_t> resumeSequence(0);   // First block since capture last (re)started
+
+static uint32_t noteOverruns(uint32_t buffers) {
+  for (uint32_t i = 0; i < buffers; i++) {
+    overrunStats.overruns++;
+    overrunStats.lostSamples += DMA_BUFFER_SAMPLES;
+    overrunStats.recentMs[overrunStats.recentCount % CAPTURE_OVERRUN_LOG] = millis();
+    overrunStats.recentCount++;
+    incrementMetricCounter(METRIC_I2S_OVERRUNS);
+  }
+  return buffers * DMA_BUFFER_SAMPLES;
+}
+
+#if CAPTURE_PDM_CHANNEL
+
+typedef struct {
+  const int16_t* samples;
+  size_t bytes;
+} dma_block_ref_t;
+
+static i2s_chan_handle_t rxChannel = NULL;
+static QueueHandle_t dmaQueue = NULL;
+static volatile uint32_t isrOverruns = 0;
+static uint32_t seenOverruns = 0;
+
+// ISR: publish the finished buffer. When the task is so far behind that the
+// queue is full, the oldest reference is dropped and counted: its buffer is
+// the next one the DMA refills, while the new one stays valid longest.
+static bool IRAM_ATTR onDmaReceive(i2s_chan_handle_t handle, i2s_event_data_t* event, void* context) {
+  // event->data points at the descriptor's buffer pointer, not the samples
+  dma_block_ref_t ref = { *(const int16_t**)event->data, event->size };
+  BaseType_t woken = pdFALSE;
+  
+  if (xQueueSendFromISR(dmaQueue, &ref, &woken) != pdTRUE) {
+    dma_block_ref_t stale;
+    if (xQueueReceiveFromISR(dmaQueue, &stale, &woken) == pdTRUE) {
+      isrOverruns = isrOverruns + 1;
+    }
+    if (xQueueSendFromISR(dmaQueue, &ref, &woken) != pdTRUE) {
+      isrOverruns = isrOverruns + 1;
+    }
+  }
+  return woken == pdTRUE;
+}
+
+static uint32_t collectOverruns() {
+  uint32_t total = isrOverruns;
+  uint32_t dropped = total - seenOverruns;
+  seenOverruns = total;
+  return noteOverruns(dropped);
+}
+
+static bool installCapture() {
+  dmaQueue = xQueueCreate(DMA_BUFFER_COUNT - 2, sizeof(dma_block_ref_t));
+  if (!dmaQueue) {
+    DEBUG_PRINTLN("Failed to create DMA queue");
+    return false;
+  }
+  
+  i2s_chan_config_t channelConfig = I2S_CHANNEL_DEFAULT_CONFIG(I2S_PORT, I2S_ROLE_MASTER);
+  channelConfig.dma_desc_num = DMA_BUFFER_COUNT;
+  channelConfig.dma_frame_num = DMA_BUFFER_SAMPLES;
+  
+  esp_err_t err = i2s_new_channel(&channelConfig, NULL, &rxChannel);
+  if (err != ESP_OK) {
+    DEBUG_PRINTF("Failed to create I2S channel: %s\n", esp_err_to_name(err));
+    return false;
+  }
+  
+  i2s_pdm_rx_config_t pdmConfig = {
+    .clk_cfg = I2S_PDM_RX_CLK_DEFAULT_CONFIG(SAMPLE_RATE),
+    .slot_cfg = I2S_PDM_RX_SLOT_DEFAULT_CONFIG(I2S_DATA_BIT_WIDTH_16BIT, I2S_SLOT_MODE_MONO),
+    .gpio_cfg = {
+      .clk = (gpio_num_t)PDM_CLK_PIN,
+      .din = (gpio_num_t)PDM_DATA_PIN,
+      .invert_flags = { .clk_inv = false },
+    },
+  };
+  
+  i2s_event_callbacks_t callbacks = {};
+  callbacks.on_recv = onDmaReceive;
+  
+  err = i2s_channel_init_pdm_rx_mode(rxChannel, &pdmConfig);
+  if (err == ESP_OK) {
+    err = i2s_channel_register_event_callback(rxChannel, &callbacks, NULL);
+  }
+  if (err == ESP_OK) {
+    err = i2s_channel_enable(rxChannel);
+  }
+  if (err != ESP_OK) {
+    DEBUG_PRINTF("Failed to start PDM capture: %s\n", esp_err_to_name(err));
+    i2s_del_channel(rxChannel);
+    rxChannel = NULL;
+    return false;
+  }
+  
+  return true;
+}
+
+static void uninstallCapture() {
+  i2s_channel_disable(rxChannel);
+  i2s_del_channel(rxChannel);
+  rxChannel = NULL;
+}
+
+// The one copy on the capture path: DMA buffer to ring slot. The ring has
+// to outlive the DMA buffers by seconds for pre-roll and SD stalls.
+static bool captureBlock(int16_t* dest, size_t* samples) {
+  dma_block_ref_t ref;
+  if (xQueueReceive(dmaQueue, &ref, pdMS_TO_TICKS(CAPTURE_READ_TIMEOUT_MS)) != pdTRUE) {
+    return false;
+  }
+  
+  size_t bytes = MIN(ref.bytes, sizeof(int16_t) * PIPELINE_BLOCK_SAMPLES);
+  memcpy(dest, ref.samples, bytes);
+  *samples = bytes / sizeof(int16_t);
+  return true;
+}
+
+static void stopCaptureHardware() {
+  i2s_channel_disable(rxChannel);
+}
+
+static void startCaptureHardware() {
+  // References queued before the stop point at buffers about to be reused
+  xQueueReset(dmaQueue);
+  i2s_channel_enable(rxChannel);
+}
+
+#else
+
+// The legacy driver posts I2S_EVENT_RX_DONE for every buffer, evicting the
+// oldest event when its queue is full, but I2S_EVENT_RX_Q_OVF only when
+// there is room. The queue is sized for a stall a few times the DMA budget;
+// beyond that the events under-report, so the time the task was away
+// bounds the loss from below as well.
+#define CAPTURE_EVENT_QUEUE_LENGTH (4 * DMA_BUFFER_COUNT)
+#define DMA_BUFFER_US ((int64_t)DMA_BUFFER_SAMPLES * 1000000 / SAMPLE_RATE)
+
+static QueueHandle_t i2sEventQueue = NULL;
+static int64_t lastReadUs = 0;           // 0 after a (re)start: no interval yet
+static uint32_t timedOverruns = 0;
+
+static uint32_t collectOverruns() {
+  uint32_t dropped = 0;
+  i2s_event_t event;
+  
+  while (i2sEventQueue && xQueueReceive(i2sEventQueue, &event, 0) == pdTRUE) {
+    if (event.type == I2S_EVENT_RX_Q_OVF) {
+      dropped++;
+    }
+  }
+  
+  dropped = MAX(dropped, timedOverruns);
+  timedOverruns = 0;
+  return noteOverruns(dropped);
+}
+
+// Away for longer than the DMA ring holds means the excess buffers were
+// overwritten, whether or not their events survived
+static void noteReadInterval() {
+  int64_t now = esp_timer_get_time();
+  if (lastReadUs != 0) {
+    int64_t completed = (now - lastReadUs) / DMA_BUFFER_US;
+    if (completed > DMA_BUFFER_COUNT) {
+      timedOverruns += (uint32_t)(completed - DMA_BUFFER_COUNT);
+    }
+  }
+  lastReadUs = now;
+}
+
+static bool installCapture() {
+  i2s_config_t i2s_config = {
+    .mode = (i2s_mode_t)(I2S_MODE_MASTER | I2S_MODE_RX | I2S_MODE_PDM),
+    .sample_rate = SAMPLE_RATE,
+    .bits_per_sample = I2S_BITS_PER_SAMPLE_16BIT,
+    .channel_format = I2S_CHANNEL_FMT_ONLY_LEFT,
+    .communication_format = I2S_COMM_FORMAT_STAND_I2S,
+    .intr_alloc_flags = ESP_INTR_FLAG_LEVEL1,
+    .dma_buf_count = DMA_BUFFER_COUNT,
+    .dma_buf_len = DMA_BUFFER_SAMPLES,
+    .use_apll = false,
+    .tx_desc_auto_clear = false,
+    .fixed_mclk = 0
+  };
+
+  // PDM uses the WS line as its clock; there is no bit clock
+  i2s_pin_config_t pin_config = {
+    .bck_io_num = I2S_PIN_NO_CHANGE,
+    .ws_io_num = PDM_CLK_PIN,
+    .data_out_num = I2S_PIN_NO_CHANGE,
+    .data_in_num = PDM_DATA_PIN
+  };
+
+  esp_err_t err = i2s_driver_install(I2S_PORT, &i2s_config, CAPTURE_EVENT_QUEUE_LENGTH, &i2sEventQueue);
+  if (err != ESP_OK) {
+    DEBUG_PRINTF("Failed to install I2S driver: %s\n", esp_err_to_name(err));
+    return false;
+  }
+
+  err = i2s_set_pin(I2S_PORT, &pin_config);
+  if (err != ESP_OK) {
+    DEBUG_PRINTF("Failed to set I2S pins: %s\n", esp_err_to_name(err));
+    i2s_driver_uninstall(I2S_PORT);
+    return false;
+  }
+
+  return true;
+}
+
+static void uninstallCapture() {
+  i2s_driver_uninstall(I2S_PORT);
+}
+
+static bool captureBlock(int16_t* dest, size_t* samples) {
+  size_t bytesRead = 0;
+  esp_err_t err = i2s_read(I2S_PORT, dest, sizeof(int16_t) * PIPELINE_BLOCK_SAMPLES,
+                           &bytesRead, pdMS_TO_TICKS(CAPTURE_READ_TIMEOUT_MS));
+  *samples = bytesRead / sizeof(int16_t);
+  
+  bool captured = err == ESP_OK && bytesRead > 0;
+  if (captured) {
+    noteReadInterval();
+  }
+  return captured;
+}
+
+static void stopCaptureHardware() {
+  i2s_stop(I2S_PORT);
+}
+
+static void startCaptureHardware() {
+  // Time spent paused is not loss
+  lastReadUs = 0;
+  timedOverruns = 0;
+  i2s_zero_dma_buffer(I2S_PORT);
+  i2s_start(I2S_PORT);
+}
+
+#endif
+
+static void captureTask(void* param) {
+  // I2S DMA stops in light sleep, so capture keeps the chip awake for good
+  acquirePowerLock(POWER_LOCK_AUDIO_CAPTURE);
+  
+  for (;;) {
+    if (pauseRequested.load(std::memory_order_acquire)) {
+      releasePowerLock(POWER_LOCK_AUDIO_CAPTURE);
+      capturePaused.store(true, std::memory_order_release);
+      
+      while (pauseRequested.load(std::memory_order_acquire)) {
+        ulTaskNotifyTake(pdTRUE, portMAX_DELAY);
+      }
+      
+      capturePaused.store(false, std::memory_order_release);
+      acquirePowerLock(POWER_LOCK_AUDIO_CAPTURE);
+    }
+    
+    uint32_t head = ringHead.load(std::memory_order_relaxed);
+    uint32_t slot = head & RING_MASK;
+    uint32_t gap = collectOverruns();
+
+    size_t samples = 0;
+    int64_t waitStart = esp_timer_get_time();
+    bool captured = captureBlock(ringSamples[slot], &samples);
+    recordMetric(METRIC_I2S_WAIT, (uint32_t)(esp_timer_get_time() - waitStart));
+
+    if (!captured) {
+      captureReadErrors++;
+      continue;
+    }
+
+    // In place and only once; every consumer reads the cleaned block
+    uint32_t preprocessStart = metricsCycleCount();
+    preprocessBlock(&preprocessState, ringSamples[slot], samples);
+    recordMetricCycles(METRIC_PREPROCESS, preprocessStart);
+
+    ringLengths[slot] = samples;
+    ringGaps[slot] = gap + collectOverruns();
+    ringHead.store(head + 1, std::memory_order_release);
+    postSystemEvents(SYSTEM_EVENT_AUDIO_BLOCK);
+
+    if (firstCaptureUs == 0) {
+      firstCaptureUs = esp_timer_get_time();
+    }
+  }
+}
+
+static bool allocateRing() {
+  if (ringSamples) {
+    return true;
+  }
+
+  size_t ringBytes = sizeof(int16_t) * PIPELINE_BLOCK_SAMPLES * PIPELINE_RING_BLOCKS;
+
+  if (PIPELINE_RING_IN_PSRAM) {
+    ringSamples = (int16_t (*)[PIPELINE_BLOCK_SAMPLES])heap_caps_malloc(ringBytes, MALLOC_CAP_SPIRAM | MALLOC_CAP_8BIT);
+  }
+
+  if (!ringSamples) {
+    ringSamples = (int16_t (*)[PIPELINE_BLOCK_SAMPLES])heap_caps_malloc(ringBytes, MALLOC_CAP_INTERNAL | MALLOC_CAP_8BIT);
+    if (!ringSamples) {
+      DEBUG_PRINTF("Failed to allocate %u byte audio ring\n", ringBytes);
+      return false;
+    }
+    DEBUG_PRINTLN("PSRAM unavailable, audio ring allocated in internal RAM");
+  }
+
+  return true;
+}
+
+bool initializeAudioPipeline() {
+  if (pipelineInitialized) {
+    return true;
+  }
+
+  if (!allocateRing()) {
+    return false;
+  }
+
+  if (!installCapture()) {
+    return false;
+  }
+
+  preprocessBegin(&preprocessState, PREPROCESS_HIGHPASS_HZ, PREPROCESS_AGC_ENABLED);
+  ringHead.store(0, std::memory_order_relaxed);
+  for (int i = 0; i < PIPELINE_CONSUMER_COUNT; i++) {
+    consumerCursor[i] = 0;
+    consumerDropped[i] = 0;
+  }
+
+  BaseType_t created = xTaskCreatePinnedToCore(captureTask, "audio_capture",
+                                               CAPTURE_TASK_STACK_SIZE, NULL,
+                                               CAPTURE_TASK_PRIORITY, &captureTaskHandle,
+                                               CAPTURE_TASK_CORE);
+  if (created != pdPASS) {
+    DEBUG_PRINTLN("Failed to create audio capture task");
+    uninstallCapture();
+    return false;
+  }
+
+  pipelineInitialized = true;
+  DEBUG_PRINTF("Audio pipeline started on core %d (%d x %d samples, DMA %d x %d, %s)\n",
+               CAPTURE_TASK_CORE, PIPELINE_RING_BLOCKS, PIPELINE_BLOCK_SAMPLES,
+               DMA_BUFFER_COUNT, DMA_BUFFER_SAMPLES, CAPTURE_PDM_CHANNEL ? "PDM channel" : "legacy PDM");
+  return true;
+}
+
+// Stops I2S and parks the capture task so the chip may light sleep. Blocks
+// already in the ring stay readable.
+bool pauseAudioCapture() {
+  if (!pipelineInitialized) {
+    return false;
+  }
+  if (capturePaused.load(std::memory_order_acquire)) {
+    return true;
+  }
+
+  pauseRequested.store(true, std::memory_order_release);
+
+  unsigned long start = millis();
+  while (!capturePaused.load(std::memory_order_acquire)) {
+    if (millis() - start > CAPTURE_READ_TIMEOUT_MS * 2) {
+      pauseRequested.store(false, std::memory_order_release);
+      return false;
+    }
+    delay(1);
+  }
+
+  stopCaptureHardware();
+  return true;
+}
+
+bool resumeAudioCapture() {
+  if (!pipelineInitialized) {
+    return false;
+  }
+  if (!pauseRequested.load(std::memory_order_acquire)) {
+    return true;
+  }
+
+  // Nothing is published while paused, so the next block starts the new run
+  resumeSequence.store(ringHead.load(std::memory_order_acquire), std::memory_order_release);
+  startCaptureHardware();
+  pauseRequested.store(false, std::memory_order_release);
+  xTaskNotifyGive(captureTaskHandle);
+  return true;
+}
+
+bool isAudioCapturePaused() {
+  return capturePaused.load(std::memory_order_acquire);
+}
+
+bool isAudioPipelineRunning() {
+  return pipelineInitialized;
+}
+
+bool acquireAudioBlock(pipeline_consumer_t consumer, audio_block_t* block) {
+  if (!pipelineInitialized || !block) {
+    return false;
+  }
+
+  uint32_t head = ringHead.load(std::memory_order_acquire);
+  uint32_t cursor = consumerCursor[consumer];
+
+  if (cursor == head) {
+    return false;
+  }
+
+  uint32_t skipped = ringCatchUp(head, &cursor, PIPELINE_RING_BLOCKS);
+  if (skipped > 0) {
+    consumerDropped[consumer] += skipped;
+    incrementMetricCounter(METRIC_BLOCKS_DROPPED, skipped);
+    consumerCursor[consumer] = cursor;
+  }
+
+  uint32_t slot = cursor & RING_MASK;
+  block->samples = ringSamples[slot];
+  block->sampleCount = ringLengths[slot];
+  block->sequence = cursor;
+  block->gapSamples = ringGaps[slot];
+  return true;
+}
+
+bool releaseAudioBlock(pipeline_consumer_t consumer, const audio_block_t* block) {
+  consumerCursor[consumer] = block->sequence + 1;
+
+  // The producer starts overwriting a slot once it reaches sequence + ring size
+  uint32_t head = ringHead.load(std::memory_order_acquire);
+  if (ringBlockOverwritten(head, block->sequence, PIPELINE_RING_BLOCKS)) {
+    consumerDropped[consumer]++;
+    incrementMetricCounter(METRIC_BLOCKS_DROPPED);
+    return false;
+  }
+
+  return true;
+}
+
+void syncConsumerToLatest(pipeline_consumer_t consumer) {
+  consumerCursor[consumer] = ringHead.load(std::memory_order_acquire);
+}
+
+uint32_t rewindConsumer(pipeline_consumer_t consumer, uint32_t blocks) {
+  uint32_t head = ringHead.load(std::memory_order_acquire);
+  consumerCursor[consumer] = ringRewindTarget(head, blocks, PIPELINE_RING_BLOCKS,
+                                              resumeSequence.load(std::memory_order_acquire));
+  return head - consumerCursor[consumer];
+}
+
+uint32_t getConsumerPosition(pipeline_consumer_t consumer) {
+  return consumerCursor[consumer];
+}
+
+uint32_t getPipelineDroppedBlocks(pipeline_consumer_t consumer) {
+  return consumerDropped[consumer];
+}
+
+uint32_t getPipelineCapturedBlocks() {
+  return ringHead.load(std::memory_order_relaxed);
+}
+
+// Written by the capture task; a reader may see one overrun half-recorded
+void getCaptureOverrunStats(capture_overrun_stats_t* stats) {
+  if (stats) {
+    *stats = overrunStats;
+  }
+}
+
+// esp_timer time of the first published block, 0 until there is one; its
+// first sample was captured one block duration earlier
+int64_t getFirstCaptureTimeUs() {
+  return firstCaptureUs;
+}
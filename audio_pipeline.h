@@ -0,0 +1,44 @@
+#ifndef AUDIO_PIPELINE_H
+#define AUDIO_PIPELINE_H
+
+#include "config.h"
+
+// Every consumer sees every captured block through its own read cursor.
+typedef enum {
+  PIPELINE_CONSUMER_RECORDER,
+  PIPELINE_CONSUMER_VAD,
+  PIPELINE_CONSUMER_COUNT
+} pipeline_consumer_t;
+
+typedef struct {
+  const int16_t* samples;
+  size_t sampleCount;
+  uint32_t sequence;
+  uint32_t gapSamples;      // Lost to DMA overruns just before this block
+} audio_block_t;
+
+#define CAPTURE_OVERRUN_LOG 8
+
+typedef struct {
+  uint32_t overruns;        // DMA buffers dropped by the driver
+  uint32_t lostSamples;
+  uint32_t recentMs[CAPTURE_OVERRUN_LOG];  // millis() of the latest overruns, circular
+  uint32_t recentCount;
+} capture_overrun_stats_t;
+
+bool initializeAudioPipeline();
+bool isAudioPipelineRunning();
+bool pauseAudioCapture();
+bool resumeAudioCapture();
+bool isAudioCapturePaused();
+bool acquireAudioBlock(pipeline_consumer_t consumer, audio_block_t* block);
+bool releaseAudioBlock(pipeline_consumer_t consumer, const audio_block_t* block);
+void syncConsumerToLatest(pipeline_consumer_t consumer);
+uint32_t rewindConsumer(pipeline_consumer_t consumer, uint32_t blocks);
+uint32_t getConsumerPosition(pipeline_consumer_t consumer);
+uint32_t getPipelineDroppedBlocks(pipeline_consumer_t consumer);
+uint32_t getPipelineCapturedBlocks();
+void getCaptureOverrunStats(capture_overrun_stats_t* stats);
+int64_t getFirstCaptureTimeUs();
+
+#endif // AUDIO_PIPELINE_H
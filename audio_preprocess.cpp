@@ -0,0 +1,107 @@
+#include "audio_preprocess.h"
+#include <math.h>
+
+// DC tracker time constant of 2^shift samples, ~2.5 Hz at every rate
+#define DC_SHIFT (SAMPLE_RATE >= 32000 ? 11 : SAMPLE_RATE >= 16000 ? 10 : 9)
+#define COEFF_SHIFT 20
+#define AGC_UNITY_Q8 256
+
+// Butterworth high-pass (RBJ cookbook, Q = 1/sqrt(2)); coefficients are
+// computed once here so the per-sample path stays integer
+void preprocessBegin(audio_preprocess_t* state, uint32_t highPassHz, bool agc) {
+  state->dc = 0;
+  state->dcSeeded = false;
+  state->highPass = highPassHz > 0 && highPassHz < SAMPLE_RATE / 2;
+  state->agc = agc;
+  state->x1 = state->x2 = state->y1 = state->y2 = 0;
+  state->gainQ8 = AGC_UNITY_Q8;
+  state->clipped = 0;
+
+  state->b0 = state->a1 = state->a2 = 0;
+  if (state->highPass) {
+    double w0 = 2 * M_PI * highPassHz / SAMPLE_RATE;
+    double alpha = sin(w0) / (2 * M_SQRT1_2);
+    double a0 = 1 + alpha;
+    double scale = (double)(1 << COEFF_SHIFT);
+    state->b0 = (int32_t)lrint((1 + cos(w0)) / 2 / a0 * scale);
+    state->a1 = (int32_t)lrint(-2 * cos(w0) / a0 * scale);
+    state->a2 = (int32_t)lrint((1 - alpha) / a0 * scale);
+  }
+}
+
+// Gain moves once per block: down quickly when speech would exceed the
+// target, back up over seconds, and not at all on blocks below the gate so
+// room noise is never pumped up
+static void updateGain(audio_preprocess_t* state, int32_t peak) {
+  if (peak < PREPROCESS_AGC_GATE_LEVEL) {
+    return;
+  }
+
+  uint32_t desired = (uint32_t)PREPROCESS_AGC_TARGET_PEAK * AGC_UNITY_Q8 / (uint32_t)peak;
+  desired = MIN(MAX(desired, (uint32_t)AGC_UNITY_Q8), (uint32_t)(PREPROCESS_AGC_MAX_GAIN * AGC_UNITY_Q8));
+
+  if (desired < state->gainQ8) {
+    state->gainQ8 -= (state->gainQ8 - desired + 3) >> 2;
+  } else {
+    state->gainQ8 += (desired - state->gainQ8) >> 6;
+  }
+}
+
+void preprocessBlock(audio_preprocess_t* state, int16_t* samples, size_t count) {
+  if (count == 0) {
+    return;
+  }
+
+  // Start the tracker on the mic's resting level instead of stepping from 0
+  if (!state->dcSeeded) {
+    state->dc = (int32_t)samples[0] << 12;
+    state->dcSeeded = true;
+  }
+
+  int32_t dc = state->dc;
+  int32_t x1 = state->x1, x2 = state->x2, y1 = state->y1, y2 = state->y2;
+  int32_t gain = (int32_t)state->gainQ8;
+  int32_t peak = 0;
+  uint32_t clipped = 0;
+
+  for (size_t i = 0; i < count; i++) {
+    int32_t diff = ((int32_t)samples[i] << 12) - dc;
+    dc += diff >> DC_SHIFT;
+    int32_t value = diff >> 4;
+
+    if (state->highPass) {
+      int64_t acc = (int64_t)state->b0 * (value - 2 * x1 + x2) -
+                    (int64_t)state->a1 * y1 - (int64_t)state->a2 * y2;
+      x2 = x1;
+      x1 = value;
+      y2 = y1;
+      y1 = (int32_t)((acc + (1 << (COEFF_SHIFT - 1))) >> COEFF_SHIFT);
+      value = y1;
+    }
+
+    int32_t sample = (value + 128) >> 8;
+    int32_t magnitude = sample < 0 ? -sample : sample;
+    peak = MAX(peak, magnitude);
+
+    sample = (sample * gain) >> 8;
+    if (sample > 32767) {
+      sample = 32767;
+      clipped++;
+    } else if (sample < -32768) {
+      sample = -32768;
+      clipped++;
+    }
+    samples[i] = (int16_t)sample;
+  }
+
+  state->dc = dc;
+  state->x1 = x1;
+  state->x2 = x2;
+  state->y1 = y1;
+  state->y2 = y2;
+  state->clipped += clipped;
+
+  if (state->agc) {
+    updateGain(state, peak);
+  }
+}
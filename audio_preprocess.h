@@ -0,0 +1,25 @@
+#ifndef AUDIO_PREPROCESS_H
+#define AUDIO_PREPROCESS_H
+
+#include "config.h"
+#include <stddef.h>
+#include <stdint.h>
+
+// One fused integer pass over each captured block, in place: DC blocker,
+// optional 2nd-order high-pass and a slow AGC with saturation. Runs once in
+// the capture task, so the recorder and the VAD both read clean samples.
+typedef struct {
+  int32_t dc;                // DC estimate, Q12
+  bool dcSeeded;
+  bool highPass;
+  bool agc;
+  int32_t b0, a1, a2;        // High-pass biquad, Q20 (b1 = -2 b0, b2 = b0)
+  int32_t x1, x2, y1, y2;    // Biquad history, Q8 samples
+  uint32_t gainQ8;           // AGC gain, 256 = unity
+  uint32_t clipped;          // Samples saturated since the last begin
+} audio_preprocess_t;
+
+void preprocessBegin(audio_preprocess_t* state, uint32_t highPassHz, bool agc);
+void preprocessBlock(audio_preprocess_t* state, int16_t* samples, size_t count);
+
+#endif // AUDIO_PREPROCESS_H
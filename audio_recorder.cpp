@@ -1,44 +1,110 @@
 #include "audio_recorder.h"
+#include "audio_pipeline.h"
+#include "sd_writer.h"
+#include "sd_manager.h"
+#include "file_pool.h"
+#include "upload_queue.h"
+#include "audio_encoder.h"
+#include "recording_name.h"
+#include "metrics.h"
+#include "system_events.h"
 #include "config.h"
+#include <esp_timer.h>
+#include <esp_system.h>
+#include <mbedtls/sha256.h>
+#include <mbedtls/version.h>
+#include <string.h>
+
+#define BLOCK_BYTES (PIPELINE_BLOCK_SAMPLES * sizeof(int16_t))
+#define STOP_DRAIN_TIMEOUT_MS 1000
+#define GAP_FILL_MAX_SAMPLES ((uint32_t)CAPTURE_GAP_FILL_MAX_MS * (SAMPLE_RATE / 1000))
+#define SEGMENT_SAMPLES ((uint32_t)RECORDING_SEGMENT_MS * (SAMPLE_RATE / 1000))
 
 static File recordingFile;
 static bool recording = false;
 static uint32_t bytesWritten = 0;
 static uint32_t recordingStartTime = 0;
-static int16_t audioBuffer[BUFFER_SIZE];
+static String poolPath = "";
+static uint32_t samplesRecorded = 0;
+static audio_encoder_t encoder;
+static uint8_t encodedBlock[BLOCK_BYTES];
+static uint8_t headerBuffer[sizeof(wav_adpcm_header_t)];
+
+// Lost audio is padded so later samples keep their time position, and each
+// gap is listed in a "gap " chunk written after the data at stop
+typedef struct {
+  uint32_t sampleOffset;
+  uint32_t lostSamples;
+} gap_record_t;
+
+static gap_record_t gapRecords[CAPTURE_MAX_GAP_RECORDS];
+static uint32_t gapCount = 0;
+static uint32_t nextSequence = 0;
+static uint32_t gapNotedSequence = 0xFFFFFFFF;
+static uint32_t fillPending = 0;
+static int16_t fillBlock[PIPELINE_BLOCK_SAMPLES];
+static int16_t lastSample = 0;
+static bool lastSampleValid = false;
+
+// Bytes, samples and gaps above are per segment. Each segment is a complete
+// WAV file, queued for upload as soon as it is closed.
+static char sessionBase[MAX_FILENAME_LENGTH];
+static char segmentPath[MAX_FILENAME_LENGTH];
+static uint32_t sessionId = 0;
+static uint32_t segmentIndex = 0;
+
+// SHA-256 of each segment past its data chunk header, fed as bytes are
+// handed to the writer so the file never has to be read back. mbedtls runs
+// it on the SHA peripheral.
+static mbedtls_sha256_context segmentHash;
+static bool segmentHashing = false;
+
+static void hashBegin() {
+  if (!UPLOAD_DEDUP_ENABLED) {
+    return;
+  }
+  mbedtls_sha256_init(&segmentHash);
+#if MBEDTLS_VERSION_NUMBER >= 0x03000000
+  segmentHashing = mbedtls_sha256_starts(&segmentHash, 0) == 0;
+#else
+  segmentHashing = mbedtls_sha256_starts_ret(&segmentHash, 0) == 0;
+#endif
+}
+
+static void hashAppend(const uint8_t* data, size_t length) {
+  if (!segmentHashing || length == 0) {
+    return;
+  }
+#if MBEDTLS_VERSION_NUMBER >= 0x03000000
+  segmentHashing = mbedtls_sha256_update(&segmentHash, data, length) == 0;
+#else
+  segmentHashing = mbedtls_sha256_update_ret(&segmentHash, data, length) == 0;
+#endif
+}
+
+// False when hashing is off or failed part way
+static bool hashFinish(uint8_t hash[UPLOAD_HASH_LENGTH]) {
+  bool finished = segmentHashing;
+  if (finished) {
+#if MBEDTLS_VERSION_NUMBER >= 0x03000000
+    finished = mbedtls_sha256_finish(&segmentHash, hash) == 0;
+#else
+    finished = mbedtls_sha256_finish_ret(&segmentHash, hash) == 0;
+#endif
+  }
+  if (UPLOAD_DEDUP_ENABLED) {
+    mbedtls_sha256_free(&segmentHash);
+  }
+  segmentHashing = false;
+  return finished;
+}
 
 bool initializeAudio() {
-  i2s_config_t i2s_config = {
-    .mode = (i2s_mode_t)(I2S_MODE_MASTER | I2S_MODE_RX),
-    .sample_rate = SAMPLE_RATE,
-    .bits_per_sample = I2S_BITS_PER_SAMPLE_16BIT,
-    .channel_format = I2S_CHANNEL_FMT_ONLY_LEFT,
-    .communication_format = I2S_COMM_FORMAT_STAND_I2S,
-    .intr_alloc_flags = ESP_INTR_FLAG_LEVEL1,
-    .dma_buf_count = 4,
-    .dma_buf_len = BUFFER_SIZE,
-    .use_apll = false,
-    .tx_desc_auto_clear = false,
-    .fixed_mclk = 0
-  };
-
-  i2s_pin_config_t pin_config = {
-    .bck_io_num = I2S_SCK_PIN,
-    .ws_io_num = I2S_WS_PIN,
-    .data_out_num = I2S_PIN_NO_CHANGE,
-    .data_in_num = I2S_SD_PIN
-  };
-
-  esp_err_t err = i2s_driver_install(I2S_PORT, &i2s_config, 0, NULL);
-  if (err != ESP_OK) {
-    DEBUG_PRINTF("Failed to install I2S driver: %s\n", esp_err_to_name(err));
+  if (!initializeSDWriter()) {
     return false;
   }
 
-  err = i2s_set_pin(I2S_PORT, &pin_config);
-  if (err != ESP_OK) {
-    DEBUG_PRINTF("Failed to set I2S pins: %s\n", esp_err_to_name(err));
-    i2s_driver_uninstall(I2S_PORT);
+  if (!initializeAudioPipeline()) {
     return false;
   }
 
@@ -46,118 +112,329 @@ bool initializeAudio() {
   return true;
 }
 
-wav_header_t createWAVHeader(uint32_t dataSize) {
-  wav_header_t header;
-  
-  memcpy(header.chunkID, "RIFF", 4);
-  header.chunkSize = 36 + dataSize;
-  memcpy(header.format, "WAVE", 4);
-  
-  memcpy(header.subchunk1ID, "fmt ", 4);
-  header.subchunk1Size = 16;
-  header.audioFormat = 1; // PCM
-  header.numChannels = CHANNELS;
-  header.sampleRate = SAMPLE_RATE;
-  header.byteRate = SAMPLE_RATE * CHANNELS * (BITS_PER_SAMPLE / 8);
-  header.blockAlign = CHANNELS * (BITS_PER_SAMPLE / 8);
-  header.bitsPerSample = BITS_PER_SAMPLE;
-  
-  memcpy(header.subchunk2ID, "data", 4);
-  header.subchunk2Size = dataSize;
-  
-  return header;
-}
-
-bool startRecording(const String& filename) {
-  if (recording) {
-    DEBUG_PRINTLN("Already recording");
+static bool openSegment() {
+  if (RECORDING_SEGMENT_MS == 0) {
+    snprintf(segmentPath, sizeof(segmentPath), "%s", sessionBase);
+  } else if (!formatSegmentName(segmentPath, sizeof(segmentPath), sessionBase, sessionId, segmentIndex)) {
+    DEBUG_PRINTF("Segment name too long: %s\n", sessionBase);
     return false;
   }
 
-  recordingFile = SD.open(filename, FILE_WRITE);
+  // Prefer a preallocated pool file, opened without truncation so writes
+  // reuse its clusters; fall back to a fresh file when the pool is empty
+  if (claimPoolFile(poolPath)) {
+    recordingFile = getStorage().open(poolPath, "r+");
+    if (!recordingFile) {
+      DEBUG_PRINTF("Failed to open pool file: %s\n", poolPath.c_str());
+      releasePoolFile(poolPath);
+      poolPath = "";
+    }
+  }
+
+  if (!recordingFile) {
+    recordingFile = getStorage().open(segmentPath, FILE_WRITE);
+  }
+
+  // The date directory is missing after midnight or a warm boot
+  if (!recordingFile) {
+    upload_path_t directory;
+    snprintf(directory, sizeof(directory), "%s", segmentPath);
+    char* slash = strrchr(directory, '/');
+    if (slash && slash != directory) {
+      *slash = '\0';
+      if (createDirectoryPath(directory)) {
+        recordingFile = getStorage().open(segmentPath, FILE_WRITE);
+      }
+    }
+  }
+
   if (!recordingFile) {
-    DEBUG_PRINTF("Failed to create recording file: %s\n", filename.c_str());
+    DEBUG_PRINTF("Failed to create recording file: %s\n", segmentPath);
+    reportStorageError();
     return false;
   }
 
-  wav_header_t header = createWAVHeader(0);
-  size_t written = recordingFile.write((uint8_t*)&header, sizeof(header));
-  if (written != sizeof(header)) {
+  // The header goes through the writer so audio writes stay buffer-aligned
+  size_t headerSize = fillWAVHeader(headerBuffer, 0, 0, 0);
+  if (!sdWriterBegin(&recordingFile) || !sdWriterAppend(headerBuffer, headerSize)) {
     DEBUG_PRINTLN("Failed to write WAV header");
     recordingFile.close();
+    if (poolPath.length() > 0) {
+      releasePoolFile(poolPath);
+      poolPath = "";
+    }
     return false;
   }
 
-  esp_err_t err = i2s_start(I2S_PORT);
-  if (err != ESP_OK) {
-    DEBUG_PRINTF("Failed to start I2S: %s\n", esp_err_to_name(err));
-    recordingFile.close();
+  encoderBegin(&encoder, AUDIO_CODEC);
+  hashBegin();
+  bytesWritten = 0;
+  samplesRecorded = 0;
+  gapCount = 0;
+  return true;
+}
+
+bool startRecording(const String& filename) {
+  if (recording) {
+    DEBUG_PRINTLN("Already recording");
+    return false;
+  }
+
+  snprintf(sessionBase, sizeof(sessionBase), "%s", filename.c_str());
+  sessionId = esp_random();
+  segmentIndex = 0;
+
+  if (!openSegment()) {
     return false;
   }
 
+  // Start from audio already captured while listening so the onset is kept
+  uint32_t prerollBlocks = rewindConsumer(PIPELINE_CONSUMER_RECORDER, PREROLL_BLOCKS);
+  nextSequence = getConsumerPosition(PIPELINE_CONSUMER_RECORDER);
+  gapNotedSequence = nextSequence - 1;
+  fillPending = 0;
+  lastSampleValid = false;
+
   recording = true;
-  bytesWritten = 0;
   recordingStartTime = millis();
   
-  DEBUG_PRINTF("Started recording to: %s\n", filename.c_str());
+  DEBUG_PRINTF("Started recording to: %s (pre-roll %lu ms)\n", segmentPath,
+               prerollBlocks * PIPELINE_BLOCK_SAMPLES * 1000UL / SAMPLE_RATE);
   return true;
 }
 
-bool continueRecording() {
-  if (!recording) {
+static bool appendSamples(const int16_t* samples, size_t count) {
+  const uint8_t* data = (const uint8_t*)samples;
+  size_t length = count * sizeof(int16_t);
+  if (AUDIO_CODEC != CODEC_PCM) {
+    length = encoderProcess(&encoder, samples, count, encodedBlock, sizeof(encodedBlock));
+    data = encodedBlock;
+  }
+  
+  if (length > 0 && !sdWriterAppend(data, length)) {
+    DEBUG_PRINTLN("Failed to write audio data to file");
     return false;
   }
+  
+  hashAppend(data, length);
+  bytesWritten += length;
+  samplesRecorded += count;
+  return true;
+}
 
-  size_t bytesRead = 0;
-  esp_err_t err = i2s_read(I2S_PORT, audioBuffer, sizeof(audioBuffer), &bytesRead, portMAX_DELAY);
+// Counts samples missing before this block, from DMA overruns or blocks the
+// recorder lost to the ring, and queues the padding for them
+static void noteGap(const audio_block_t* block) {
+  uint32_t lost = block->gapSamples;
+  if (block->sequence != nextSequence) {
+    lost += (block->sequence - nextSequence) * PIPELINE_BLOCK_SAMPLES;
+  }
+  gapNotedSequence = block->sequence;
   
-  if (err != ESP_OK) {
-    DEBUG_PRINTF("I2S read error: %s\n", esp_err_to_name(err));
-    return false;
+  if (lost == 0) {
+    return;
+  }
+  
+  DEBUG_PRINTF("Audio gap: %lu samples at %lu ms\n", lost,
+               (uint32_t)((uint64_t)samplesRecorded * 1000 / SAMPLE_RATE));
+  
+  if (gapCount < CAPTURE_MAX_GAP_RECORDS) {
+    gapRecords[gapCount].sampleOffset = samplesRecorded;
+    gapRecords[gapCount].lostSamples = lost;
+    gapCount++;
+  } else {
+    // Out of records: fold the rest into the last one
+    gapRecords[gapCount - 1].lostSamples += lost;
+  }
+  
+  // Hold the last sample so the padding sits at the signal's DC level
+  int16_t hold = lastSampleValid ? lastSample : block->samples[0];
+  for (int i = 0; i < PIPELINE_BLOCK_SAMPLES; i++) {
+    fillBlock[i] = hold;
   }
+  fillPending = MIN(lost, GAP_FILL_MAX_SAMPLES);
+}
 
-  if (bytesRead > 0) {
-    size_t written = recordingFile.write((uint8_t*)audioBuffer, bytesRead);
-    if (written != bytesRead) {
-      DEBUG_PRINTLN("Failed to write audio data to file");
+static bool rollSegment();
+
+static bool writePendingBlocks(uint32_t endSequence) {
+  audio_block_t block;
+  size_t blockBytes = encoderMaxOutputBytes(AUDIO_CODEC, PIPELINE_BLOCK_SAMPLES);
+
+  // Blocks the writer has no room for stay in the ring until the card catches up
+  while (sdWriterFreeSpace() >= blockBytes) {
+    if (RECORDING_SEGMENT_MS > 0 && samplesRecorded >= SEGMENT_SAMPLES && !rollSegment()) {
       return false;
     }
     
-    bytesWritten += written;
+    if (fillPending > 0) {
+      uint32_t count = MIN(fillPending, (uint32_t)PIPELINE_BLOCK_SAMPLES);
+      if (!appendSamples(fillBlock, count)) {
+        return false;
+      }
+      fillPending -= count;
+      continue;
+    }
+    
+    if (!acquireAudioBlock(PIPELINE_CONSUMER_RECORDER, &block)) {
+      break;
+    }
+    if ((int32_t)(block.sequence - endSequence) >= 0) {
+      break;
+    }
     
-    if (bytesWritten % (SAMPLE_RATE * 2) == 0) {
-      recordingFile.flush();
+    // Pad first; the block stays unreleased until its gap is written
+    if (block.sequence != gapNotedSequence) {
+      noteGap(&block);
+      if (fillPending > 0) {
+        continue;
+      }
+    }
+
+    bool appended = appendSamples(block.samples, block.sampleCount);
+    lastSample = block.samples[block.sampleCount - 1];
+    lastSampleValid = true;
+    nextSequence = block.sequence + 1;
+
+    if (!releaseAudioBlock(PIPELINE_CONSUMER_RECORDER, &block)) {
+      DEBUG_PRINTF("Audio block %lu overwritten before it was stored\n", block.sequence);
+    }
+
+    if (!appended) {
+      return false;
+    }
+  }
+
+  return !sdWriterHasError();
+}
+
+// "gap " chunk: pairs of little-endian uint32 sample offset and samples lost
+static size_t writeGapChunk() {
+  if (gapCount == 0) {
+    return 0;
+  }
+  
+  uint8_t chunkHeader[WAV_TRAILING_CHUNK_HEADER_MAX];
+  uint32_t payloadSize = gapCount * sizeof(gap_record_t);
+  size_t headerSize = fillTrailingChunkHeader(chunkHeader, "gap ", bytesWritten, payloadSize);
+  
+  size_t written = recordingFile.write(chunkHeader, headerSize);
+  written += recordingFile.write((const uint8_t*)gapRecords, payloadSize);
+  hashAppend(chunkHeader, headerSize);
+  hashAppend((const uint8_t*)gapRecords, payloadSize);
+  return written == headerSize + payloadSize ? written : 0;
+}
+
+// Completes the open segment: encoder tail, buffered data, gap chunk and the
+// final header, then queues it for upload
+static bool closeSegment() {
+  size_t tail = encoderFinish(&encoder, encodedBlock, sizeof(encodedBlock));
+  if (tail > 0) {
+    while (sdWriterFreeSpace() < tail && !sdWriterHasError()) {
+      delay(1);
+    }
+    if (sdWriterAppend(encodedBlock, tail)) {
+      hashAppend(encodedBlock, tail);
+      bytesWritten += tail;
+    }
+  }
+
+  bool dataStored = sdWriterFinish();
+  
+  // The writer leaves the file positioned at the end of the data
+  size_t trailing = dataStored ? writeGapChunk() : 0;
+
+  int64_t headerStart = esp_timer_get_time();
+  recordingFile.seek(0);
+  size_t headerSize = fillWAVHeader(headerBuffer, bytesWritten, samplesRecorded, trailing);
+  size_t written = recordingFile.write(headerBuffer, headerSize);
+  recordMetric(METRIC_HEADER_REWRITE, (uint32_t)(esp_timer_get_time() - headerStart));
+  
+  recordingFile.close();
+  
+  uint8_t hash[UPLOAD_HASH_LENGTH];
+  bool hashed = hashFinish(hash) && dataStored;
+  
+  // Journal first: if power is lost before the rename, the stale record is
+  // dropped at upload time rather than leaving an unqueued recording
+  queueRecording(segmentPath, headerSize + bytesWritten + trailing, hashed ? hash : NULL);
+  
+  if (poolPath.length() > 0) {
+    bool committed = commitPoolFile(poolPath, segmentPath, headerSize + bytesWritten + trailing);
+    poolPath = "";
+    if (!committed) {
+      return false;
     }
   }
+  
+  if (!dataStored || written != headerSize) {
+    DEBUG_PRINTLN("Failed to update WAV header");
+    return false;
+  }
+  
+  DEBUG_PRINTF("Segment closed: %s (%lu ms, %lu gaps)\n", segmentPath,
+               (uint32_t)((uint64_t)samplesRecorded * 1000 / SAMPLE_RATE), gapCount);
+  return true;
+}
 
+// Closes the current segment and opens the next without pausing capture;
+// blocks captured meanwhile wait in the ring
+static bool rollSegment() {
+  if (!closeSegment()) {
+    recording = false;
+    return false;
+  }
+  
+  // The closed segment is already queued, so it can go out while we record
+  postSystemEvents(SYSTEM_EVENT_SEGMENT);
+  
+  segmentIndex++;
+  if (!openSegment()) {
+    recording = false;
+    return false;
+  }
   return true;
 }
 
+bool continueRecording() {
+  if (!recording) {
+    return false;
+  }
+
+  return writePendingBlocks(getPipelineCapturedBlocks());
+}
+
 bool stopRecording() {
   if (!recording) {
     DEBUG_PRINTLN("Not currently recording");
     return false;
   }
 
-  esp_err_t err = i2s_stop(I2S_PORT);
-  if (err != ESP_OK) {
-    DEBUG_PRINTF("Failed to stop I2S: %s\n", esp_err_to_name(err));
+  // Store everything captured up to the stop request, then the partial buffer
+  uint32_t endSequence = getPipelineCapturedBlocks();
+  unsigned long drainStart = millis();
+  while ((int32_t)(getConsumerPosition(PIPELINE_CONSUMER_RECORDER) - endSequence) < 0 &&
+         millis() - drainStart < STOP_DRAIN_TIMEOUT_MS) {
+    if (!writePendingBlocks(endSequence)) {
+      break;
+    }
+    delay(1);
   }
 
-  recordingFile.seek(0);
-  wav_header_t header = createWAVHeader(bytesWritten);
-  size_t written = recordingFile.write((uint8_t*)&header, sizeof(header));
-  
-  recordingFile.close();
+  bool closed = closeSegment();
   recording = false;
   
-  if (written != sizeof(header)) {
-    DEBUG_PRINTLN("Failed to update WAV header");
+  if (!closed) {
     return false;
   }
 
   uint32_t duration = millis() - recordingStartTime;
-  DEBUG_PRINTF("Recording stopped. Duration: %lu ms, Bytes: %lu\n", duration, bytesWritten);
+  DEBUG_PRINTF("Recording stopped. Duration: %lu ms, Segments: %lu\n", duration, segmentIndex + 1);
+  
+  sd_write_stats_t stats;
+  getSDWriteStats(&stats);
+  DEBUG_PRINTF("SD writes: %lu, avg %lu us, max %lu us, max flush %lu us, buffer waits %lu\n",
+               stats.writes, stats.avgWriteUs, stats.maxWriteUs, stats.maxFlushUs, stats.bufferWaits);
   
   return true;
 }
@@ -171,4 +448,8 @@ uint32_t getRecordingDuration() {
     return 0;
   }
   return millis() - recordingStartTime;
+}
+
+uint32_t getRecordingSegmentIndex() {
+  return segmentIndex;
 }
\ No newline at end of file
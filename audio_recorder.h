@@ -2,24 +2,8 @@
 #define AUDIO_RECORDER_H
 
 #include "config.h"
-#include <driver/i2s.h>
-#include <SD.h>
-
-typedef struct {
-  char chunkID[4];
-  uint32_t chunkSize;
-  char format[4];
-  char subchunk1ID[4];
-  uint32_t subchunk1Size;
-  uint16_t audioFormat;
-  uint16_t numChannels;
-  uint32_t sampleRate;
-  uint32_t byteRate;
-  uint16_t blockAlign;
-  uint16_t bitsPerSample;
-  char subchunk2ID[4];
-  uint32_t subchunk2Size;
-} wav_header_t;
+#include "wav_header.h"
+#include <FS.h>
 
 bool initializeAudio();
 bool startRecording(const String& filename);
@@ -27,5 +11,6 @@ bool continueRecording();
 bool stopRecording();
 bool isRecording();
 uint32_t getRecordingDuration();
+uint32_t getRecordingSegmentIndex();
 
 #endif // AUDIO_RECORDER_H
\ No newline at end of file
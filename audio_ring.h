@@ -0,0 +1,40 @@
+#ifndef AUDIO_RING_H
+#define AUDIO_RING_H
+
+#include <stdint.h>
+
+// Cursor arithmetic for the capture ring. Sequences are free-running 32-bit
+// block counters; slot = sequence % ring size, and every difference below is
+// taken modulo 2^32 so wrap-around needs no special case.
+
+// A consumer more than ringBlocks - 1 behind skips ahead; the margin is the
+// slot the producer is filling. Returns the blocks skipped.
+static inline uint32_t ringCatchUp(uint32_t head, uint32_t* cursor, uint32_t ringBlocks) {
+  if (head - *cursor <= ringBlocks - 1) {
+    return 0;
+  }
+  uint32_t resume = head - (ringBlocks - 1);
+  uint32_t skipped = resume - *cursor;
+  *cursor = resume;
+  return skipped;
+}
+
+// True once the producer may have started reusing this block's slot
+static inline bool ringBlockOverwritten(uint32_t head, uint32_t sequence, uint32_t ringBlocks) {
+  return head - sequence >= ringBlocks;
+}
+
+// Cursor position for replaying up to blocks of history; never reaches back
+// before firstContinuous (the first block since capture last started, so
+// older audio across a pause is not spliced on) or into slots about to be
+// reused
+static inline uint32_t ringRewindTarget(uint32_t head, uint32_t blocks, uint32_t ringBlocks,
+                                        uint32_t firstContinuous) {
+  uint32_t available = head - firstContinuous;
+  if (available > ringBlocks - 1) {
+    available = ringBlocks - 1;
+  }
+  return head - (blocks < available ? blocks : available);
+}
+
+#endif // AUDIO_RING_H
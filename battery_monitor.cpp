@@ -0,0 +1,150 @@
+#include "battery_monitor.h"
+#include "config.h"
+#include <atomic>
+#include <freertos/FreeRTOS.h>
+#include <freertos/task.h>
+#include <driver/adc.h>
+#include <esp_adc_cal.h>
+
+static_assert(BATTERY_MEDIAN_SAMPLES % 2 == 1 && BATTERY_MEDIAN_SAMPLES <= 15, "BATTERY_MEDIAN_SAMPLES must be odd and at most 15");
+
+// The whole snapshot packs into one word so loop() reads it with a single
+// atomic load: [15:0] millivolts, [26:16] percent x10, then the flags
+#define SNAPSHOT_MV_MASK 0xFFFFu
+#define SNAPSHOT_PERMILLE_SHIFT 16
+#define SNAPSHOT_PERMILLE_MASK 0x7FFu
+#define SNAPSHOT_LOW (1u << 28)
+#define SNAPSHOT_CRITICAL (1u << 29)
+#define SNAPSHOT_VALID (1u << 31)
+
+static std::atomic<uint32_t> snapshot(0);
+static esp_adc_cal_characteristics_t adcChars;
+static TaskHandle_t monitorTaskHandle = NULL;
+
+static uint32_t filteredMvQ4 = 0;   // IIR state, 1/16 mV
+static bool lowLatched = false;
+static bool criticalLatched = false;
+
+static uint32_t readMedianRaw() {
+  uint16_t samples[BATTERY_MEDIAN_SAMPLES];
+  
+  // Insertion sort as the samples arrive; the list is tiny
+  for (int i = 0; i < BATTERY_MEDIAN_SAMPLES; i++) {
+    uint16_t raw = (uint16_t)adc1_get_raw(ADC1_CHANNEL_0);
+    int j = i;
+    while (j > 0 && samples[j - 1] > raw) {
+      samples[j] = samples[j - 1];
+      j--;
+    }
+    samples[j] = raw;
+  }
+  
+  return samples[BATTERY_MEDIAN_SAMPLES / 2];
+}
+
+static uint32_t percentPermille(uint32_t millivolts) {
+  if (millivolts >= BATTERY_FULL_MV) {
+    return 1000;
+  }
+  if (millivolts <= BATTERY_EMPTY_MV) {
+    return 0;
+  }
+  return (millivolts - BATTERY_EMPTY_MV) * 1000 / (BATTERY_FULL_MV - BATTERY_EMPTY_MV);
+}
+
+// Enter below the threshold, leave only once the charge is clearly back
+static bool applyHysteresis(bool latched, uint32_t permille, float threshold) {
+  uint32_t enter = (uint32_t)(threshold * 10);
+  uint32_t leave = (uint32_t)((threshold + BATTERY_HYSTERESIS_PERCENT) * 10);
+  return latched ? permille < leave : permille < enter;
+}
+
+static void measureBattery() {
+  uint32_t adcMv = esp_adc_cal_raw_to_voltage(readMedianRaw(), &adcChars);
+  uint32_t packMv = (uint32_t)(adcMv * BATTERY_VOLTAGE_DIVIDER);
+  
+  if (!(snapshot.load(std::memory_order_relaxed) & SNAPSHOT_VALID)) {
+    filteredMvQ4 = packMv << 4;
+  } else {
+    // y += (x - y) / 2^BATTERY_IIR_SHIFT, kept in Q4 so small steps survive
+    int32_t delta = (int32_t)(packMv << 4) - (int32_t)filteredMvQ4;
+    filteredMvQ4 = (uint32_t)((int32_t)filteredMvQ4 + delta / (1 << BATTERY_IIR_SHIFT));
+  }
+  
+  uint32_t millivolts = MIN(filteredMvQ4 >> 4, SNAPSHOT_MV_MASK);
+  uint32_t permille = percentPermille(millivolts);
+  lowLatched = applyHysteresis(lowLatched, permille, LOW_BATTERY_THRESHOLD);
+  criticalLatched = applyHysteresis(criticalLatched, permille, CRITICAL_BATTERY_THRESHOLD);
+  
+  uint32_t word = millivolts | (permille << SNAPSHOT_PERMILLE_SHIFT) | SNAPSHOT_VALID;
+  if (lowLatched) {
+    word |= SNAPSHOT_LOW;
+  }
+  if (criticalLatched) {
+    word |= SNAPSHOT_CRITICAL;
+  }
+  snapshot.store(word, std::memory_order_release);
+}
+
+static void monitorTask(void* param) {
+  TickType_t lastWake = xTaskGetTickCount();
+  for (;;) {
+    measureBattery();
+    vTaskDelayUntil(&lastWake, pdMS_TO_TICKS(BATTERY_SAMPLE_INTERVAL_MS));
+  }
+}
+
+bool startBatteryMonitor() {
+  if (monitorTaskHandle) {
+    return true;
+  }
+  
+  adc1_config_width(ADC_WIDTH_BIT_12);
+  adc1_config_channel_atten(ADC1_CHANNEL_0, ADC_ATTEN_DB_11);
+  esp_adc_cal_characterize(ADC_UNIT_1, ADC_ATTEN_DB_11, ADC_WIDTH_BIT_12, 1100, &adcChars);
+  
+  // Seed the snapshot before the state machine's first look
+  measureBattery();
+  
+  BaseType_t created = xTaskCreatePinnedToCore(monitorTask, "battery",
+                                               BATTERY_TASK_STACK_SIZE, NULL,
+                                               BATTERY_TASK_PRIORITY, &monitorTaskHandle,
+                                               BATTERY_TASK_CORE);
+  if (created != pdPASS) {
+    DEBUG_PRINTLN("Failed to create battery monitor task");
+    monitorTaskHandle = NULL;
+    return false;
+  }
+  
+  return true;
+}
+
+void getBatterySnapshot(battery_snapshot_t* out) {
+  if (!out) {
+    return;
+  }
+  
+  uint32_t word = snapshot.load(std::memory_order_acquire);
+  out->valid = (word & SNAPSHOT_VALID) != 0;
+  out->millivolts = (uint16_t)(word & SNAPSHOT_MV_MASK);
+  out->percentage = ((word >> SNAPSHOT_PERMILLE_SHIFT) & SNAPSHOT_PERMILLE_MASK) / 10.0f;
+  out->low = (word & SNAPSHOT_LOW) != 0;
+  out->critical = (word & SNAPSHOT_CRITICAL) != 0;
+}
+
+float getBatteryVoltage() {
+  return (snapshot.load(std::memory_order_acquire) & SNAPSHOT_MV_MASK) / 1000.0f;
+}
+
+float getBatteryPercentage() {
+  uint32_t word = snapshot.load(std::memory_order_acquire);
+  return ((word >> SNAPSHOT_PERMILLE_SHIFT) & SNAPSHOT_PERMILLE_MASK) / 10.0f;
+}
+
+bool isBatteryLow() {
+  return (snapshot.load(std::memory_order_acquire) & SNAPSHOT_LOW) != 0;
+}
+
+bool isBatteryCritical() {
+  return (snapshot.load(std::memory_order_acquire) & SNAPSHOT_CRITICAL) != 0;
+}
@@ -0,0 +1,21 @@
+#ifndef BATTERY_MONITOR_H
+#define BATTERY_MONITOR_H
+
+#include "config.h"
+
+typedef struct {
+  bool valid;               // False until the first measurement lands
+  uint16_t millivolts;      // Filtered pack voltage
+  float percentage;
+  bool low;                 // LOW_BATTERY_THRESHOLD with hysteresis
+  bool critical;            // CRITICAL_BATTERY_THRESHOLD with hysteresis
+} battery_snapshot_t;
+
+bool startBatteryMonitor();
+void getBatterySnapshot(battery_snapshot_t* snapshot);
+float getBatteryVoltage();
+float getBatteryPercentage();
+bool isBatteryLow();
+bool isBatteryCritical();
+
+#endif // BATTERY_MONITOR_H
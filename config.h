@@ -5,47 +5,150 @@
 #define WIFI_SSID "YourWiFiNetwork"
 #define WIFI_PASSWORD "YourWiFiPassword"
 #define WIFI_TIMEOUT_MS 30000
+#define WIFI_FAST_CONNECT true                     // Reuse the last BSSID and channel, no scan
+#define WIFI_FAST_CONNECT_TIMEOUT_MS 3000          // Before falling back to a full scan
+#define WIFI_FAST_CONNECT_STATIC_IP false          // Also reuse the last DHCP lease
 
 // API Configuration
 #define API_ENDPOINT "https://api.example.com/upload"
 #define API_TIMEOUT_MS 30000
 #define MAX_UPLOAD_RETRIES 3
+#define UPLOAD_MODE_SINGLE_POST 0
+#define UPLOAD_MODE_RESUMABLE 1                    // tus 1.0 create + PATCH chunks
+#define UPLOAD_MODE UPLOAD_MODE_SINGLE_POST
+#define UPLOAD_CHUNK_SIZE (256 * 1024)
+#define UPLOAD_BATCH_ENABLED false                 // Pack short recordings into one multipart POST
+#define UPLOAD_BATCH_ENDPOINT API_ENDPOINT "/batch"
+#define UPLOAD_BATCH_MAX_BYTES (1024 * 1024)
+#define UPLOAD_DEDUP_ENABLED true                  // SHA-256 while recording; ask before re-sending
+#define UPLOAD_EXISTS_ENDPOINT API_ENDPOINT "/exists"
+// #define API_CA_CERT "-----BEGIN CERTIFICATE-----\n..."  // Verify the server; unset skips verification
 
 // Audio Configuration
-#define SAMPLE_RATE 16000
+#ifndef SAMPLE_RATE
+#define SAMPLE_RATE 16000                          // 8000, 16000 or 32000; may come from the build
+#endif
 #define BITS_PER_SAMPLE 16
 #define CHANNELS 1
 #define I2S_PORT I2S_NUM_0
-#define I2S_WS_PIN 42
-#define I2S_SCK_PIN 41
-#define I2S_SD_PIN 2
+#define PDM_CLK_PIN 42
+#define PDM_DATA_PIN 41
+
+// Audio Encoding
+#define CODEC_PCM 0
+#define CODEC_IMA_ADPCM 1                          // 4:1, WAV format 0x11
+#define CODEC_OPUS 2                               // Needs libopus, not bundled
+#define AUDIO_CODEC CODEC_IMA_ADPCM
+#define ADPCM_BLOCK_ALIGN 256                      // Bytes per ADPCM block (mono)
 
 // Recording Configuration
 #define MAX_RECORDING_DURATION_MS (5 * 60 * 1000)  // 5 minutes
 #define SILENCE_TIMEOUT_MS (3 * 1000)              // 3 seconds
-#define BUFFER_SIZE 1024
+#define RECORDING_SEGMENT_MS (30 * 1000)           // Closed and queued as it fills; 0 = one file
+
+// Audio Pipeline
+#define PIPELINE_BLOCK_SAMPLES (SAMPLE_RATE / 1000 * 32)  // 32 ms, 512 at 16 kHz
+#define PIPELINE_RING_BLOCKS 128                   // Power of two, ~4 s of audio
+#define PIPELINE_RING_IN_PSRAM true                // Falls back to internal RAM
+#define PREROLL_DURATION_MS 1000                   // Audio kept ahead of the trigger
+#define PREROLL_BLOCKS ((PREROLL_DURATION_MS * (SAMPLE_RATE / 1000) + PIPELINE_BLOCK_SAMPLES - 1) / PIPELINE_BLOCK_SAMPLES)
+#define CAPTURE_TASK_CORE 0                        // Arduino loop() runs on core 1
+#define CAPTURE_TASK_PRIORITY (configMAX_PRIORITIES - 2)
+#define CAPTURE_TASK_STACK_SIZE 4096
+#define CAPTURE_READ_TIMEOUT_MS 100
+#define CAPTURE_DMA_LATENCY_MS 200                 // Capture task stall the I2S DMA can absorb
+#define CAPTURE_GAP_FILL_MAX_MS 2000               // Longest gap padded in a recording
+#define CAPTURE_MAX_GAP_RECORDS 32                 // Per recording, in the "gap " chunk
+
+// Capture Pre-processing - once per block in the capture task, before any consumer
+#define PREPROCESS_HIGHPASS_HZ 90                  // 2nd-order high-pass; 0 = DC blocker only
+#define PREPROCESS_AGC_ENABLED false               // VAD levels are absolute; retune them first
+#define PREPROCESS_AGC_TARGET_PEAK 8192            // Block peak the AGC aims for (-12 dBFS)
+#define PREPROCESS_AGC_MAX_GAIN 8
+#define PREPROCESS_AGC_GATE_LEVEL 256              // Quieter blocks leave the gain alone
 
 // Voice Activity Detection
 #define VAD_THRESHOLD 500
-#define VAD_SAMPLE_WINDOW 256
+#define VAD_SAMPLE_WINDOW (SAMPLE_RATE / 1000 * 16)  // 16 ms, 256 at 16 kHz
 #define VAD_NOISE_FLOOR 100
 #define VAD_SENSITIVITY 2.0
+#define VAD_RMS_THRESHOLD 50                       // Tuned in test 6 (KEY_FINDINGS.md)
+#define VAD_VARIANCE_MIN 5000                      // Below this is silence or steady tone
+#define VAD_VARIANCE_MAX 100000                    // Above this is cloth rubbing, knocks
+#define VAD_MODE_ENERGY 0
+#define VAD_MODE_SPECTRAL 1
+#define VAD_MODE VAD_MODE_ENERGY
+#define VAD_SPEECH_BAND_LOW_HZ 300
+#define VAD_SPEECH_BAND_HIGH_HZ 3400
+#define VAD_SPECTRAL_BAND_RATIO 0.6               // Min share of energy in the speech band
+#define VAD_SPECTRAL_FLATNESS_MAX 0.35            // White noise sits near 0.56, voiced speech well below
+#define VAD_ONSET_WINDOWS 2                       // Consecutive speech windows to trigger
+#define VAD_HANGOVER_WINDOWS 10                   // Windows held after speech ends (~160 ms)
+#define VAD_BLOCK_BUDGET_US 3000                  // CPU allowed per pipeline block
+#define VAD_DEBUG_INTERVAL_MS 1000
 
 // Power Management
 #define LOW_BATTERY_THRESHOLD 10.0        // 10%
 #define CRITICAL_BATTERY_THRESHOLD 5.0    // 5%
 #define SLEEP_TIMEOUT_MS (30 * 1000)      // 30 seconds
 #define DEEP_SLEEP_TIMEOUT_MS (5 * 60 * 1000)  // 5 minutes
+#define WARM_BOOT_ENABLED true                 // Timer wakeups reuse state kept in RTC memory
 #define BATTERY_ADC_PIN A0
 #define USB_DETECT_PIN 21
 #define BATTERY_VOLTAGE_DIVIDER 2.0
+#define BATTERY_FULL_MV 4200
+#define BATTERY_EMPTY_MV 3200
+
+// Battery Monitor - sampled off the main loop, median + IIR filtered
+#define BATTERY_SAMPLE_INTERVAL_MS 1000
+#define BATTERY_MEDIAN_SAMPLES 7                   // Odd; rejects single-sample spikes
+#define BATTERY_IIR_SHIFT 3                        // y += (x - y) / 8, ~8 s time constant
+#define BATTERY_HYSTERESIS_PERCENT 3.0             // Charge needed above a threshold to clear it
+#define BATTERY_TASK_CORE 0
+#define BATTERY_TASK_PRIORITY 1
+#define BATTERY_TASK_STACK_SIZE 3072
+
+// Power Profiles - esp_pm frequency range per system state
+#define PM_DFS_ENABLED true
+#define PM_LIGHT_SLEEP_ENABLED true                // Needs a tickless-idle core build, else DFS only
+#define PM_IDLE_MAX_MHZ 80                         // Listening, no voice for SLEEP_TIMEOUT_MS
+#define PM_IDLE_MIN_MHZ 40
+#define PM_LISTENING_MAX_MHZ 80
+#define PM_LISTENING_MIN_MHZ 40
+#define PM_RECORDING_MAX_MHZ 240                   // Encoding + SD writes
+#define PM_RECORDING_MIN_MHZ 80
+#define PM_UPLOADING_MAX_MHZ 240                   // WiFi needs at least 80
+#define PM_UPLOADING_MIN_MHZ 80
+#define PM_REPORT_INTERVAL_MS 60000
+
+// Duty-cycled Listening - on battery in the idle profile, sleep between short
+// capture bursts and escalate to continuous capture on a VAD hit
+#define DUTY_CYCLE_ENABLED true
+#define DUTY_CYCLE_SLEEP_MS 400                    // Worst-case onset delay ~ sleep + burst
+#define DUTY_CYCLE_BURST_MS 128                    // Analysed audio per wake (4 blocks)
+#define DUTY_CYCLE_SETTLE_BLOCKS 1                 // Discarded after restart (PDM filter settling)
+#define DUTY_CYCLE_AUDIT_EVERY 50                  // Every Nth gap is listened through to measure misses; 0 = off
+#define DUTY_CYCLE_REPORT_INTERVAL_MS 60000
+
+// Event Loop - loop() sleeps until one of these or an audio block wakes it
+#define HOUSEKEEPING_INTERVAL_MS 1000              // Battery and power status checks
+#define USB_DEBOUNCE_INTERVAL_MS 100               // USB detect is sampled; GPIO21 is shared with SD CS
+#define USB_DEBOUNCE_SAMPLES 3                     // Agreeing reads before a change counts
+#define ERROR_RECOVERY_INTERVAL_MS (10 * 1000)     // Between recovery attempts in the error state
+
+// Metrics - hot-path histograms; send 'm' over serial to dump, 'r' to reset
+#define METRICS_ENABLED true
+#define METRICS_TELEMETRY_ENABLED true             // X-Telemetry header on uploads
+#define METRICS_SUMMARY_LENGTH 256
+#define METRICS_FALSE_TRIGGER_MS 1000              // Less voice than this counts as a false trigger
 
 // LED Configuration
 #define LED_PIN LED_BUILTIN
 #define LED_BRIGHTNESS 128
 
 // LED Patterns (in milliseconds)
-#define LED_LISTENING_PERIOD 1000    // 1Hz slow pulse
+#define LED_LISTENING_PERIOD 1000    // 1Hz heartbeat
+#define LED_LISTENING_ON_TIME 100    // Flash length per heartbeat
 #define LED_RECORDING_PERIOD 333     // 3Hz fast blink
 #define LED_LOW_BATTERY_PERIOD 200   // 5Hz rapid flash
 #define LED_UPLOADING_ON_TIME 100
@@ -56,7 +159,51 @@
 #define SD_MOSI_PIN 9
 #define SD_MISO_PIN 8
 #define SD_SCK_PIN 7
-#define SD_SPI_FREQ 4000000
+#define SD_SPI_FREQ 4000000                        // Slowest SPI fallback
+#define SD_SPI_FREQ_MAX 20000000                   // First SPI clock tried
+
+// Storage Backend
+#define STORAGE_BACKEND_SPI 0
+#define STORAGE_BACKEND_SDMMC_1BIT 1
+#define STORAGE_BACKEND_SDMMC_4BIT 2
+#define STORAGE_BACKEND STORAGE_BACKEND_SDMMC_1BIT
+#define STORAGE_FALLBACK_TO_SPI true               // Try SPI if SDMMC fails to mount
+#define STORAGE_ERROR_THRESHOLD 3                  // I/O errors before stepping down a mode
+#define SDMMC_CLK_PIN SD_SCK_PIN                   // Sense slot: CLK=7, CMD=9, D0=8, D3=21
+#define SDMMC_CMD_PIN SD_MOSI_PIN
+#define SDMMC_D0_PIN SD_MISO_PIN
+#define SDMMC_D1_PIN -1                            // Only wired on custom carrier boards
+#define SDMMC_D2_PIN -1
+#define SDMMC_D3_PIN SD_CS_PIN
+#define SDMMC_FREQ_KHZ 40000                       // High speed, falls back to 20 MHz
+
+// SD Writer - full, cluster-aligned buffers are handed to a writer task
+#define SD_WRITE_BUFFER_SIZE 16384                 // Multiple of 512, 4096 or 16384 typical
+#define SD_WRITER_TASK_CORE 1
+#define SD_WRITER_TASK_PRIORITY 2                  // Above loop(), below capture
+#define SD_WRITER_TASK_STACK_SIZE 4096
+#define SD_FLUSH_INTERVAL_MS 2000                  // Flush at least this often...
+#define SD_FLUSH_BYTES (256 * 1024)                // ...or after this many bytes
+
+// Upload Streamer - a reader task keeps the next buffers filled from SD while
+// HTTPClient sends the current one
+#define UPLOAD_STREAM_BUFFER_SIZE (16 * 1024)      // 8-32 KB
+#define UPLOAD_STREAM_DEPTH 3                      // Buffers in flight between SD and WiFi
+#define UPLOAD_READER_TASK_CORE 0
+#define UPLOAD_READER_TASK_PRIORITY 1              // Below capture
+#define UPLOAD_READER_TASK_STACK_SIZE 4096
+#define UPLOAD_STREAM_WAIT_MS 100
+
+// Upload Service - uploads run in the background while the device listens
+#define UPLOAD_TASK_CORE 0
+#define UPLOAD_TASK_PRIORITY 1
+#define UPLOAD_TASK_STACK_SIZE 10240               // TLS handshakes run on this stack
+#define UPLOAD_CHECK_INTERVAL_MS 30000
+#define UPLOAD_RECORDING_RATE_KBPS 64              // SD read budget while recording
+#define UPLOAD_IDLE_RATE_KBPS 0                    // 0 = unlimited
+#define UPLOAD_RESPONSE_MAX_BYTES 512              // Response body kept; the rest is discarded
+#define SCRATCH_ARENA_SIZE 4096                    // Per-batch path list and multipart preambles
+#define SCRATCH_ARENA_IN_PSRAM true                // Falls back to internal RAM
 
 // File Management
 #define RECORDINGS_DIR "/recordings"
@@ -64,6 +211,23 @@
 #define CONFIG_FILE "/config.txt"
 #define MAX_FILENAME_LENGTH 64
 
+// Upload Queue
+#define UPLOAD_QUEUE_FILE "/queue.idx"
+#define UPLOAD_QUEUE_COMPACT_RECORDS 256           // Drop the journal once this many are all uploaded
+
+// Retention - uploaded recordings are evicted oldest-first
+#define RETENTION_LOW_WATER_BYTES (100ULL * 1024 * 1024)   // Start evicting below this much free space
+#define RETENTION_HIGH_WATER_BYTES (200ULL * 1024 * 1024)  // ...and stop once this much is free again
+#define RETENTION_MAX_AGE_DAYS 30                          // 0 = no age limit; needs a set clock
+#define RETENTION_BATCH_FILES 16                           // Deletes per maintainRetention() call
+#define RETENTION_CHECK_INTERVAL_MS 10000
+
+// Recording File Pool - preallocated files so recording never grows the FAT chain
+#define FILE_POOL_DIR "/pool"
+#define FILE_POOL_SIZE 2
+#define FILE_POOL_SEGMENT_MS (RECORDING_SEGMENT_MS > 0 ? RECORDING_SEGMENT_MS : MAX_RECORDING_DURATION_MS)
+#define FILE_POOL_FILE_BYTES ((uint32_t)(FILE_POOL_SEGMENT_MS + PREROLL_DURATION_MS + 1000) / 1000 * SAMPLE_RATE * CHANNELS * (BITS_PER_SAMPLE / 8) / (AUDIO_CODEC == CODEC_IMA_ADPCM ? 3 : 1))
+
 // System Configuration
 #define DEBUG_ENABLED true
 #define SERIAL_BAUD_RATE 115200
@@ -0,0 +1,149 @@
+#include "duty_cycle.h"
+#include "audio_pipeline.h"
+#include "voice_detection.h"
+#include "power_management.h"
+#include "config.h"
+
+#define BLOCK_MS ((PIPELINE_BLOCK_SAMPLES * 1000) / SAMPLE_RATE)
+#define BURST_BLOCKS ((DUTY_CYCLE_BURST_MS + BLOCK_MS - 1) / BLOCK_MS)
+
+static uint32_t statCycles = 0;
+static uint32_t statHits = 0;
+static uint64_t statTotalDecisionMs = 0;
+static uint32_t statMaxDecisionMs = 0;
+static uint32_t statSleepMs = 0;
+static uint32_t statAwakeMs = 0;
+static uint32_t statAuditEvents = 0;
+static uint32_t statAuditMisses = 0;
+static unsigned long lastReport = 0;
+
+static bool waitForCapturedBlocks(uint32_t count) {
+  uint32_t target = getPipelineCapturedBlocks() + count;
+  unsigned long start = millis();
+  
+  while ((int32_t)(getPipelineCapturedBlocks() - target) < 0) {
+    if (millis() - start > count * BLOCK_MS + CAPTURE_READ_TIMEOUT_MS) {
+      return false;
+    }
+    delay(1);
+  }
+  
+  return true;
+}
+
+// Restart capture, skip the settling blocks, then run the VAD over a burst
+static bool captureBurst() {
+  resumeAudioCapture();
+  
+  if (!waitForCapturedBlocks(DUTY_CYCLE_SETTLE_BLOCKS)) {
+    return false;
+  }
+  syncConsumerToLatest(PIPELINE_CONSUMER_VAD);
+  
+  if (!waitForCapturedBlocks(BURST_BLOCKS)) {
+    return false;
+  }
+  return detectVoiceActivity();
+}
+
+// Listens straight through one gap to see what the sleeping duty cycle
+// would have missed. Speech seen in the gap is escalated either way.
+static bool runAuditCycle() {
+  unsigned long start = millis();
+  bool gapVoice = false;
+  
+  resumeAudioCapture();
+  syncConsumerToLatest(PIPELINE_CONSUMER_VAD);
+  
+  while (millis() - start < DUTY_CYCLE_SLEEP_MS) {
+    if (detectVoiceActivity()) {
+      gapVoice = true;
+    }
+    delay(BLOCK_MS);
+  }
+  
+  // The burst the sleeping cycle would have taken next
+  bool burstVoice = false;
+  if (waitForCapturedBlocks(BURST_BLOCKS)) {
+    burstVoice = detectVoiceActivity();
+  }
+  
+  if (gapVoice) {
+    statAuditEvents++;
+    if (!burstVoice) {
+      statAuditMisses++;
+    }
+  }
+  
+  statAwakeMs += millis() - start;
+  return gapVoice || burstVoice;
+}
+
+static void reportStats() {
+  if (!DEBUG_ENABLED || millis() - lastReport < DUTY_CYCLE_REPORT_INTERVAL_MS) {
+    return;
+  }
+  
+  duty_cycle_stats_t stats;
+  getDutyCycleStats(&stats);
+  uint32_t total = stats.sleepMs + stats.awakeMs;
+  DEBUG_PRINTF("Duty cycle: %lu cycles, %lu hits, awake %lu%%, decision avg %lu ms max %lu ms, misses %lu/%lu\n",
+               stats.cycles, stats.hits, total > 0 ? stats.awakeMs * 100 / total : 0,
+               stats.avgDecisionMs, stats.maxDecisionMs, stats.auditMisses, stats.auditEvents);
+  lastReport = millis();
+}
+
+// One sleep + burst cycle. Returns true on a VAD hit, with capture left
+// running so the caller can go straight to continuous listening/recording.
+bool runDutyCycleListen() {
+  reportStats();
+  statCycles++;
+  
+  if (DUTY_CYCLE_AUDIT_EVERY > 0 && statCycles % DUTY_CYCLE_AUDIT_EVERY == 0) {
+    bool voice = runAuditCycle();
+    if (voice) {
+      statHits++;
+    }
+    return voice;
+  }
+  
+  if (!pauseAudioCapture()) {
+    return detectVoiceActivity();
+  }
+  
+  unsigned long sleepStart = millis();
+  enterTimedLightSleep(DUTY_CYCLE_SLEEP_MS);
+  unsigned long wake = millis();
+  statSleepMs += wake - sleepStart;
+  
+  bool voice = captureBurst();
+  
+  uint32_t decisionMs = millis() - wake;
+  statAwakeMs += decisionMs;
+  statTotalDecisionMs += decisionMs;
+  statMaxDecisionMs = MAX(statMaxDecisionMs, decisionMs);
+  
+  if (voice) {
+    statHits++;
+    DEBUG_PRINTF("Duty cycle hit after %lu ms awake\n", decisionMs);
+  }
+  
+  return voice;
+}
+
+void getDutyCycleStats(duty_cycle_stats_t* stats) {
+  if (!stats) {
+    return;
+  }
+  
+  uint32_t sleepingCycles = statCycles - (DUTY_CYCLE_AUDIT_EVERY > 0 ? statCycles / DUTY_CYCLE_AUDIT_EVERY : 0);
+  
+  stats->cycles = statCycles;
+  stats->hits = statHits;
+  stats->avgDecisionMs = sleepingCycles > 0 ? (uint32_t)(statTotalDecisionMs / sleepingCycles) : 0;
+  stats->maxDecisionMs = statMaxDecisionMs;
+  stats->sleepMs = statSleepMs;
+  stats->awakeMs = statAwakeMs;
+  stats->auditEvents = statAuditEvents;
+  stats->auditMisses = statAuditMisses;
+}
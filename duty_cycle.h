@@ -0,0 +1,20 @@
+#ifndef DUTY_CYCLE_H
+#define DUTY_CYCLE_H
+
+#include "config.h"
+
+typedef struct {
+  uint32_t cycles;
+  uint32_t hits;              // Bursts that escalated to continuous capture
+  uint32_t avgDecisionMs;     // Wake to VAD decision
+  uint32_t maxDecisionMs;
+  uint32_t sleepMs;
+  uint32_t awakeMs;
+  uint32_t auditEvents;       // Audited gaps that contained speech
+  uint32_t auditMisses;       // ...of which the following burst saw none
+} duty_cycle_stats_t;
+
+bool runDutyCycleListen();
+void getDutyCycleStats(duty_cycle_stats_t* stats);
+
+#endif // DUTY_CYCLE_H
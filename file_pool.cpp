@@ -0,0 +1,167 @@
+#include "file_pool.h"
+#include "sd_manager.h"
+#include "config.h"
+#include <unistd.h>
+
+static bool poolReady[FILE_POOL_SIZE];
+static bool poolClaimed[FILE_POOL_SIZE];
+static bool poolInitialized = false;
+
+static String poolFilePath(int index) {
+  char path[MAX_FILENAME_LENGTH];
+  snprintf(path, sizeof(path), "%s/slot%d.wav", FILE_POOL_DIR, index);
+  return String(path);
+}
+
+static int poolIndexOf(const String& poolPath) {
+  for (int i = 0; i < FILE_POOL_SIZE; i++) {
+    if (poolPath == poolFilePath(i)) {
+      return i;
+    }
+  }
+  return -1;
+}
+
+static bool isPoolFileReady(int index) {
+  File file = getStorage().open(poolFilePath(index), FILE_READ);
+  if (!file) {
+    return false;
+  }
+  
+  bool ready = !file.isDirectory() && file.size() >= FILE_POOL_FILE_BYTES;
+  file.close();
+  return ready;
+}
+
+// Seeking past the end makes FAT allocate the whole cluster chain up front,
+// without writing recording-sized data to the card
+static bool preparePoolFile(int index) {
+  String path = poolFilePath(index);
+  fs::FS& fs = getStorage();
+  
+  unsigned long startTime = millis();
+  File file = fs.open(path, FILE_WRITE);
+  if (!file) {
+    DEBUG_PRINTF("Failed to create pool file: %s\n", path.c_str());
+    reportStorageError();
+    return false;
+  }
+  
+  bool sized = file.seek(FILE_POOL_FILE_BYTES - 1) && file.write((uint8_t)0) == 1;
+  file.close();
+  
+  if (!sized) {
+    DEBUG_PRINTF("Failed to size pool file: %s\n", path.c_str());
+    fs.remove(path);
+    reportStorageError();
+    return false;
+  }
+  
+  DEBUG_PRINTF("Pool file ready: %s (%lu bytes, %lu ms)\n", path.c_str(),
+               (uint32_t)FILE_POOL_FILE_BYTES, millis() - startTime);
+  return true;
+}
+
+bool initializeFilePool() {
+  fs::FS& fs = getStorage();
+  
+  if (!fs.mkdir(FILE_POOL_DIR)) {
+    if (!fs.exists(FILE_POOL_DIR)) {
+      DEBUG_PRINTLN("Failed to create file pool directory");
+      return false;
+    }
+  }
+  
+  for (int i = 0; i < FILE_POOL_SIZE; i++) {
+    poolClaimed[i] = false;
+    poolReady[i] = isPoolFileReady(i) || preparePoolFile(i);
+  }
+  
+  poolInitialized = true;
+  DEBUG_PRINTF("File pool initialized: %d of %d ready\n", getReadyPoolFileCount(), FILE_POOL_SIZE);
+  return true;
+}
+
+// Replaces at most one consumed pool file per call; only call while idle
+bool maintainFilePool() {
+  if (!poolInitialized) {
+    return false;
+  }
+  
+  for (int i = 0; i < FILE_POOL_SIZE; i++) {
+    if (!poolReady[i] && !poolClaimed[i]) {
+      poolReady[i] = preparePoolFile(i);
+      return poolReady[i];
+    }
+  }
+  
+  return true;
+}
+
+bool claimPoolFile(String& poolPath) {
+  if (!poolInitialized) {
+    return false;
+  }
+  
+  for (int i = 0; i < FILE_POOL_SIZE; i++) {
+    if (poolReady[i] && !poolClaimed[i]) {
+      poolReady[i] = false;
+      poolClaimed[i] = true;
+      poolPath = poolFilePath(i);
+      return true;
+    }
+  }
+  
+  DEBUG_PRINTLN("File pool empty");
+  return false;
+}
+
+void releasePoolFile(const String& poolPath) {
+  int index = poolIndexOf(poolPath);
+  if (index >= 0) {
+    poolClaimed[index] = false;
+    poolReady[index] = isPoolFileReady(index);
+  }
+}
+
+bool commitPoolFile(const String& poolPath, const String& filename, uint32_t fileSize) {
+  int index = poolIndexOf(poolPath);
+  if (index < 0) {
+    return false;
+  }
+  
+  poolClaimed[index] = false;
+  
+  // Publish even if the truncate fails: uploads send the journaled size, so
+  // stale pool bytes past the audio never leave the card
+  String fullPath = String(getStorageMountPoint()) + poolPath;
+  if (truncate(fullPath.c_str(), fileSize) != 0) {
+    DEBUG_PRINTF("Failed to truncate pool file: %s\n", poolPath.c_str());
+    reportStorageError();
+  }
+  
+  String directory = filename.substring(0, filename.lastIndexOf('/'));
+  fs::FS& fs = getStorage();
+  if (!fs.exists(directory) && !createDirectoryPath(directory.c_str())) {
+    DEBUG_PRINTF("Failed to create directory: %s\n", directory.c_str());
+    return false;
+  }
+  
+  if (!fs.rename(poolPath, filename)) {
+    DEBUG_PRINTF("Failed to move pool file to: %s\n", filename.c_str());
+    reportStorageError();
+    return false;
+  }
+  
+  return true;
+}
+
+int getReadyPoolFileCount() {
+  int count = 0;
+  for (int i = 0; i < FILE_POOL_SIZE; i++) {
+    if (poolReady[i]) {
+      count++;
+    }
+  }
+  return count;
+}
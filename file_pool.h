@@ -0,0 +1,14 @@
+#ifndef FILE_POOL_H
+#define FILE_POOL_H
+
+#include "config.h"
+#include <FS.h>
+
+bool initializeFilePool();
+bool maintainFilePool();
+bool claimPoolFile(String& poolPath);
+void releasePoolFile(const String& poolPath);
+bool commitPoolFile(const String& poolPath, const String& filename, uint32_t fileSize);
+int getReadyPoolFileCount();
+
+#endif // FILE_POOL_H
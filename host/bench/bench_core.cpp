@@ -0,0 +1,92 @@
+// Microbenchmarks for the per-block hot paths. Host timings do not equal
+// ESP32 timings, but a regression here shows up on the device too.
+//
+//   bench_core [iterations]
+
+#include "vad_kernel.h"
+#include "vad_spectral.h"
+#include "vad_detector.h"
+#include "audio_encoder.h"
+#include "audio_preprocess.h"
+#include "wav_header.h"
+#include "test_signals.h"
+#include <chrono>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#define BENCH_BLOCKS 64
+
+static int16_t audio[PIPELINE_BLOCK_SAMPLES * BENCH_BLOCKS];
+static uint8_t encoded[ADPCM_BLOCK_ALIGN * BENCH_BLOCKS * 4];
+static volatile uint32_t sink = 0;
+
+template <typename Body>
+static void runBenchmark(const char* name, long iterations, size_t samplesPerCall, Body body) {
+  for (long i = 0; i < iterations / 10 + 1; i++) {
+    body(i);
+  }
+  
+  auto start = std::chrono::steady_clock::now();
+  for (long i = 0; i < iterations; i++) {
+    body(i);
+  }
+  double seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+  
+  double nsPerCall = seconds * 1e9 / iterations;
+  if (samplesPerCall == 0) {
+    printf("%-22s %10.0f ns/call\n", name, nsPerCall);
+    return;
+  }
+  double audioSeconds = (double)samplesPerCall * iterations / SAMPLE_RATE;
+  printf("%-22s %10.0f ns/call %10.0fx realtime\n", name, nsPerCall, audioSeconds / seconds);
+}
+
+int main(int argc, char** argv) {
+  long iterations = argc > 1 ? atol(argv[1]) : 200000;
+  
+  fillVoiced(audio, ARRAY_SIZE(audio), 2000, TEST_MIC_DC);
+  initializeSpectralVAD();
+  
+  runBenchmark("vad_window_stats", iterations, VAD_SAMPLE_WINDOW, [](long i) {
+    vad_window_stats_t stats;
+    computeVADWindowStats(audio + (i % BENCH_BLOCKS) * PIPELINE_BLOCK_SAMPLES, VAD_SAMPLE_WINDOW, &stats);
+    sink += stats.variance;
+  });
+  
+  runBenchmark("vad_spectral_features", iterations / 10, VAD_SAMPLE_WINDOW, [](long i) {
+    vad_spectral_features_t features;
+    computeSpectralFeatures(audio + (i % BENCH_BLOCKS) * PIPELINE_BLOCK_SAMPLES, VAD_SAMPLE_WINDOW, &features);
+    sink += (uint32_t)(features.flatness * 1000);
+  });
+  
+  static vad_detector_t detector;
+  vadDetectorReset(&detector, 0);
+  runBenchmark("vad_detector_window", iterations, VAD_SAMPLE_WINDOW, [](long i) {
+    vad_decision_t decision;
+    sink += vadDetectorAnalyze(&detector, audio + (i % BENCH_BLOCKS) * PIPELINE_BLOCK_SAMPLES,
+                               VAD_SAMPLE_WINDOW, (uint32_t)(i * 16), &decision);
+  });
+  
+  static audio_preprocess_t preprocess;
+  static int16_t block[PIPELINE_BLOCK_SAMPLES];
+  preprocessBegin(&preprocess, PREPROCESS_HIGHPASS_HZ, true);
+  runBenchmark("preprocess_block", iterations / 10, PIPELINE_BLOCK_SAMPLES, [](long i) {
+    memcpy(block, audio + (i % BENCH_BLOCKS) * PIPELINE_BLOCK_SAMPLES, sizeof(block));
+    preprocessBlock(&preprocess, block, PIPELINE_BLOCK_SAMPLES);
+    sink += block[0];
+  });
+  
+  static audio_encoder_t encoder;
+  encoderBegin(&encoder, CODEC_IMA_ADPCM);
+  runBenchmark("adpcm_encode_block", iterations / 10, PIPELINE_BLOCK_SAMPLES, [](long i) {
+    sink += encoderProcess(&encoder, audio + (i % BENCH_BLOCKS) * PIPELINE_BLOCK_SAMPLES,
+                           PIPELINE_BLOCK_SAMPLES, encoded, sizeof(encoded));
+  });
+  
+  runBenchmark("wav_header_fill", iterations, 0, [](long i) {
+    sink += fillWAVHeader(encoded, (uint32_t)i, (uint32_t)i, 0);
+  });
+  
+  return sink == 0xFFFFFFFFu ? 1 : 0;
+}
@@ -0,0 +1,208 @@
+// Runs recorded WAV files through the VAD and the recording state logic the
+// firmware uses, and reports what the device would have done with them.
+//
+//   replay [--no-calibration] file.wav [file.wav ...]
+//
+// Files must be 16-bit PCM at SAMPLE_RATE. Like the device after boot, the
+// first 3 s are used to calibrate the noise floor unless --no-calibration.
+// The capture pre-processing runs first, as it does on the device.
+
+#include "vad_detector.h"
+#include "audio_encoder.h"
+#include "audio_preprocess.h"
+#include "wav_header.h"
+#include "wav_reader.h"
+#include <chrono>
+#include <stdio.h>
+#include <string.h>
+
+#define BLOCK_MS (PIPELINE_BLOCK_SAMPLES * 1000 / SAMPLE_RATE)
+#define CALIBRATION_WINDOWS 30
+#define CALIBRATION_SPACING_MS 100
+
+typedef struct {
+  double audioSeconds;
+  double processSeconds;
+  uint32_t triggers;
+  uint32_t falseTriggers;
+  double recordedSeconds;
+  uint64_t bytesWritten;
+} replay_result_t;
+
+static uint32_t blockTimeMs(size_t block) {
+  return (uint32_t)(block * BLOCK_MS);
+}
+
+// Same sampling as calibrateVAD(): one window every 100 ms for 3 s
+static size_t calibrate(vad_detector_t* detector, const std::vector<int16_t>& samples) {
+  size_t spacing = CALIBRATION_SPACING_MS * SAMPLE_RATE / 1000;
+  uint64_t sum = 0;
+  int windows = 0;
+  
+  for (int i = 0; i < CALIBRATION_WINDOWS; i++) {
+    size_t offset = i * spacing;
+    if (offset + VAD_SAMPLE_WINDOW > samples.size()) {
+      break;
+    }
+    vad_window_stats_t stats;
+    computeVADWindowStats(&samples[offset], VAD_SAMPLE_WINDOW, &stats);
+    sum += stats.variance;
+    windows++;
+  }
+  
+  if (windows > 0) {
+    vadDetectorCalibrate(detector, (uint32_t)(sum / windows));
+  }
+  return CALIBRATION_WINDOWS * spacing / PIPELINE_BLOCK_SAMPLES;
+}
+
+static bool analyzeBlock(vad_detector_t* detector, const int16_t* block, size_t count, uint32_t nowMs) {
+  bool voice = false;
+  for (size_t offset = 0; offset < count; offset += VAD_SAMPLE_WINDOW) {
+    vad_decision_t decision;
+    size_t windowCount = MIN((size_t)VAD_SAMPLE_WINDOW, count - offset);
+    if (vadDetectorAnalyze(detector, block + offset, windowCount, nowMs, &decision)) {
+      voice = true;
+    }
+  }
+  return voice;
+}
+
+static void replayFile(const wav_audio_t& audio, bool calibration, replay_result_t* result) {
+  static uint8_t encoded[PIPELINE_BLOCK_SAMPLES * sizeof(int16_t)];
+  std::vector<int16_t> samples = audio.samples;
+  size_t blocks = samples.size() / PIPELINE_BLOCK_SAMPLES;
+  
+  memset(result, 0, sizeof(*result));
+  result->audioSeconds = (double)samples.size() / SAMPLE_RATE;
+  
+  auto start = std::chrono::steady_clock::now();
+  
+  audio_preprocess_t preprocess;
+  preprocessBegin(&preprocess, PREPROCESS_HIGHPASS_HZ, PREPROCESS_AGC_ENABLED);
+  for (size_t b = 0; b < blocks; b++) {
+    preprocessBlock(&preprocess, &samples[b * PIPELINE_BLOCK_SAMPLES], PIPELINE_BLOCK_SAMPLES);
+  }
+  
+  vad_detector_t detector;
+  vadDetectorReset(&detector, 0);
+  size_t firstBlock = calibration ? calibrate(&detector, samples) : 0;
+  
+  audio_encoder_t encoder;
+  bool recording = false;
+  uint32_t recordingStart = 0;
+  uint32_t silenceStart = 0;
+  uint32_t dataBytes = 0;
+  
+  for (size_t b = firstBlock; b < blocks; b++) {
+    const int16_t* block = &samples[b * PIPELINE_BLOCK_SAMPLES];
+    uint32_t now = blockTimeMs(b + 1);
+    bool voice = analyzeBlock(&detector, block, PIPELINE_BLOCK_SAMPLES, now);
+    
+    if (!recording) {
+      if (!voice) {
+        continue;
+      }
+      
+      // The recorder rewinds into the ring for the pre-roll
+      recording = true;
+      recordingStart = now;
+      silenceStart = 0;
+      dataBytes = 0;
+      result->triggers++;
+      encoderBegin(&encoder, AUDIO_CODEC);
+      size_t preroll = MIN((size_t)PREROLL_BLOCKS, b - firstBlock);
+      for (size_t p = b - preroll; p < b; p++) {
+        dataBytes += encoderProcess(&encoder, &samples[p * PIPELINE_BLOCK_SAMPLES],
+                                    PIPELINE_BLOCK_SAMPLES, encoded, sizeof(encoded));
+      }
+    }
+    
+    dataBytes += encoderProcess(&encoder, block, PIPELINE_BLOCK_SAMPLES, encoded, sizeof(encoded));
+    
+    // Mirrors handleRecordingState(): the silence timer starts at the first
+    // silent pass and runs until the recording stops
+    bool stop = now - recordingStart > MAX_RECORDING_DURATION_MS || b + 1 == blocks;
+    if (!voice) {
+      if (silenceStart == 0) {
+        silenceStart = now;
+      } else if (now - silenceStart > SILENCE_TIMEOUT_MS) {
+        if (silenceStart - recordingStart < METRICS_FALSE_TRIGGER_MS) {
+          result->falseTriggers++;
+        }
+        stop = true;
+      }
+    }
+    
+    if (stop) {
+      dataBytes += encoderFinish(&encoder, encoded, sizeof(encoded));
+      uint8_t header[sizeof(wav_adpcm_header_t)];
+      result->bytesWritten += fillWAVHeader(header, dataBytes, encoder.samplesEncoded, 0) + dataBytes;
+      result->recordedSeconds += (double)encoder.samplesEncoded / SAMPLE_RATE;
+      recording = false;
+    }
+  }
+  
+  result->processSeconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+}
+
+static void printResult(const char* name, const replay_result_t& r) {
+  double minutes = r.audioSeconds / 60;
+  printf("%-32s %8.1f %6u %8.2f %6u %9.1f %10llu %9.0fx\n", name, r.audioSeconds, r.triggers,
+         minutes > 0 ? r.triggers / minutes : 0, r.falseTriggers, r.recordedSeconds,
+         (unsigned long long)r.bytesWritten, r.processSeconds > 0 ? r.audioSeconds / r.processSeconds : 0);
+}
+
+int main(int argc, char** argv) {
+  bool calibration = true;
+  replay_result_t total;
+  memset(&total, 0, sizeof(total));
+  int files = 0;
+  int failures = 0;
+  
+  printf("%-32s %8s %6s %8s %6s %9s %10s %10s\n", "file", "audio_s", "trig", "trig/min",
+         "false", "rec_s", "bytes", "speed");
+  
+  for (int i = 1; i < argc; i++) {
+    if (strcmp(argv[i], "--no-calibration") == 0) {
+      calibration = false;
+      continue;
+    }
+    
+    wav_audio_t audio;
+    std::string error;
+    if (!loadWAVFile(argv[i], &audio, &error)) {
+      fprintf(stderr, "%s: %s\n", argv[i], error.c_str());
+      failures++;
+      continue;
+    }
+    if (audio.sampleRate != SAMPLE_RATE) {
+      fprintf(stderr, "%s: %u Hz, expected %d Hz\n", argv[i], audio.sampleRate, SAMPLE_RATE);
+      failures++;
+      continue;
+    }
+    
+    replay_result_t result;
+    replayFile(audio, calibration, &result);
+    const char* name = strrchr(argv[i], '/');
+    printResult(name ? name + 1 : argv[i], result);
+    
+    total.audioSeconds += result.audioSeconds;
+    total.processSeconds += result.processSeconds;
+    total.triggers += result.triggers;
+    total.falseTriggers += result.falseTriggers;
+    total.recordedSeconds += result.recordedSeconds;
+    total.bytesWritten += result.bytesWritten;
+    files++;
+  }
+  
+  if (files == 0 && failures == 0) {
+    fprintf(stderr, "usage: %s [--no-calibration] file.wav [file.wav ...]\n", argv[0]);
+    return 2;
+  }
+  
+  if (files > 1) {
+    printResult("TOTAL", total);
+  }
+  return failures == 0 ? 0 : 1;
+}
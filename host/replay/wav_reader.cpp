@@ -0,0 +1,68 @@
+#include "wav_reader.h"
+#include <algorithm>
+#include <stdio.h>
+#include <string.h>
+
+static uint32_t readLE32(const uint8_t* p) {
+  return p[0] | (p[1] << 8) | (p[2] << 16) | ((uint32_t)p[3] << 24);
+}
+
+static uint16_t readLE16(const uint8_t* p) {
+  return (uint16_t)(p[0] | (p[1] << 8));
+}
+
+bool loadWAVFile(const std::string& path, wav_audio_t* audio, std::string* error) {
+  FILE* file = fopen(path.c_str(), "rb");
+  if (!file) {
+    *error = "cannot open";
+    return false;
+  }
+  
+  std::vector<uint8_t> bytes;
+  uint8_t chunk[65536];
+  size_t got;
+  while ((got = fread(chunk, 1, sizeof(chunk), file)) > 0) {
+    bytes.insert(bytes.end(), chunk, chunk + got);
+  }
+  fclose(file);
+  
+  if (bytes.size() < 12 || memcmp(&bytes[0], "RIFF", 4) != 0 || memcmp(&bytes[8], "WAVE", 4) != 0) {
+    *error = "not a RIFF/WAVE file";
+    return false;
+  }
+  
+  uint16_t format = 0;
+  uint16_t channels = 0;
+  uint16_t bits = 0;
+  size_t offset = 12;
+  
+  while (offset + 8 <= bytes.size()) {
+    const uint8_t* header = &bytes[offset];
+    uint32_t size = readLE32(header + 4);
+    size_t body = offset + 8;
+    size = (uint32_t)std::min<size_t>(size, bytes.size() - body);
+    
+    if (memcmp(header, "fmt ", 4) == 0 && size >= 16) {
+      format = readLE16(&bytes[body]);
+      channels = readLE16(&bytes[body + 2]);
+      audio->sampleRate = readLE32(&bytes[body + 4]);
+      bits = readLE16(&bytes[body + 14]);
+    } else if (memcmp(header, "data", 4) == 0) {
+      if (format != 1 || bits != 16 || channels == 0) {
+        *error = "only 16-bit PCM is supported";
+        return false;
+      }
+      size_t frames = size / (2 * channels);
+      audio->samples.resize(frames);
+      for (size_t i = 0; i < frames; i++) {
+        audio->samples[i] = (int16_t)readLE16(&bytes[body + i * 2 * channels]);
+      }
+      return true;
+    }
+    
+    offset = body + size + (size & 1);
+  }
+  
+  *error = "no data chunk";
+  return false;
+}
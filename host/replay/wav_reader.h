@@ -0,0 +1,17 @@
+#ifndef WAV_READER_H
+#define WAV_READER_H
+
+#include <stdint.h>
+#include <string>
+#include <vector>
+
+// 16-bit PCM WAV loader for the replay driver; multi-channel files keep
+// only the first channel, as the device records mono
+typedef struct {
+  uint32_t sampleRate;
+  std::vector<int16_t> samples;
+} wav_audio_t;
+
+bool loadWAVFile(const std::string& path, wav_audio_t* audio, std::string* error);
+
+#endif // WAV_READER_H
@@ -0,0 +1,46 @@
+#ifndef TEST_HARNESS_H
+#define TEST_HARNESS_H
+
+#include <math.h>
+#include <stdio.h>
+
+// Minimal checks for the host tests; a failed check reports and carries on
+// so one run shows every failure
+static int testFailures = 0;
+
+#define CHECK(cond) \
+  do { \
+    if (!(cond)) { \
+      printf("%s:%d: CHECK(%s) failed\n", __FILE__, __LINE__, #cond); \
+      testFailures++; \
+    } \
+  } while (0)
+
+#define CHECK_EQ(a, b) \
+  do { \
+    long long valueA = (long long)(a); \
+    long long valueB = (long long)(b); \
+    if (valueA != valueB) { \
+      printf("%s:%d: CHECK_EQ(%s, %s) failed: %lld != %lld\n", __FILE__, __LINE__, #a, #b, valueA, valueB); \
+      testFailures++; \
+    } \
+  } while (0)
+
+#define CHECK_NEAR(a, b, tolerance) \
+  do { \
+    double valueA = (double)(a); \
+    double valueB = (double)(b); \
+    if (fabs(valueA - valueB) > (tolerance)) { \
+      printf("%s:%d: CHECK_NEAR(%s, %s) failed: %g vs %g\n", __FILE__, __LINE__, #a, #b, valueA, valueB); \
+      testFailures++; \
+    } \
+  } while (0)
+
+#define RUN_TEST(test) \
+  do { \
+    int before = testFailures; \
+    test(); \
+    printf("%s %s\n", testFailures == before ? "PASS" : "FAIL", #test); \
+  } while (0)
+
+#endif // TEST_HARNESS_H
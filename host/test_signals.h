@@ -0,0 +1,62 @@
+#ifndef TEST_SIGNALS_H
+#define TEST_SIGNALS_H
+
+#include <math.h>
+#include <stddef.h>
+#include <stdint.h>
+
+// Synthetic audio at SAMPLE_RATE for tests and benchmarks. The DC offset
+// matches the ~1280 the PDM microphone reads at rest.
+#define TEST_MIC_DC 1280
+
+static inline int16_t clampSample(double value) {
+  if (value > 32767) {
+    return 32767;
+  }
+  if (value < -32768) {
+    return -32768;
+  }
+  return (int16_t)lrint(value);
+}
+
+static inline void fillTone(int16_t* samples, size_t count, double hz, double amplitude,
+                            double dc, size_t startSample = 0) {
+  for (size_t i = 0; i < count; i++) {
+    double t = (double)(startSample + i) / SAMPLE_RATE;
+    samples[i] = clampSample(dc + amplitude * sin(2 * M_PI * hz * t));
+  }
+}
+
+// Uniform white noise from a fixed LCG so runs are repeatable
+static inline void fillNoise(int16_t* samples, size_t count, double amplitude, double dc,
+                             uint32_t* seed) {
+  for (size_t i = 0; i < count; i++) {
+    *seed = *seed * 1664525u + 1013904223u;
+    double unit = ((*seed >> 8) / 8388608.0) - 1.0;
+    samples[i] = clampSample(dc + amplitude * unit);
+  }
+}
+
+// Voiced-speech stand-in: a 150 Hz fundamental with harmonics falling off as
+// 1/sqrt(h) up to 3 kHz, so most energy sits in the speech band and the
+// spectrum is peaky.
+// Scaled so the AC part has the given RMS.
+static inline void fillVoiced(int16_t* samples, size_t count, double rms, double dc,
+                              size_t startSample = 0) {
+  double power = 0;
+  for (int h = 1; h * 150 <= 3000; h++) {
+    power += 0.5 / h;
+  }
+  double scale = rms / sqrt(power);
+  
+  for (size_t i = 0; i < count; i++) {
+    double t = (double)(startSample + i) / SAMPLE_RATE;
+    double value = 0;
+    for (int h = 1; h * 150 <= 3000; h++) {
+      value += sin(2 * M_PI * 150 * h * t) / sqrt((double)h);
+    }
+    samples[i] = clampSample(dc + scale * value);
+  }
+}
+
+#endif // TEST_SIGNALS_H
@@ -0,0 +1,122 @@
+#include "audio_encoder.h"
+#include "test_harness.h"
+#include "test_signals.h"
+#include <string.h>
+
+// Reference IMA-ADPCM decoder, written from the format description rather
+// than shared with the encoder
+static const int stepTable[89] = {
+  7, 8, 9, 10, 11, 12, 13, 14, 16, 17, 19, 21, 23, 25, 28, 31, 34, 37, 41, 45,
+  50, 55, 60, 66, 73, 80, 88, 97, 107, 118, 130, 143, 157, 173, 190, 209, 230,
+  253, 279, 307, 337, 371, 408, 449, 494, 544, 598, 658, 724, 796, 876, 963,
+  1060, 1166, 1282, 1411, 1552, 1707, 1878, 2066, 2272, 2499, 2749, 3024, 3327,
+  3660, 4026, 4428, 4871, 5358, 5894, 6484, 7132, 7845, 8630, 9493, 10442,
+  11487, 12635, 13899, 15289, 16818, 18500, 20350, 22385, 24623, 27086, 29794,
+  32767
+};
+static const int indexTable[16] = { -1, -1, -1, -1, 2, 4, 6, 8, -1, -1, -1, -1, 2, 4, 6, 8 };
+
+static void decodeBlock(const uint8_t* block, int16_t* out) {
+  int predictor = (int16_t)(block[0] | (block[1] << 8));
+  int index = block[2];
+  out[0] = (int16_t)predictor;
+  
+  for (int n = 0; n < ADPCM_SAMPLES_PER_BLOCK - 1; n++) {
+    int nibble = (block[4 + n / 2] >> ((n & 1) * 4)) & 0xF;
+    int step = stepTable[index];
+    int diff = step >> 3;
+    if (nibble & 4) diff += step;
+    if (nibble & 2) diff += step >> 1;
+    if (nibble & 1) diff += step >> 2;
+    predictor += (nibble & 8) ? -diff : diff;
+    predictor = predictor > 32767 ? 32767 : (predictor < -32768 ? -32768 : predictor);
+    index += indexTable[nibble];
+    index = index < 0 ? 0 : (index > 88 ? 88 : index);
+    out[n + 1] = (int16_t)predictor;
+  }
+}
+
+static void testADPCMRoundTrip() {
+  const int blocks = 8;
+  static int16_t input[ADPCM_SAMPLES_PER_BLOCK * blocks];
+  static uint8_t encoded[ADPCM_BLOCK_ALIGN * blocks];
+  static int16_t decoded[ADPCM_SAMPLES_PER_BLOCK * blocks];
+  fillTone(input, ARRAY_SIZE(input), 440, 8000, TEST_MIC_DC);
+  
+  audio_encoder_t encoder;
+  encoderBegin(&encoder, CODEC_IMA_ADPCM);
+  size_t produced = encoderProcess(&encoder, input, ARRAY_SIZE(input), encoded, sizeof(encoded));
+  CHECK_EQ(produced, sizeof(encoded));
+  CHECK_EQ(encoder.samplesEncoded, ARRAY_SIZE(input));
+  
+  double signal = 0;
+  double error = 0;
+  for (int b = 0; b < blocks; b++) {
+    decodeBlock(encoded + b * ADPCM_BLOCK_ALIGN, decoded + b * ADPCM_SAMPLES_PER_BLOCK);
+  }
+  for (size_t i = 0; i < ARRAY_SIZE(input); i++) {
+    double ac = input[i] - TEST_MIC_DC;
+    signal += ac * ac;
+    error += (double)(input[i] - decoded[i]) * (input[i] - decoded[i]);
+  }
+  
+  double snrDb = 10 * log10(signal / (error > 0 ? error : 1));
+  printf("  ADPCM SNR %.1f dB\n", snrDb);
+  CHECK(snrDb > 25);
+}
+
+// Arbitrary chunk sizes must produce the same stream as one large call
+static void testChunkingIsTransparent() {
+  static int16_t input[ADPCM_SAMPLES_PER_BLOCK * 4 + 100];
+  static uint8_t whole[ADPCM_BLOCK_ALIGN * 5];
+  static uint8_t chunked[ADPCM_BLOCK_ALIGN * 5];
+  uint32_t seed = 5;
+  fillNoise(input, ARRAY_SIZE(input), 8000, 0, &seed);
+  
+  audio_encoder_t encoder;
+  encoderBegin(&encoder, CODEC_IMA_ADPCM);
+  size_t wholeBytes = encoderProcess(&encoder, input, ARRAY_SIZE(input), whole, sizeof(whole));
+  wholeBytes += encoderFinish(&encoder, whole + wholeBytes, sizeof(whole) - wholeBytes);
+  
+  encoderBegin(&encoder, CODEC_IMA_ADPCM);
+  size_t chunkedBytes = 0;
+  for (size_t offset = 0; offset < ARRAY_SIZE(input); offset += 77) {
+    size_t count = MIN((size_t)77, ARRAY_SIZE(input) - offset);
+    chunkedBytes += encoderProcess(&encoder, input + offset, count, chunked + chunkedBytes,
+                                   sizeof(chunked) - chunkedBytes);
+  }
+  chunkedBytes += encoderFinish(&encoder, chunked + chunkedBytes, sizeof(chunked) - chunkedBytes);
+  
+  CHECK_EQ(wholeBytes, ADPCM_BLOCK_ALIGN * 5);
+  CHECK_EQ(chunkedBytes, wholeBytes);
+  CHECK(memcmp(whole, chunked, wholeBytes) == 0);
+}
+
+static void testPCMPassThrough() {
+  int16_t input[64];
+  uint8_t output[sizeof(input)];
+  fillTone(input, 64, 440, 1000, 0);
+  
+  audio_encoder_t encoder;
+  encoderBegin(&encoder, CODEC_PCM);
+  CHECK_EQ(encoderProcess(&encoder, input, 64, output, sizeof(output)), sizeof(input));
+  CHECK(memcmp(input, output, sizeof(input)) == 0);
+  CHECK_EQ(encoderProcess(&encoder, input, 64, output, sizeof(output) - 1), 0);
+  CHECK_EQ(encoderFinish(&encoder, output, sizeof(output)), 0);
+}
+
+static void testMaxOutputBound() {
+  for (size_t count = 0; count < ADPCM_SAMPLES_PER_BLOCK * 3; count += 97) {
+    size_t bound = encoderMaxOutputBytes(CODEC_IMA_ADPCM, count);
+    size_t blocks = (count + ADPCM_SAMPLES_PER_BLOCK - 1) / ADPCM_SAMPLES_PER_BLOCK;
+    CHECK(bound >= blocks * ADPCM_BLOCK_ALIGN);
+  }
+}
+
+int main() {
+  RUN_TEST(testADPCMRoundTrip);
+  RUN_TEST(testChunkingIsTransparent);
+  RUN_TEST(testPCMPassThrough);
+  RUN_TEST(testMaxOutputBound);
+  return testFailures == 0 ? 0 : 1;
+}
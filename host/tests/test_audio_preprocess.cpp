@@ -0,0 +1,136 @@
+#include "audio_preprocess.h"
+#include "test_harness.h"
+#include "test_signals.h"
+#include <string.h>
+
+#define TEST_SECONDS 2
+#define TEST_SAMPLES (SAMPLE_RATE * TEST_SECONDS)
+
+static int16_t input[TEST_SAMPLES];
+static int16_t output[TEST_SAMPLES];
+
+static void runBlocks(audio_preprocess_t* state, const int16_t* samples, int16_t* out, size_t count) {
+  memcpy(out, samples, count * sizeof(int16_t));
+  for (size_t offset = 0; offset < count; offset += PIPELINE_BLOCK_SAMPLES) {
+    preprocessBlock(state, out + offset, MIN((size_t)PIPELINE_BLOCK_SAMPLES, count - offset));
+  }
+}
+
+// Over the second half, once the filters have settled
+static double settledMean(const int16_t* samples) {
+  double sum = 0;
+  for (size_t i = TEST_SAMPLES / 2; i < TEST_SAMPLES; i++) {
+    sum += samples[i];
+  }
+  return sum / (TEST_SAMPLES / 2);
+}
+
+static double settledRMS(const int16_t* samples) {
+  double mean = settledMean(samples);
+  double sum = 0;
+  for (size_t i = TEST_SAMPLES / 2; i < TEST_SAMPLES; i++) {
+    sum += (samples[i] - mean) * (samples[i] - mean);
+  }
+  return sqrt(sum / (TEST_SAMPLES / 2));
+}
+
+static void testRemovesDCOffset() {
+  fillTone(input, TEST_SAMPLES, 1000, 1000, TEST_MIC_DC);
+  
+  audio_preprocess_t state;
+  preprocessBegin(&state, 0, false);
+  runBlocks(&state, input, output, TEST_SAMPLES);
+  
+  CHECK_NEAR(settledMean(output), 0, 2.0);
+  CHECK_NEAR(settledRMS(output), settledRMS(input), settledRMS(input) * 0.01);
+  
+  // Seeded on the resting level, so the first block has no step to remove
+  CHECK(output[0] > -50 && output[0] < 50);
+}
+
+static void testHighPassCutsRumble() {
+  audio_preprocess_t state;
+  
+  fillTone(input, TEST_SAMPLES, 30, 4000, TEST_MIC_DC);
+  preprocessBegin(&state, 90, false);
+  runBlocks(&state, input, output, TEST_SAMPLES);
+  CHECK(settledRMS(output) < settledRMS(input) * 0.15);
+  
+  fillTone(input, TEST_SAMPLES, 1000, 4000, TEST_MIC_DC);
+  preprocessBegin(&state, 90, false);
+  runBlocks(&state, input, output, TEST_SAMPLES);
+  CHECK_NEAR(settledRMS(output), settledRMS(input), settledRMS(input) * 0.02);
+  CHECK_NEAR(settledMean(output), 0, 2.0);
+}
+
+static void testAGCRaisesQuietSpeech() {
+  fillVoiced(input, TEST_SAMPLES, 400, TEST_MIC_DC);
+  
+  audio_preprocess_t state;
+  preprocessBegin(&state, 90, true);
+  runBlocks(&state, input, output, TEST_SAMPLES);
+  
+  CHECK(state.gainQ8 > 256);
+  CHECK(state.gainQ8 <= PREPROCESS_AGC_MAX_GAIN * 256);
+  CHECK(settledRMS(output) > settledRMS(input) * 1.5);
+}
+
+static void testAGCHoldsOnRoomNoise() {
+  uint32_t seed = 7;
+  fillNoise(input, TEST_SAMPLES, PREPROCESS_AGC_GATE_LEVEL / 4, TEST_MIC_DC, &seed);
+  
+  audio_preprocess_t state;
+  preprocessBegin(&state, 90, true);
+  runBlocks(&state, input, output, TEST_SAMPLES);
+  
+  CHECK_EQ(state.gainQ8, 256);
+}
+
+static void testSaturatesInsteadOfWrapping() {
+  for (size_t i = 0; i < TEST_SAMPLES; i++) {
+    input[i] = ((i / 8) & 1) ? 32767 : -32768;
+  }
+  
+  audio_preprocess_t state;
+  preprocessBegin(&state, 90, true);
+  runBlocks(&state, input, output, TEST_SAMPLES);
+  
+  // The filter overshoots full scale on every edge; it must clip, not wrap
+  CHECK(state.clipped > 0);
+  bool wrapped = false;
+  for (size_t i = TEST_SAMPLES / 2; i < TEST_SAMPLES; i++) {
+    if (input[i] == 32767 && input[i - 1] == -32768 && output[i] < 0) {
+      wrapped = true;
+    }
+  }
+  CHECK(!wrapped);
+}
+
+static void testBlockSplitIsTransparent() {
+  fillVoiced(input, TEST_SAMPLES, 2000, TEST_MIC_DC);
+  
+  audio_preprocess_t whole;
+  preprocessBegin(&whole, 90, false);
+  memcpy(output, input, sizeof(input));
+  preprocessBlock(&whole, output, TEST_SAMPLES);
+  
+  static int16_t split[TEST_SAMPLES];
+  audio_preprocess_t pieces;
+  preprocessBegin(&pieces, 90, false);
+  memcpy(split, input, sizeof(input));
+  for (size_t offset = 0; offset < TEST_SAMPLES; offset += 97) {
+    preprocessBlock(&pieces, split + offset, MIN((size_t)97, TEST_SAMPLES - offset));
+  }
+  
+  CHECK(memcmp(output, split, sizeof(split)) == 0);
+}
+
+int main() {
+  RUN_TEST(testRemovesDCOffset);
+  RUN_TEST(testHighPassCutsRumble);
+  RUN_TEST(testAGCRaisesQuietSpeech);
+  RUN_TEST(testAGCHoldsOnRoomNoise);
+  RUN_TEST(testSaturatesInsteadOfWrapping);
+  RUN_TEST(testBlockSplitIsTransparent);
+  return testFailures == 0 ? 0 : 1;
+}
@@ -0,0 +1,57 @@
+#include "audio_ring.h"
+#include "test_harness.h"
+
+#define RING 64
+
+static void testConsumerWithinRing() {
+  uint32_t cursor = 100;
+  CHECK_EQ(ringCatchUp(100 + RING - 1, &cursor, RING), 0);
+  CHECK_EQ(cursor, 100);
+}
+
+static void testConsumerFallsBehind() {
+  uint32_t cursor = 100;
+  CHECK_EQ(ringCatchUp(100 + RING + 10, &cursor, RING), 11);
+  CHECK_EQ(cursor, 100 + RING + 10 - (RING - 1));
+}
+
+static void testOverwriteDetection() {
+  CHECK(!ringBlockOverwritten(200, 200 - RING + 1, RING));
+  CHECK(ringBlockOverwritten(200, 200 - RING, RING));
+}
+
+static void testRewindClamps() {
+  CHECK_EQ(ringRewindTarget(10, 30, RING, 0), 0);
+  CHECK_EQ(ringRewindTarget(1000, 30, RING, 0), 970);
+  CHECK_EQ(ringRewindTarget(1000, 500, RING, 0), 1000 - (RING - 1));
+}
+
+// After a duty-cycle pause only the blocks since the resume are contiguous
+static void testRewindStopsAtResume() {
+  CHECK_EQ(ringRewindTarget(1000, 32, RING, 995), 995);
+  CHECK_EQ(ringRewindTarget(1000, 3, RING, 995), 997);
+  CHECK_EQ(ringRewindTarget(1000, 32, RING, 1000), 1000);
+  CHECK_EQ(ringRewindTarget(5, 32, RING, 0xFFFFFFFEu), 0xFFFFFFFEu);
+}
+
+// The sequence counter wraps after ~4 years of capture
+static void testSequenceWrap() {
+  uint32_t head = 5;
+  uint32_t cursor = 0xFFFFFFF0u;
+  CHECK_EQ(ringCatchUp(head, &cursor, RING), 0);
+  CHECK(!ringBlockOverwritten(head, 0xFFFFFFF0u, RING));
+  
+  cursor = 0xFFFFFF00u;
+  CHECK_EQ(ringCatchUp(head, &cursor, RING), 0x100 + 5 - (RING - 1));
+  CHECK_EQ(cursor, head - (RING - 1));
+}
+
+int main() {
+  RUN_TEST(testConsumerWithinRing);
+  RUN_TEST(testConsumerFallsBehind);
+  RUN_TEST(testOverwriteDetection);
+  RUN_TEST(testRewindClamps);
+  RUN_TEST(testRewindStopsAtResume);
+  RUN_TEST(testSequenceWrap);
+  return testFailures == 0 ? 0 : 1;
+}
@@ -0,0 +1,41 @@
+#include "recording_name.h"
+#include "config.h"
+#include "test_harness.h"
+#include <string.h>
+
+static void testFormatAndParse() {
+  char name[MAX_FILENAME_LENGTH];
+  CHECK(formatSegmentName(name, sizeof(name), "/recordings/2024-01-15/REC_20240115_093000.wav", 0x1a2b3c4d, 7));
+  CHECK(strcmp(name, "/recordings/2024-01-15/REC_20240115_093000_S1A2B3C4D_007.wav") == 0);
+  
+  uint32_t session = 0;
+  uint32_t segment = 0;
+  CHECK(parseSegmentName(name, &session, &segment));
+  CHECK_EQ(session, 0x1a2b3c4d);
+  CHECK_EQ(segment, 7);
+}
+
+// The longest dated name must still fit the journal's path field
+static void testFitsQueuePath() {
+  char name[MAX_FILENAME_LENGTH];
+  CHECK(formatSegmentName(name, sizeof(name), "/recordings/2024-01-15/REC_20240115_093000.wav", 0xFFFFFFFF, 999));
+  CHECK(!formatSegmentName(name, 16, "/recordings/2024-01-15/REC_20240115_093000.wav", 1, 1));
+}
+
+static void testRejectsPlainNames() {
+  uint32_t session = 0;
+  uint32_t segment = 0;
+  CHECK(!parseSegmentName("/recordings/2024-01-15/REC_20240115_093000.wav", &session, &segment));
+  CHECK(!parseSegmentName("/recordings/REC_S1A2B3C4D_007.txt", &session, &segment));
+  CHECK(!parseSegmentName("/recordings/REC_S1A2B3C4_007.wav", &session, &segment));
+  CHECK(!parseSegmentName("S1A2B3C4D_007.wav", &session, &segment));
+  CHECK(parseSegmentName("/r/x_S00000000_1000.wav", &session, &segment));
+  CHECK_EQ(segment, 1000);
+}
+
+int main() {
+  RUN_TEST(testFormatAndParse);
+  RUN_TEST(testFitsQueuePath);
+  RUN_TEST(testRejectsPlainNames);
+  return testFailures == 0 ? 0 : 1;
+}
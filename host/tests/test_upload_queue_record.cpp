@@ -0,0 +1,86 @@
+#include "upload_queue_record.h"
+#include "test_harness.h"
+#include <stddef.h>
+#include <string.h>
+
+// The journal on existing cards has this layout; changing it needs a new magic
+static_assert(sizeof(upload_queue_record_t) == 12 + MAX_FILENAME_LENGTH + UPLOAD_URL_LENGTH + UPLOAD_HASH_LENGTH,
+              "Queue record layout changed");
+static_assert(offsetof(upload_queue_record_t, status) == 2, "Status byte moved");
+
+static void testInitRecord() {
+  upload_queue_record_t record;
+  CHECK(initQueueRecord(&record, "/recordings/2024-01-15/REC_1.wav", 1234, NULL));
+  CHECK_EQ(record.magic, QUEUE_RECORD_MAGIC);
+  CHECK_EQ(record.status, QUEUE_STATUS_PENDING);
+  CHECK_EQ(record.fileSize, 1234);
+  CHECK_EQ(record.uploadOffset, 0);
+  CHECK(strcmp(record.path, "/recordings/2024-01-15/REC_1.wav") == 0);
+  CHECK(record.uploadUrl[0] == '\0');
+  CHECK_EQ(record.flags, 0);
+  CHECK(isQueueRecordValid(&record));
+}
+
+static void testHashedRecord() {
+  uint8_t hash[UPLOAD_HASH_LENGTH];
+  for (int i = 0; i < UPLOAD_HASH_LENGTH; i++) {
+    hash[i] = (uint8_t)(i * 17 + 1);
+  }
+  
+  upload_queue_record_t record;
+  CHECK(initQueueRecord(&record, "/recordings/a.wav", 1, hash));
+  CHECK_EQ(record.flags, QUEUE_FLAG_HASHED);
+  CHECK(memcmp(record.contentHash, hash, sizeof(hash)) == 0);
+  
+  char text[UPLOAD_HASH_LENGTH * 2 + 1];
+  formatContentHash(record.contentHash, text);
+  CHECK_EQ(strlen(text), 64);
+  CHECK(strncmp(text, "011223", 6) == 0);
+  CHECK(strcmp(text + 58, "eeff10") == 0);
+}
+
+static void testRejectsLongPath() {
+  char path[MAX_FILENAME_LENGTH + 1];
+  memset(path, 'a', sizeof(path) - 1);
+  path[sizeof(path) - 1] = '\0';
+  
+  upload_queue_record_t record;
+  CHECK(!initQueueRecord(&record, path, 1, NULL));
+  path[MAX_FILENAME_LENGTH - 1] = '\0';
+  CHECK(initQueueRecord(&record, path, 1, NULL));
+}
+
+static void testDetectsCorruption() {
+  upload_queue_record_t record;
+  initQueueRecord(&record, "/recordings/a.wav", 1, NULL);
+  
+  upload_queue_record_t corrupt = record;
+  corrupt.magic = 0xFFFF;
+  CHECK(!isQueueRecordValid(&corrupt));
+  
+  corrupt = record;
+  corrupt.status = 0xFF;
+  CHECK(!isQueueRecordValid(&corrupt));
+  
+  corrupt = record;
+  memset(corrupt.path, 'x', sizeof(corrupt.path));
+  CHECK(!isQueueRecordValid(&corrupt));
+}
+
+static void testRecordCount() {
+  uint32_t count;
+  CHECK(getQueueRecordCount(sizeof(upload_queue_record_t) * 3, &count));
+  CHECK_EQ(count, 3);
+  CHECK(!getQueueRecordCount(sizeof(upload_queue_record_t) * 3 + 5, &count));
+  CHECK(getQueueRecordCount(0, &count));
+  CHECK_EQ(count, 0);
+}
+
+int main() {
+  RUN_TEST(testInitRecord);
+  RUN_TEST(testHashedRecord);
+  RUN_TEST(testRejectsLongPath);
+  RUN_TEST(testDetectsCorruption);
+  RUN_TEST(testRecordCount);
+  return testFailures == 0 ? 0 : 1;
+}
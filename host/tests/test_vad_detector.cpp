@@ -0,0 +1,113 @@
+#include "vad_detector.h"
+#include "test_harness.h"
+#include "test_signals.h"
+
+#define WINDOW_MS (VAD_SAMPLE_WINDOW * 1000 / SAMPLE_RATE)
+
+// Feeds whole windows and returns how many were judged voice
+static int countVoiceWindows(vad_detector_t* detector, const int16_t* samples, size_t count,
+                             uint32_t* nowMs) {
+  int voiced = 0;
+  for (size_t offset = 0; offset + VAD_SAMPLE_WINDOW <= count; offset += VAD_SAMPLE_WINDOW) {
+    vad_decision_t decision;
+    if (vadDetectorAnalyze(detector, samples + offset, VAD_SAMPLE_WINDOW, *nowMs, &decision)) {
+      voiced++;
+    }
+    *nowMs += WINDOW_MS;
+  }
+  return voiced;
+}
+
+static void testQuietRoomStaysSilent() {
+  static int16_t samples[VAD_SAMPLE_WINDOW * 200];
+  uint32_t seed = 7;
+  fillNoise(samples, ARRAY_SIZE(samples), 60, TEST_MIC_DC, &seed);
+  
+  vad_detector_t detector;
+  uint32_t now = 0;
+  vadDetectorReset(&detector, now);
+  CHECK_EQ(countVoiceWindows(&detector, samples, ARRAY_SIZE(samples), &now), 0);
+}
+
+static void testSpeechLevelTriggers() {
+  // ~260 RMS: above the 200 RMS default threshold, below the energy ceiling
+  static int16_t samples[VAD_SAMPLE_WINDOW * 20];
+  fillVoiced(samples, ARRAY_SIZE(samples), 260, TEST_MIC_DC);
+  
+  vad_detector_t detector;
+  uint32_t now = 0;
+  vadDetectorReset(&detector, now);
+  int voiced = countVoiceWindows(&detector, samples, ARRAY_SIZE(samples), &now);
+  CHECK(voiced >= 18);
+}
+
+static void testDCOffsetIsIgnored() {
+  static int16_t samples[VAD_SAMPLE_WINDOW * 20];
+  fillTone(samples, ARRAY_SIZE(samples), 0, 0, 20000);
+  
+  vad_detector_t detector;
+  uint32_t now = 0;
+  vadDetectorReset(&detector, now);
+  CHECK_EQ(countVoiceWindows(&detector, samples, ARRAY_SIZE(samples), &now), 0);
+}
+
+static void testCalibrationRaisesThreshold() {
+  static int16_t samples[VAD_SAMPLE_WINDOW * 20];
+  fillVoiced(samples, ARRAY_SIZE(samples), 260, TEST_MIC_DC);
+  
+  vad_detector_t detector;
+  uint32_t now = 0;
+  vadDetectorReset(&detector, now);
+  vadDetectorCalibrate(&detector, 200 * 200);
+  CHECK_EQ(detector.noiseFloor, 200 * 200 * 144 / 100);
+  CHECK_EQ(countVoiceWindows(&detector, samples, ARRAY_SIZE(samples), &now), 0);
+}
+
+// A warm boot restores the floor saved before sleep instead of calibrating
+static void testRestoreMatchesCalibration() {
+  static int16_t samples[VAD_SAMPLE_WINDOW * 20];
+  fillVoiced(samples, ARRAY_SIZE(samples), 260, TEST_MIC_DC);
+  
+  vad_detector_t calibrated;
+  vadDetectorReset(&calibrated, 0);
+  vadDetectorCalibrate(&calibrated, 200 * 200);
+  
+  vad_detector_t restored;
+  vadDetectorReset(&restored, 0);
+  vadDetectorRestore(&restored, calibrated.noiseFloor, 1234);
+  CHECK_EQ(restored.noiseFloor, calibrated.noiseFloor);
+  CHECK_EQ(restored.runningAverage, 1234);
+  
+  uint32_t now = 0;
+  CHECK_EQ(countVoiceWindows(&restored, samples, ARRAY_SIZE(samples), &now), 0);
+  
+  // A zeroed RTC copy must not leave the detector without a floor
+  vadDetectorRestore(&restored, 0, 0);
+  CHECK(restored.noiseFloor > 0);
+}
+
+static void testNoiseFloorTracksQuietLevels() {
+  static int16_t samples[VAD_SAMPLE_WINDOW * 2000];
+  uint32_t seed = 3;
+  fillNoise(samples, ARRAY_SIZE(samples), 200, TEST_MIC_DC, &seed);
+  
+  vad_detector_t detector;
+  uint32_t now = 0;
+  vadDetectorReset(&detector, now);
+  uint32_t initial = detector.noiseFloor;
+  countVoiceWindows(&detector, samples, ARRAY_SIZE(samples), &now);
+  
+  // Uniform noise of amplitude 200 has variance 200^2 / 3
+  CHECK(detector.noiseFloor > initial);
+  CHECK(detector.noiseFloor <= 200 * 200 / 3 + 100);
+}
+
+int main() {
+  RUN_TEST(testQuietRoomStaysSilent);
+  RUN_TEST(testSpeechLevelTriggers);
+  RUN_TEST(testDCOffsetIsIgnored);
+  RUN_TEST(testCalibrationRaisesThreshold);
+  RUN_TEST(testRestoreMatchesCalibration);
+  RUN_TEST(testNoiseFloorTracksQuietLevels);
+  return testFailures == 0 ? 0 : 1;
+}
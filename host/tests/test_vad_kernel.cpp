@@ -0,0 +1,80 @@
+#include "vad_kernel.h"
+#include "config.h"
+#include "test_harness.h"
+#include "test_signals.h"
+
+static void testMatchesReference() {
+  int16_t samples[VAD_SAMPLE_WINDOW];
+  uint32_t seed = 1;
+  fillNoise(samples, VAD_SAMPLE_WINDOW, 20000, TEST_MIC_DC, &seed);
+  
+  double sum = 0;
+  double sumSquares = 0;
+  for (int i = 0; i < VAD_SAMPLE_WINDOW; i++) {
+    sum += samples[i];
+    sumSquares += (double)samples[i] * samples[i];
+  }
+  double mean = sum / VAD_SAMPLE_WINDOW;
+  
+  vad_window_stats_t stats;
+  computeVADWindowStats(samples, VAD_SAMPLE_WINDOW, &stats);
+  CHECK_NEAR(stats.mean, mean, 1.0);
+  CHECK_NEAR(stats.meanSquare, sumSquares / VAD_SAMPLE_WINDOW, 1.0);
+  CHECK_NEAR(stats.variance, sumSquares / VAD_SAMPLE_WINDOW - mean * mean, 2.0);
+}
+
+static void testDCOnlyHasNoVariance() {
+  int16_t samples[VAD_SAMPLE_WINDOW];
+  fillTone(samples, VAD_SAMPLE_WINDOW, 0, 0, TEST_MIC_DC);
+  
+  vad_window_stats_t stats;
+  computeVADWindowStats(samples, VAD_SAMPLE_WINDOW, &stats);
+  CHECK_EQ(stats.mean, TEST_MIC_DC);
+  CHECK_EQ(stats.variance, 0);
+}
+
+static void testFullScaleDoesNotOverflow() {
+  int16_t samples[VAD_SAMPLE_WINDOW];
+  for (int i = 0; i < VAD_SAMPLE_WINDOW; i++) {
+    samples[i] = (i & 1) ? 32767 : -32768;
+  }
+  
+  vad_window_stats_t stats;
+  computeVADWindowStats(samples, VAD_SAMPLE_WINDOW, &stats);
+  CHECK_NEAR(stats.variance, 32767.5 * 32767.5, 65536.0);
+}
+
+static void testOddAndEmptyCounts() {
+  int16_t samples[3] = { 10, 20, 30 };
+  vad_window_stats_t stats;
+  
+  computeVADWindowStats(samples, 3, &stats);
+  CHECK_EQ(stats.mean, 20);
+  CHECK_NEAR(stats.variance, 66.67, 1.0);
+  
+  computeVADWindowStats(samples, 0, &stats);
+  CHECK_EQ(stats.variance, 0);
+}
+
+static void testFixedWindowMatchesRuntime() {
+  int16_t samples[VAD_SAMPLE_WINDOW];
+  uint32_t seed = 7;
+  fillNoise(samples, VAD_SAMPLE_WINDOW, 12000, TEST_MIC_DC, &seed);
+  
+  vad_window_stats_t fixed;
+  vad_window_stats_t runtime;
+  computeVADWindowStatsFixed<VAD_SAMPLE_WINDOW>(samples, &fixed);
+  computeVADWindowStats(samples, VAD_SAMPLE_WINDOW, &runtime);
+  CHECK_EQ(fixed.mean, runtime.mean);
+  CHECK_EQ(fixed.meanSquare, runtime.meanSquare);
+  CHECK_EQ(fixed.variance, runtime.variance);
+}
+
+int main() {
+  RUN_TEST(testMatchesReference);
+  RUN_TEST(testDCOnlyHasNoVariance);
+  RUN_TEST(testFullScaleDoesNotOverflow);
+  RUN_TEST(testOddAndEmptyCounts);
+  RUN_TEST(testFixedWindowMatchesRuntime);
+  return testFailures == 0 ? 0 : 1;
+}
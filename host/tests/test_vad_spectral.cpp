@@ -0,0 +1,45 @@
+#include "vad_spectral.h"
+#include "test_harness.h"
+#include "test_signals.h"
+
+static void measure(const int16_t* samples, vad_spectral_features_t* features) {
+  computeSpectralFeatures(samples, VAD_SAMPLE_WINDOW, features);
+}
+
+static void testVoicedIsInBandAndPeaky() {
+  int16_t samples[VAD_SAMPLE_WINDOW];
+  fillVoiced(samples, VAD_SAMPLE_WINDOW, 2000, TEST_MIC_DC);
+  
+  vad_spectral_features_t features;
+  measure(samples, &features);
+  printf("  voiced: band ratio %.2f, flatness %.2f\n", features.bandRatio, features.flatness);
+  CHECK(features.bandRatio >= VAD_SPECTRAL_BAND_RATIO);
+  CHECK(features.flatness <= VAD_SPECTRAL_FLATNESS_MAX);
+}
+
+static void testWhiteNoiseIsFlat() {
+  int16_t samples[VAD_SAMPLE_WINDOW];
+  uint32_t seed = 11;
+  fillNoise(samples, VAD_SAMPLE_WINDOW, 2000, TEST_MIC_DC, &seed);
+  
+  vad_spectral_features_t features;
+  measure(samples, &features);
+  CHECK(features.flatness > VAD_SPECTRAL_FLATNESS_MAX);
+}
+
+static void testHumIsOutOfBand() {
+  int16_t samples[VAD_SAMPLE_WINDOW];
+  fillTone(samples, VAD_SAMPLE_WINDOW, 100, 4000, TEST_MIC_DC);
+  
+  vad_spectral_features_t features;
+  measure(samples, &features);
+  CHECK(features.bandRatio < VAD_SPECTRAL_BAND_RATIO);
+}
+
+int main() {
+  CHECK(initializeSpectralVAD());
+  RUN_TEST(testVoicedIsInBandAndPeaky);
+  RUN_TEST(testWhiteNoiseIsFlat);
+  RUN_TEST(testHumIsOutOfBand);
+  return testFailures == 0 ? 0 : 1;
+}
@@ -0,0 +1,95 @@
+#include "wav_header.h"
+#include "audio_encoder.h"
+#include "test_harness.h"
+#include <string.h>
+
+// Both layouts are written to disk byte for byte, so padding would corrupt them
+static_assert(sizeof(wav_header_t) == 44, "PCM header must be 44 bytes");
+static_assert(sizeof(wav_adpcm_header_t) == 60, "ADPCM header must be 60 bytes");
+
+// Headers for a fixed format are built entirely at compile time
+static_assert(makeWAVHeader<audio_format<8000, 16, 1> >(0).byteRate == 16000, "8 kHz PCM is 16000 bytes/s");
+static_assert(makeWAVHeader<audio_format<32000, 16, 1> >(100).chunkSize == 136, "RIFF size covers fmt and data");
+static_assert(makeADPCMWAVHeader<audio_format<16000, 16, 1> >(0, 0).blockAlign == ADPCM_BLOCK_ALIGN, "ADPCM block align");
+
+static uint32_t readLE32(const uint8_t* p) {
+  return p[0] | (p[1] << 8) | (p[2] << 16) | ((uint32_t)p[3] << 24);
+}
+
+static void testPCMHeader() {
+  wav_header_t header = createWAVHeader(32000);
+  CHECK(memcmp(header.chunkID, "RIFF", 4) == 0);
+  CHECK(memcmp(header.format, "WAVE", 4) == 0);
+  CHECK(memcmp(header.subchunk2ID, "data", 4) == 0);
+  CHECK_EQ(header.chunkSize, 36 + 32000);
+  CHECK_EQ(header.audioFormat, 1);
+  CHECK_EQ(header.sampleRate, SAMPLE_RATE);
+  CHECK_EQ(header.byteRate, SAMPLE_RATE * CHANNELS * BITS_PER_SAMPLE / 8);
+  CHECK_EQ(header.subchunk2Size, 32000);
+}
+
+static void testADPCMHeader() {
+  wav_adpcm_header_t header = createADPCMWAVHeader(ADPCM_BLOCK_ALIGN * 10, 5000);
+  CHECK_EQ(header.audioFormat, 0x11);
+  CHECK_EQ(header.blockAlign, ADPCM_BLOCK_ALIGN);
+  CHECK_EQ(header.samplesPerBlock, ADPCM_SAMPLES_PER_BLOCK);
+  CHECK_EQ(header.sampleLength, 5000);
+  CHECK_EQ(header.chunkSize, sizeof(header) - 8 + ADPCM_BLOCK_ALIGN * 10);
+  CHECK(memcmp(header.factID, "fact", 4) == 0);
+}
+
+// fillWAVHeader is what actually lands on the card
+static void testFilledBytes() {
+  uint8_t buffer[sizeof(wav_adpcm_header_t)];
+  size_t size = fillWAVHeader(buffer, 1000, 2000, 24);
+  
+  CHECK(memcmp(buffer, "RIFF", 4) == 0);
+  CHECK_EQ(readLE32(buffer + 4), size - 8 + 1000 + 24);
+  CHECK(memcmp(buffer + size - 8, "data", 4) == 0);
+  CHECK_EQ(readLE32(buffer + size - 4), 1000);
+  CHECK_EQ(size, AUDIO_CODEC == CODEC_PCM ? sizeof(wav_header_t) : sizeof(wav_adpcm_header_t));
+}
+
+// An odd data length needs a pad byte, or the gap chunk lands on an odd
+// offset. Walk the assembled file the way a RIFF reader would.
+static void testTrailingChunkAfterOddData() {
+  const uint32_t dataSize = 1001;
+  const uint32_t payloadSize = 16;
+  static uint8_t file[sizeof(wav_adpcm_header_t) + dataSize + WAV_TRAILING_CHUNK_HEADER_MAX + payloadSize];
+  
+  uint8_t chunkHeader[WAV_TRAILING_CHUNK_HEADER_MAX];
+  size_t chunkHeaderSize = fillTrailingChunkHeader(chunkHeader, "gap ", dataSize, payloadSize);
+  CHECK_EQ(chunkHeaderSize, 9);
+  CHECK_EQ(chunkHeader[0], 0);
+  CHECK_EQ(fillTrailingChunkHeader(chunkHeader, "gap ", dataSize + 1, payloadSize), 8);
+  fillTrailingChunkHeader(chunkHeader, "gap ", dataSize, payloadSize);
+  
+  size_t headerSize = fillWAVHeader(file, dataSize, 2000, chunkHeaderSize + payloadSize);
+  memset(file + headerSize, 0x55, dataSize);
+  memcpy(file + headerSize + dataSize, chunkHeader, chunkHeaderSize);
+  memset(file + headerSize + dataSize + chunkHeaderSize, 0xAA, payloadSize);
+  size_t fileSize = headerSize + dataSize + chunkHeaderSize + payloadSize;
+  CHECK_EQ(readLE32(file + 4) + 8, fileSize);
+  
+  size_t offset = 12;
+  bool foundGap = false;
+  while (offset + 8 <= fileSize) {
+    uint32_t size = readLE32(file + offset + 4);
+    if (memcmp(file + offset, "gap ", 4) == 0) {
+      foundGap = true;
+      CHECK_EQ(size, payloadSize);
+      CHECK_EQ(file[offset + 8], 0xAA);
+    }
+    offset += 8 + size + (size & 1);
+  }
+  CHECK(foundGap);
+  CHECK_EQ(offset, fileSize);
+}
+
+int main() {
+  RUN_TEST(testPCMHeader);
+  RUN_TEST(testADPCMHeader);
+  RUN_TEST(testFilledBytes);
+  RUN_TEST(testTrailingChunkAfterOddData);
+  return testFailures == 0 ? 0 : 1;
+}
@@ -1,28 +1,71 @@
 #include "led_control.h"
 #include "config.h"
+#include <atomic>
+#include <esp_timer.h>
+
+// All pattern state below belongs to the LED timer callback; other tasks
+// only post a new mode through requestedMode
+static std::atomic<led_mode_t> requestedMode(LED_OFF);
+static esp_timer_handle_t ledTimer = NULL;
 
 static led_mode_t currentMode = LED_OFF;
 static unsigned long lastUpdate = 0;
 static bool ledState = false;
 static uint8_t brightness = LED_BRIGHTNESS;
 static bool morseActive = false;
-static uint8_t morseErrorCode = 0;
-static int morseStep = 0;
+static std::atomic<uint8_t> morseErrorCode(0);
+static std::atomic<bool> morseRestart(false);
+static char morsePattern[8] = "";
+static size_t morseLength = 0;
+static size_t morseStep = 0;
+static bool morseInSymbol = false;
+static unsigned long symbolStartTime = 0;
+
+uint32_t updateHeartbeatLED(unsigned long currentTime);
+uint32_t updateBlinkingLED(unsigned long currentTime, unsigned long period);
+uint32_t updateDoubleFlashLED(unsigned long currentTime);
+uint32_t updateMorseCode(unsigned long currentTime);
+void startMorseCode(uint8_t errorCode);
+const char* getMorsePattern(uint8_t errorCode);
+
+// Each update returns how long until the pattern next changes, so a blink
+// costs one wakeup per edge rather than one per 10 ms
+static void ledTimerCallback(void* arg) {
+  uint32_t nextMs = updateLED();
+  if (nextMs > 0) {
+    esp_timer_start_once(ledTimer, (uint64_t)nextMs * 1000);
+  }
+}
+
+static void kickLEDTimer() {
+  if (ledTimer) {
+    esp_timer_stop(ledTimer);
+    esp_timer_start_once(ledTimer, 0);
+  }
+}
 
 void initializeLED() {
   pinMode(LED_PIN, OUTPUT);
   digitalWrite(LED_PIN, LOW);
-  currentMode = LED_OFF;
+  
+  if (!ledTimer) {
+    esp_timer_create_args_t args = {};
+    args.callback = ledTimerCallback;
+    args.name = "led";
+    if (esp_timer_create(&args, &ledTimer) != ESP_OK) {
+      DEBUG_PRINTLN("Failed to create LED timer");
+      ledTimer = NULL;
+    }
+  }
+  
+  setLEDMode(LED_OFF);
   DEBUG_PRINTLN("LED control initialized");
 }
 
 void setLEDMode(led_mode_t mode) {
-  if (mode != currentMode) {
-    currentMode = mode;
-    lastUpdate = 0;
-    ledState = false;
-    morseActive = false;
+  if (requestedMode.exchange(mode) != mode) {
     DEBUG_PRINTF("LED mode changed to: %d\n", mode);
+    kickLEDTimer();
   }
 }
 
@@ -30,167 +73,148 @@ void setLEDBrightness(uint8_t newBrightness) {
   brightness = newBrightness;
 }
 
-void updateLED() {
+// Runs in the esp_timer task; 0 means the LED holds until the next mode change
+uint32_t updateLED() {
   unsigned long currentTime = millis();
   
+  led_mode_t mode = requestedMode.load();
+  if (mode != currentMode) {
+    currentMode = mode;
+    lastUpdate = 0;
+    ledState = false;
+    morseActive = false;
+  }
+  
+  // A new error code restarts the pattern even when already in LED_ERROR
+  if (morseRestart.exchange(false)) {
+    morseActive = false;
+  }
+  
   if (morseActive) {
-    updateMorseCode(currentTime);
-    return;
+    return updateMorseCode(currentTime);
   }
   
   switch (currentMode) {
     case LED_OFF:
       digitalWrite(LED_PIN, LOW);
-      break;
+      return 0;
       
     case LED_SOLID:
       digitalWrite(LED_PIN, HIGH);
-      break;
+      return 0;
       
     case LED_LISTENING:
-      updatePulsingLED(currentTime, LED_LISTENING_PERIOD);
-      break;
+      return updateHeartbeatLED(currentTime);
       
     case LED_RECORDING:
-      updateBlinkingLED(currentTime, LED_RECORDING_PERIOD);
-      break;
+      return updateBlinkingLED(currentTime, LED_RECORDING_PERIOD);
       
     case LED_LOW_BATTERY:
-      updateBlinkingLED(currentTime, LED_LOW_BATTERY_PERIOD);
-      break;
+      return updateBlinkingLED(currentTime, LED_LOW_BATTERY_PERIOD);
       
     case LED_UPLOADING:
-      updateDoubleFlashLED(currentTime);
-      break;
+      return updateDoubleFlashLED(currentTime);
       
     case LED_ERROR:
-      if (morseErrorCode > 0) {
-        startMorseCode(morseErrorCode);
-      } else {
-        updateBlinkingLED(currentTime, 100);
+      if (morseErrorCode.load() > 0) {
+        startMorseCode(morseErrorCode.load());
+        return updateMorseCode(currentTime);
       }
-      break;
+      return updateBlinkingLED(currentTime, 100);
   }
+  
+  return 0;
 }
 
-void updatePulsingLED(unsigned long currentTime, unsigned long period) {
-  float phase = (float)(currentTime % period) / period;
-  float intensity = (sin(phase * 2 * PI) + 1) / 2;
+// The built-in LED has no PWM, so listening is a short flash per period
+uint32_t updateHeartbeatLED(unsigned long currentTime) {
+  unsigned long cycleTime = currentTime % LED_LISTENING_PERIOD;
   
-  if (currentTime - lastUpdate > 10) {
-    int pwmValue = (int)(intensity * brightness);
-    analogWrite(LED_PIN, pwmValue);
-    lastUpdate = currentTime;
-  }
+  bool shouldBeOn = cycleTime < LED_LISTENING_ON_TIME;
+  digitalWrite(LED_PIN, shouldBeOn ? HIGH : LOW);
+  lastUpdate = currentTime;
+  
+  return shouldBeOn ? LED_LISTENING_ON_TIME - cycleTime : LED_LISTENING_PERIOD - cycleTime;
 }
 
-void updateBlinkingLED(unsigned long currentTime, unsigned long period) {
+uint32_t updateBlinkingLED(unsigned long currentTime, unsigned long period) {
   if (currentTime - lastUpdate >= period) {
     ledState = !ledState;
     digitalWrite(LED_PIN, ledState ? HIGH : LOW);
     lastUpdate = currentTime;
+    return period;
   }
+  return period - (currentTime - lastUpdate);
 }
 
-void updateDoubleFlashLED(unsigned long currentTime) {
+uint32_t updateDoubleFlashLED(unsigned long currentTime) {
   unsigned long cycleTime = currentTime % 1000;
   
   bool shouldBeOn = (cycleTime < LED_UPLOADING_ON_TIME) || 
                     (cycleTime >= 200 && cycleTime < 200 + LED_UPLOADING_ON_TIME);
+  digitalWrite(LED_PIN, shouldBeOn ? HIGH : LOW);
+  lastUpdate = currentTime;
   
-  if (currentTime - lastUpdate > 10) {
-    digitalWrite(LED_PIN, shouldBeOn ? HIGH : LOW);
-    lastUpdate = currentTime;
+  // Next edge: end of the first flash, start and end of the second, then the wrap
+  static const unsigned long edges[] = { LED_UPLOADING_ON_TIME, 200, 200 + LED_UPLOADING_ON_TIME, 1000 };
+  for (size_t i = 0; i < sizeof(edges) / sizeof(edges[0]); i++) {
+    if (cycleTime < edges[i]) {
+      return edges[i] - cycleTime;
+    }
   }
+  return 1000 - cycleTime;
 }
 
 void morseCodeError(uint8_t errorCode) {
-  morseErrorCode = errorCode;
+  morseErrorCode.store(errorCode);
+  morseRestart.store(true);
   setLEDMode(LED_ERROR);
+  kickLEDTimer();
 }
 
 void startMorseCode(uint8_t errorCode) {
+  strlcpy(morsePattern, getMorsePattern(errorCode), sizeof(morsePattern));
+  morseLength = strlen(morsePattern);
   morseActive = true;
   morseStep = 0;
+  morseInSymbol = false;
   lastUpdate = millis();
   
   DEBUG_PRINTF("Starting morse code for error: 0x%02X\n", errorCode);
 }
 
-void updatePulsingLED(unsigned long currentTime, unsigned long period);
-void updateBlinkingLED(unsigned long currentTime, unsigned long period);
-void updateDoubleFlashLED(unsigned long currentTime);
-void updateMorseCode(unsigned long currentTime);
-void startMorseCode(uint8_t errorCode);
-String getMorsePattern(uint8_t errorCode);
-
-void updatePulsingLED(unsigned long currentTime, unsigned long period) {
-  float phase = (float)(currentTime % period) / period;
-  float intensity = (sin(phase * 2 * PI) + 1) / 2;
-  
-  if (currentTime - lastUpdate > 10) {
-    int pwmValue = (int)(intensity * brightness);
-    analogWrite(LED_PIN, pwmValue);
-    lastUpdate = currentTime;
-  }
-}
-
-void updateBlinkingLED(unsigned long currentTime, unsigned long period) {
-  if (currentTime - lastUpdate >= period) {
-    ledState = !ledState;
-    digitalWrite(LED_PIN, ledState ? HIGH : LOW);
-    lastUpdate = currentTime;
-  }
-}
-
-void updateDoubleFlashLED(unsigned long currentTime) {
-  unsigned long cycleTime = currentTime % 1000;
-  
-  bool shouldBeOn = (cycleTime < LED_UPLOADING_ON_TIME) || 
-                    (cycleTime >= 200 && cycleTime < 200 + LED_UPLOADING_ON_TIME);
-  
-  if (currentTime - lastUpdate > 10) {
-    digitalWrite(LED_PIN, shouldBeOn ? HIGH : LOW);
-    lastUpdate = currentTime;
-  }
-}
-
-void updateMorseCode(unsigned long currentTime) {
-  static bool inSymbol = false;
-  static unsigned long symbolStartTime = 0;
-  static String morsePattern = "";
-  
-  if (morsePattern.length() == 0) {
-    morsePattern = getMorsePattern(morseErrorCode);
-  }
-  
-  if (!inSymbol) {
-    if (morseStep >= morsePattern.length()) {
-      if (currentTime - lastUpdate > 2000) {
-        morseStep = 0;
-        lastUpdate = currentTime;
-      }
+uint32_t updateMorseCode(unsigned long currentTime) {
+  if (!morseInSymbol) {
+    if (morseStep >= morseLength) {
+      // Two seconds dark between repeats
+      unsigned long idle = currentTime - lastUpdate;
       digitalWrite(LED_PIN, LOW);
-      return;
+      if (idle <= 2000) {
+        return 2001 - idle;
+      }
+      morseStep = 0;
+      lastUpdate = currentTime;
     }
     
-    inSymbol = true;
+    morseInSymbol = true;
     symbolStartTime = currentTime;
     digitalWrite(LED_PIN, HIGH);
-  } else {
-    char symbol = morsePattern.charAt(morseStep);
-    unsigned long duration = (symbol == '.') ? MORSE_DOT_DURATION : MORSE_DASH_DURATION;
-    
-    if (currentTime - symbolStartTime >= duration) {
-      digitalWrite(LED_PIN, LOW);
-      inSymbol = false;
-      morseStep++;
-      lastUpdate = currentTime;
-    }
   }
+  
+  char symbol = morsePattern[morseStep];
+  unsigned long duration = (symbol == '.') ? MORSE_DOT_DURATION : MORSE_DASH_DURATION;
+  
+  if (currentTime - symbolStartTime >= duration) {
+    digitalWrite(LED_PIN, LOW);
+    morseInSymbol = false;
+    morseStep++;
+    lastUpdate = currentTime;
+    return MORSE_DOT_DURATION;
+  }
+  return duration - (currentTime - symbolStartTime);
 }
 
-String getMorsePattern(uint8_t errorCode) {
+const char* getMorsePattern(uint8_t errorCode) {
   switch (errorCode) {
     case ERROR_SD_INIT_FAILED:
       return "..."; // S
@@ -209,4 +233,4 @@ String getMorsePattern(uint8_t errorCode) {
     default:
       return "."; // E (generic error)
   }
-}
\ No newline at end of file
+}
@@ -15,7 +15,7 @@ typedef enum {
 
 void initializeLED();
 void setLEDMode(led_mode_t mode);
-void updateLED();
+uint32_t updateLED();
 void setLEDBrightness(uint8_t brightness);
 void morseCodeError(uint8_t errorCode);
 
@@ -0,0 +1,143 @@
+#include "metrics.h"
+#include "config.h"
+#include <string.h>
+#include <esp_idf_version.h>
+#include <esp_heap_caps.h>
+
+#if ESP_IDF_VERSION_MAJOR >= 5
+#include <esp_cpu.h>
+#else
+#include <hal/cpu_hal.h>
+#endif
+
+// Bucket b holds values in [2^(b-1), 2^b); bucket 0 holds zero
+#define METRIC_BUCKETS 24
+
+typedef struct {
+  uint32_t buckets[METRIC_BUCKETS];
+  uint32_t count;
+  uint32_t max;
+  uint64_t sum;
+} metric_histogram_data_t;
+
+static const struct {
+  const char* name;
+  const char* unit;
+} histogramInfo[METRIC_HISTOGRAM_COUNT] = {
+  { "i2s", "us" },
+  { "vad", "cyc" },
+  { "sd", "us" },
+  { "hdr", "us" },
+  { "up", "KB/s" },
+  { "loop", "us" },
+  { "pre", "cyc" },
+};
+
+static const char* counterNames[METRIC_COUNTER_COUNT] = { "drop", "ft", "retry", "ovf" };
+
+static metric_histogram_data_t histograms[METRIC_HISTOGRAM_COUNT];
+static uint32_t counters[METRIC_COUNTER_COUNT];
+
+static int bucketFor(uint32_t value) {
+  int bucket = value == 0 ? 0 : 32 - __builtin_clz(value);
+  return MIN(bucket, METRIC_BUCKETS - 1);
+}
+
+// Upper bound of the bucket holding the given fraction of samples
+static uint32_t percentile(const metric_histogram_data_t* h, uint32_t permille) {
+  uint32_t target = (uint32_t)(((uint64_t)h->count * permille + 999) / 1000);
+  uint32_t seen = 0;
+  
+  for (int b = 0; b < METRIC_BUCKETS; b++) {
+    seen += h->buckets[b];
+    if (seen >= target) {
+      return b == 0 ? 0 : MIN((uint32_t)1 << b, h->max);
+    }
+  }
+  
+  return h->max;
+}
+
+uint32_t metricsCycleCount() {
+#if ESP_IDF_VERSION_MAJOR >= 5
+  return (uint32_t)esp_cpu_get_cycle_count();
+#else
+  return cpu_hal_get_cycle_count();
+#endif
+}
+
+void recordMetric(metric_histogram_t metric, uint32_t value) {
+  if (!METRICS_ENABLED) {
+    return;
+  }
+  
+  metric_histogram_data_t* h = &histograms[metric];
+  h->buckets[bucketFor(value)]++;
+  h->count++;
+  h->sum += value;
+  h->max = MAX(h->max, value);
+}
+
+// Cycles rather than time: the count is unaffected by frequency scaling, so
+// it measures the work itself. Only use it for code that does not block.
+void recordMetricCycles(metric_histogram_t metric, uint32_t startCycles) {
+  recordMetric(metric, metricsCycleCount() - startCycles);
+}
+
+void incrementMetricCounter(metric_counter_t counter, uint32_t amount) {
+  if (METRICS_ENABLED) {
+    counters[counter] += amount;
+  }
+}
+
+void printMetrics() {
+  Serial.println("Metrics (count avg p50 p99 max):");
+  for (int i = 0; i < METRIC_HISTOGRAM_COUNT; i++) {
+    const metric_histogram_data_t* h = &histograms[i];
+    Serial.printf("  %-5s %8lu %8lu %8lu %8lu %8lu %s\n", histogramInfo[i].name, h->count,
+                  h->count > 0 ? (uint32_t)(h->sum / h->count) : 0,
+                  percentile(h, 500), percentile(h, 990), h->max, histogramInfo[i].unit);
+  }
+  
+  for (int i = 0; i < METRIC_COUNTER_COUNT; i++) {
+    Serial.printf("  %-5s %8lu\n", counterNames[i], counters[i]);
+  }
+  
+  // Internal RAM only; the minimum is since boot and survives resetMetrics()
+  Serial.printf("  heap  free %lu, min %lu, largest block %lu bytes\n",
+                (uint32_t)heap_caps_get_free_size(MALLOC_CAP_INTERNAL),
+                (uint32_t)heap_caps_get_minimum_free_size(MALLOC_CAP_INTERNAL),
+                (uint32_t)heap_caps_get_largest_free_block(MALLOC_CAP_INTERNAL));
+}
+
+// One line for the X-Telemetry header, e.g.
+// "i2s=31902/32768/33012;vad=...;drop=0;ft=2;retry=1;ovf=0;heap=..." as
+// avg/p99/max, with heap as free/min/largest block
+size_t formatMetricsSummary(char* buffer, size_t capacity) {
+  size_t used = 0;
+  
+  for (int i = 0; i < METRIC_HISTOGRAM_COUNT && used < capacity; i++) {
+    const metric_histogram_data_t* h = &histograms[i];
+    used += snprintf(buffer + used, capacity - used, "%s=%lu/%lu/%lu;", histogramInfo[i].name,
+                     h->count > 0 ? (uint32_t)(h->sum / h->count) : 0,
+                     percentile(h, 990), h->max);
+  }
+  
+  for (int i = 0; i < METRIC_COUNTER_COUNT && used < capacity; i++) {
+    used += snprintf(buffer + used, capacity - used, "%s=%lu;", counterNames[i], counters[i]);
+  }
+  
+  if (used < capacity) {
+    used += snprintf(buffer + used, capacity - used, "heap=%lu/%lu/%lu",
+                     (uint32_t)heap_caps_get_free_size(MALLOC_CAP_INTERNAL),
+                     (uint32_t)heap_caps_get_minimum_free_size(MALLOC_CAP_INTERNAL),
+                     (uint32_t)heap_caps_get_largest_free_block(MALLOC_CAP_INTERNAL));
+  }
+  
+  return MIN(used, capacity > 0 ? capacity - 1 : 0);
+}
+
+void resetMetrics() {
+  memset(histograms, 0, sizeof(histograms));
+  memset(counters, 0, sizeof(counters));
+}
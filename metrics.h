@@ -0,0 +1,35 @@
+#ifndef METRICS_H
+#define METRICS_H
+
+#include "config.h"
+
+// Each histogram is written by exactly one task (noted per entry), so
+// recording is a handful of plain stores with no locking
+typedef enum {
+  METRIC_I2S_WAIT,          // us blocked in i2s_read (capture task)
+  METRIC_VAD_WINDOW,        // CPU cycles per VAD window (loop)
+  METRIC_SD_WRITE,          // us per SD buffer write (SD writer task)
+  METRIC_HEADER_REWRITE,    // us to seek back and rewrite the WAV header (loop)
+  METRIC_UPLOAD_THROUGHPUT, // KB/s per streamed upload (upload task)
+  METRIC_LOOP_ITERATION,    // us per loop() pass, excluding its delay (loop)
+  METRIC_PREPROCESS,        // CPU cycles per block of pre-processing (capture task)
+  METRIC_HISTOGRAM_COUNT
+} metric_histogram_t;
+
+typedef enum {
+  METRIC_BLOCKS_DROPPED,    // Audio blocks a consumer fell too far behind to read
+  METRIC_FALSE_TRIGGERS,    // Recordings with under METRICS_FALSE_TRIGGER_MS of voice
+  METRIC_UPLOAD_RETRIES,    // Failed upload requests
+  METRIC_I2S_OVERRUNS,      // DMA buffers the I2S driver dropped (capture task)
+  METRIC_COUNTER_COUNT
+} metric_counter_t;
+
+uint32_t metricsCycleCount();
+void recordMetric(metric_histogram_t metric, uint32_t value);
+void recordMetricCycles(metric_histogram_t metric, uint32_t startCycles);
+void incrementMetricCounter(metric_counter_t counter, uint32_t amount = 1);
+void printMetrics();
+size_t formatMetricsSummary(char* buffer, size_t capacity);
+void resetMetrics();
+
+#endif // METRICS_H
@@ -1,26 +1,90 @@
 #include "power_management.h"
+#include "battery_monitor.h"
+#include "warm_boot.h"
 #include "config.h"
 #include <driver/gpio.h>
-#include <driver/adc.h>
-#include <esp_adc_cal.h>
+#include <esp_pm.h>
+#include <esp_idf_version.h>
+
+#if ESP_IDF_VERSION_MAJOR >= 5
+typedef esp_pm_config_t pm_config_t;
+#else
+typedef esp_pm_config_esp32s3_t pm_config_t;
+#endif
+
+typedef struct {
+  const char* name;
+  int maxMhz;
+  int minMhz;
+} power_profile_config_t;
+
+static const power_profile_config_t profileConfigs[POWER_PROFILE_COUNT] = {
+  { "idle", PM_IDLE_MAX_MHZ, PM_IDLE_MIN_MHZ },
+  { "listening", PM_LISTENING_MAX_MHZ, PM_LISTENING_MIN_MHZ },
+  { "recording", PM_RECORDING_MAX_MHZ, PM_RECORDING_MIN_MHZ },
+  { "uploading", PM_UPLOADING_MAX_MHZ, PM_UPLOADING_MIN_MHZ },
+};
+
+static const struct {
+  esp_pm_lock_type_t type;
+  const char* name;
+} lockConfigs[POWER_LOCK_COUNT] = {
+  { ESP_PM_NO_LIGHT_SLEEP, "audio_capture" },
+  { ESP_PM_CPU_FREQ_MAX, "sd_write" },
+};
 
 static bool powerInitialized = false;
-static esp_adc_cal_characteristics_t* adcChars = NULL;
-static float lastBatteryVoltage = 0.0;
-static float lastBatteryPercentage = 0.0;
-static unsigned long lastBatteryCheck = 0;
+
+static bool pmAvailable = false;
+static bool lightSleepAvailable = PM_LIGHT_SLEEP_ENABLED;
+static power_profile_t currentProfile = POWER_PROFILE_COUNT;
+static unsigned long profileSince = 0;
+static uint32_t profileTimeMs[POWER_PROFILE_COUNT];
+static unsigned long lastProfileReport = 0;
+static unsigned long lastStatusReport = 0;
+static esp_pm_lock_handle_t powerLocks[POWER_LOCK_COUNT];
+static portMUX_TYPE lockMux = portMUX_INITIALIZER_UNLOCKED;
+
+static bool applyProfile(power_profile_t profile) {
+  pm_config_t config = {};
+  config.max_freq_mhz = profileConfigs[profile].maxMhz;
+  config.min_freq_mhz = profileConfigs[profile].minMhz;
+  config.light_sleep_enable = lightSleepAvailable;
+  
+  esp_err_t err = esp_pm_configure(&config);
+  if (err != ESP_OK && lightSleepAvailable) {
+    // Automatic light sleep needs tickless idle, which stock cores lack
+    DEBUG_PRINTLN("Automatic light sleep unavailable, using frequency scaling only");
+    lightSleepAvailable = false;
+    config.light_sleep_enable = false;
+    err = esp_pm_configure(&config);
+  }
+  
+  if (err != ESP_OK) {
+    DEBUG_PRINTF("esp_pm_configure failed: %d\n", err);
+    return false;
+  }
+  
+  return true;
+}
 
 bool initializePowerManagement() {
   pinMode(USB_DETECT_PIN, INPUT_PULLUP);
   
-  adc1_config_width(ADC_WIDTH_BIT_12);
-  adc1_config_channel_atten(ADC1_CHANNEL_0, ADC_ATTEN_DB_11);
-  
-  adcChars = (esp_adc_cal_characteristics_t*)calloc(1, sizeof(esp_adc_cal_characteristics_t));
-  esp_adc_cal_characterize(ADC_UNIT_1, ADC_ATTEN_DB_11, ADC_WIDTH_BIT_12, 1100, adcChars);
+  if (!startBatteryMonitor()) {
+    return false;
+  }
   
   esp_sleep_enable_ext0_wakeup(GPIO_NUM_21, 0);
   
+  pmAvailable = PM_DFS_ENABLED && applyProfile(POWER_PROFILE_LISTENING);
+  if (!pmAvailable) {
+    DEBUG_PRINTLN("Dynamic frequency scaling unavailable, running at full clock");
+  }
+  currentProfile = POWER_PROFILE_LISTENING;
+  profileSince = millis();
+  lastProfileReport = millis();
+  
   updatePowerStatus();
   
   powerInitialized = true;
@@ -32,53 +96,81 @@ bool isUSBConnected() {
   return digitalRead(USB_DETECT_PIN) == LOW;
 }
 
-float getBatteryVoltage() {
-  if (millis() - lastBatteryCheck < 1000) {
-    return lastBatteryVoltage;
+// Profiles only bound the clock range; within it esp_pm scales on demand
+// and drops into light sleep whenever no lock forbids it
+void setPowerProfile(power_profile_t profile) {
+  if (profile >= POWER_PROFILE_COUNT || profile == currentProfile) {
+    return;
   }
   
-  uint32_t adcReading = 0;
-  for (int i = 0; i < 10; i++) {
-    adcReading += adc1_get_raw(ADC1_CHANNEL_0);
+  unsigned long now = millis();
+  if (currentProfile < POWER_PROFILE_COUNT) {
+    profileTimeMs[currentProfile] += now - profileSince;
   }
-  adcReading /= 10;
+  profileSince = now;
+  currentProfile = profile;
   
-  uint32_t voltage = esp_adc_cal_raw_to_voltage(adcReading, adcChars);
-  lastBatteryVoltage = (voltage / 1000.0) * BATTERY_VOLTAGE_DIVIDER;
-  lastBatteryCheck = millis();
+  if (pmAvailable) {
+    applyProfile(profile);
+  }
   
-  return lastBatteryVoltage;
+  DEBUG_PRINTF("Power profile: %s (%d-%d MHz)\n", profileConfigs[profile].name,
+               profileConfigs[profile].minMhz, profileConfigs[profile].maxMhz);
 }
 
-float getBatteryPercentage() {
-  float voltage = getBatteryVoltage();
-  
-  float minVoltage = 3.2;
-  float maxVoltage = 4.2;
-  
-  if (voltage >= maxVoltage) {
-    lastBatteryPercentage = 100.0;
-  } else if (voltage <= minVoltage) {
-    lastBatteryPercentage = 0.0;
-  } else {
-    lastBatteryPercentage = ((voltage - minVoltage) / (maxVoltage - minVoltage)) * 100.0;
+power_profile_t getPowerProfile() {
+  return currentProfile;
+}
+
+uint32_t getPowerProfileTimeMs(power_profile_t profile) {
+  if (profile >= POWER_PROFILE_COUNT) {
+    return 0;
   }
   
-  return lastBatteryPercentage;
+  uint32_t total = profileTimeMs[profile];
+  if (profile == currentProfile) {
+    total += millis() - profileSince;
+  }
+  return total;
 }
 
-void enterLightSleep() {
-  DEBUG_PRINTLN("Entering light sleep mode");
-  
-  esp_sleep_enable_timer_wakeup(5 * 1000000ULL);
+// Locks are created on first use so tasks started before
+// initializePowerManagement() can still take them
+void acquirePowerLock(power_lock_t lock) {
+  if (lock >= POWER_LOCK_COUNT) {
+    return;
+  }
   
-  esp_light_sleep_start();
+  if (!powerLocks[lock]) {
+    esp_pm_lock_handle_t handle = NULL;
+    if (esp_pm_lock_create(lockConfigs[lock].type, 0, lockConfigs[lock].name, &handle) != ESP_OK) {
+      return;
+    }
+    
+    portENTER_CRITICAL(&lockMux);
+    bool created = powerLocks[lock] == NULL;
+    if (created) {
+      powerLocks[lock] = handle;
+    }
+    portEXIT_CRITICAL(&lockMux);
+    
+    if (!created) {
+      esp_pm_lock_delete(handle);
+    }
+  }
   
-  DEBUG_PRINTLN("Woke from light sleep");
+  esp_pm_lock_acquire(powerLocks[lock]);
+}
+
+void releasePowerLock(power_lock_t lock) {
+  if (lock < POWER_LOCK_COUNT && powerLocks[lock]) {
+    esp_pm_lock_release(powerLocks[lock]);
+  }
 }
 
 void enterDeepSleep() {
   DEBUG_PRINTLN("Entering deep sleep mode");
+  saveWarmBootState();
   
   esp_sleep_enable_timer_wakeup(60 * 1000000ULL);
   esp_sleep_enable_ext0_wakeup(GPIO_NUM_21, 0);
@@ -86,14 +178,13 @@ void enterDeepSleep() {
   esp_deep_sleep_start();
 }
 
-void enableWakeOnVoice() {
-  esp_sleep_enable_ext0_wakeup((gpio_num_t)I2S_WS_PIN, 1);
-  DEBUG_PRINTLN("Wake on voice enabled");
-}
-
-void disableWakeOnVoice() {
+// Timer-only light sleep for duty-cycled listening. EXT0 is left out: GPIO21
+// doubles as the SD CS/D3 line and would wake the chip at random.
+void enterTimedLightSleep(uint32_t durationMs) {
   esp_sleep_disable_wakeup_source(ESP_SLEEP_WAKEUP_EXT0);
-  DEBUG_PRINTLN("Wake on voice disabled");
+  esp_sleep_enable_timer_wakeup((uint64_t)durationMs * 1000ULL);
+  esp_light_sleep_start();
+  esp_sleep_disable_wakeup_source(ESP_SLEEP_WAKEUP_TIMER);
 }
 
 void updatePowerStatus() {
@@ -101,8 +192,20 @@ void updatePowerStatus() {
   float percentage = getBatteryPercentage();
   bool usbConnected = isUSBConnected();
   
-  if (DEBUG_ENABLED && millis() % 10000 == 0) {
+  if (DEBUG_ENABLED && millis() - lastStatusReport >= 10000) {
     DEBUG_PRINTF("Power Status - Battery: %.2fV (%.1f%%), USB: %s\n", 
                  voltage, percentage, usbConnected ? "Connected" : "Disconnected");
+    lastStatusReport = millis();
+  }
+  
+  // Time in each profile; multiply by the current measured per profile to
+  // get the average draw
+  if (DEBUG_ENABLED && millis() - lastProfileReport >= PM_REPORT_INTERVAL_MS) {
+    DEBUG_PRINTF("Power profiles (s) - idle: %lu, listening: %lu, recording: %lu, uploading: %lu\n",
+                 getPowerProfileTimeMs(POWER_PROFILE_IDLE) / 1000,
+                 getPowerProfileTimeMs(POWER_PROFILE_LISTENING) / 1000,
+                 getPowerProfileTimeMs(POWER_PROFILE_RECORDING) / 1000,
+                 getPowerProfileTimeMs(POWER_PROFILE_UPLOADING) / 1000);
+    lastProfileReport = millis();
   }
 }
\ No newline at end of file
@@ -2,16 +2,33 @@
 #define POWER_MANAGEMENT_H
 
 #include "config.h"
+#include "battery_monitor.h"
 #include <esp_sleep.h>
 
+typedef enum {
+  POWER_PROFILE_IDLE,
+  POWER_PROFILE_LISTENING,
+  POWER_PROFILE_RECORDING,
+  POWER_PROFILE_UPLOADING,
+  POWER_PROFILE_COUNT
+} power_profile_t;
+
+// Held by the code that needs them, independent of the active profile
+typedef enum {
+  POWER_LOCK_AUDIO_CAPTURE,   // No light sleep while I2S DMA runs
+  POWER_LOCK_SD_WRITE,        // Full CPU clock for the duration of a write burst
+  POWER_LOCK_COUNT
+} power_lock_t;
+
 bool initializePowerManagement();
+void setPowerProfile(power_profile_t profile);
+power_profile_t getPowerProfile();
+void acquirePowerLock(power_lock_t lock);
+void releasePowerLock(power_lock_t lock);
+uint32_t getPowerProfileTimeMs(power_profile_t profile);
 bool isUSBConnected();
-float getBatteryVoltage();
-float getBatteryPercentage();
-void enterLightSleep();
 void enterDeepSleep();
-void enableWakeOnVoice();
-void disableWakeOnVoice();
+void enterTimedLightSleep(uint32_t durationMs);
 void updatePowerStatus();
 
 #endif // POWER_MANAGEMENT_H
\ No newline at end of file
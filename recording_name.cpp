@@ -0,0 +1,64 @@
+#include "recording_name.h"
+#include <ctype.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#define SESSION_DIGITS 8
+
+// basePath may end in ".wav"; the extension is moved after the suffix
+bool formatSegmentName(char* out, size_t capacity, const char* basePath,
+                       uint32_t sessionId, uint32_t segment) {
+  size_t baseLength = strlen(basePath);
+  if (baseLength >= 4 && strcmp(basePath + baseLength - 4, ".wav") == 0) {
+    baseLength -= 4;
+  }
+  
+  int written = snprintf(out, capacity, "%.*s_S%08lX_%03lu.wav", (int)baseLength, basePath,
+                         (unsigned long)sessionId, (unsigned long)segment);
+  return written > 0 && (size_t)written < capacity;
+}
+
+static bool allDigits(const char* text, size_t length, bool hex) {
+  if (length == 0) {
+    return false;
+  }
+  for (size_t i = 0; i < length; i++) {
+    unsigned char c = (unsigned char)text[i];
+    if (hex ? !isxdigit(c) : !isdigit(c)) {
+      return false;
+    }
+  }
+  return true;
+}
+
+// False for names without the segment suffix, e.g. unsegmented recordings
+bool parseSegmentName(const char* path, uint32_t* sessionId, uint32_t* segment) {
+  size_t length = strlen(path);
+  if (length < 4 || strcmp(path + length - 4, ".wav") != 0) {
+    return false;
+  }
+  length -= 4;
+  
+  const char* segmentStart = path + length;
+  while (segmentStart > path && segmentStart[-1] != '_' && segmentStart[-1] != '/') {
+    segmentStart--;
+  }
+  size_t segmentLength = path + length - segmentStart;
+  
+  // "_S" + session + "_" must sit in front of the segment number
+  if ((size_t)(segmentStart - path) < SESSION_DIGITS + 3) {
+    return false;
+  }
+  
+  const char* sessionStart = segmentStart - 1 - SESSION_DIGITS;
+  if (segmentStart[-1] != '_' || sessionStart[-1] != 'S' || sessionStart[-2] != '_' ||
+      !allDigits(sessionStart, SESSION_DIGITS, true) ||
+      !allDigits(segmentStart, segmentLength, false) || segmentLength > 9) {
+    return false;
+  }
+  
+  *sessionId = (uint32_t)strtoul(sessionStart, NULL, 16);
+  *segment = (uint32_t)strtoul(segmentStart, NULL, 10);
+  return true;
+}
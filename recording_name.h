@@ -0,0 +1,14 @@
+#ifndef RECORDING_NAME_H
+#define RECORDING_NAME_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+// Segments of one recording share a session ID and are numbered from 0:
+// "<base>_S<session as 8 hex digits>_<segment as 3+ digits>.wav". The name is
+// the only place these live, so they survive a rebuilt upload queue.
+bool formatSegmentName(char* out, size_t capacity, const char* basePath,
+                       uint32_t sessionId, uint32_t segment);
+bool parseSegmentName(const char* path, uint32_t* sessionId, uint32_t* segment);
+
+#endif // RECORDING_NAME_H
@@ -0,0 +1,154 @@
+#include "retention.h"
+#include "sd_manager.h"
+#include "config.h"
+#include <time.h>
+
+// Clocks before this have never been set (no NTP since boot)
+#define CLOCK_VALID_AFTER 1609459200  // 2021-01-01
+
+static bool evicting = false;
+static bool workPending = false;
+static unsigned long lastCheck = 0;
+
+// Directory and file names both embed the date, so name order is age order
+static String findOldestDateDirectory() {
+  File dir = getStorage().open(UPLOADED_DIR);
+  if (!dir || !dir.isDirectory()) {
+    return "";
+  }
+  
+  String oldest = "";
+  File entry = dir.openNextFile();
+  while (entry) {
+    if (entry.isDirectory()) {
+      String name = String(entry.name());
+      name = name.substring(name.lastIndexOf('/') + 1);
+      if (oldest.length() == 0 || name < oldest) {
+        oldest = name;
+      }
+    }
+    entry.close();
+    entry = dir.openNextFile();
+  }
+  
+  dir.close();
+  return oldest;
+}
+
+static bool isDateExpired(const String& dateName) {
+  if (RETENTION_MAX_AGE_DAYS == 0) {
+    return false;
+  }
+  
+  time_t now = time(NULL);
+  if (now < CLOCK_VALID_AFTER) {
+    return false;
+  }
+  
+  struct tm date = {};
+  if (sscanf(dateName.c_str(), "%4d-%2d-%2d", &date.tm_year, &date.tm_mon, &date.tm_mday) != 3) {
+    return false;
+  }
+  date.tm_year -= 1900;
+  date.tm_mon -= 1;
+  
+  time_t dirTime = mktime(&date);
+  return dirTime > 0 && now - dirTime > (time_t)RETENTION_MAX_AGE_DAYS * 24 * 60 * 60;
+}
+
+// One directory scan picks the RETENTION_BATCH_FILES oldest names, which are
+// then deleted. The directory itself goes once it is empty.
+static int evictBatch(const String& dirPath) {
+  fs::FS& fs = getStorage();
+  File dir = fs.open(dirPath);
+  if (!dir || !dir.isDirectory()) {
+    return 0;
+  }
+  
+  String batch[RETENTION_BATCH_FILES];
+  int batchCount = 0;
+  int seen = 0;
+  
+  File entry = dir.openNextFile();
+  while (entry) {
+    if (!entry.isDirectory()) {
+      String name = String(entry.name());
+      name = name.substring(name.lastIndexOf('/') + 1);
+      seen++;
+      
+      // Keep batch[] sorted ascending, dropping the newest when full
+      int slot = batchCount;
+      while (slot > 0 && name < batch[slot - 1]) {
+        if (slot < RETENTION_BATCH_FILES) {
+          batch[slot] = batch[slot - 1];
+        }
+        slot--;
+      }
+      if (slot < RETENTION_BATCH_FILES) {
+        batch[slot] = name;
+        batchCount = MIN(batchCount + 1, RETENTION_BATCH_FILES);
+      }
+    }
+    entry.close();
+    entry = dir.openNextFile();
+  }
+  
+  dir.close();
+  
+  int deleted = 0;
+  for (int i = 0; i < batchCount; i++) {
+    if (fs.remove(dirPath + "/" + batch[i])) {
+      deleted++;
+    } else {
+      reportStorageError();
+    }
+  }
+  
+  if (deleted == seen && fs.rmdir(dirPath)) {
+    DEBUG_PRINTF("Retention removed directory: %s\n", dirPath.c_str());
+  }
+  
+  return deleted;
+}
+
+// Runs at most one batch per call, from the idle part of the listening loop.
+// Evicts oldest-first whenever free space drops below the low-water mark
+// until the high-water mark is back, and drops dated directories older
+// than RETENTION_MAX_AGE_DAYS.
+bool maintainRetention() {
+  if (!isSDCardAvailable()) {
+    return false;
+  }
+  
+  if (!workPending && millis() - lastCheck < RETENTION_CHECK_INTERVAL_MS) {
+    return true;
+  }
+  lastCheck = millis();
+  workPending = false;
+  
+  uint64_t freeSpace = getSDCardFreeSpace();
+  if (!evicting && freeSpace < RETENTION_LOW_WATER_BYTES) {
+    DEBUG_PRINTF("Low disk space (%llu MB free), evicting uploaded recordings\n", freeSpace / (1024 * 1024));
+    evicting = true;
+  } else if (evicting && freeSpace >= RETENTION_HIGH_WATER_BYTES) {
+    DEBUG_PRINTF("Retention done, %llu MB free\n", freeSpace / (1024 * 1024));
+    evicting = false;
+  }
+  
+  String oldest = findOldestDateDirectory();
+  if (oldest.length() == 0) {
+    evicting = false;
+    return true;
+  }
+  
+  if (!evicting && !isDateExpired(oldest)) {
+    return true;
+  }
+  
+  String dirPath = String(UPLOADED_DIR) + "/" + oldest;
+  int deleted = evictBatch(dirPath);
+  DEBUG_PRINTF("Retention evicted %d files from %s\n", deleted, dirPath.c_str());
+  
+  workPending = deleted > 0;
+  return true;
+}
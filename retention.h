@@ -0,0 +1,8 @@
+#ifndef RETENTION_H
+#define RETENTION_H
+
+#include "config.h"
+
+bool maintainRetention();
+
+#endif // RETENTION_H
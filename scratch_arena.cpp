@@ -0,0 +1,48 @@
+#include "scratch_arena.h"
+#include <esp_heap_caps.h>
+
+#define SCRATCH_ALIGN 4
+
+static uint8_t* arena = NULL;
+static size_t arenaUsed = 0;
+static size_t arenaHighWater = 0;
+
+bool initializeScratchArena() {
+  if (arena) {
+    return true;
+  }
+  
+  if (SCRATCH_ARENA_IN_PSRAM) {
+    arena = (uint8_t*)heap_caps_malloc(SCRATCH_ARENA_SIZE, MALLOC_CAP_SPIRAM | MALLOC_CAP_8BIT);
+  }
+  if (!arena) {
+    arena = (uint8_t*)heap_caps_malloc(SCRATCH_ARENA_SIZE, MALLOC_CAP_INTERNAL | MALLOC_CAP_8BIT);
+  }
+  if (!arena) {
+    DEBUG_PRINTF("Failed to allocate %d byte scratch arena\n", SCRATCH_ARENA_SIZE);
+    return false;
+  }
+  
+  arenaUsed = 0;
+  return true;
+}
+
+// Returns NULL once the arena is full; callers treat that like a failed malloc
+void* scratchAlloc(size_t bytes) {
+  size_t start = (arenaUsed + SCRATCH_ALIGN - 1) & ~(size_t)(SCRATCH_ALIGN - 1);
+  if (!arena || start + bytes > SCRATCH_ARENA_SIZE) {
+    return NULL;
+  }
+  
+  arenaUsed = start + bytes;
+  arenaHighWater = MAX(arenaHighWater, arenaUsed);
+  return arena + start;
+}
+
+void scratchReset() {
+  arenaUsed = 0;
+}
+
+size_t getScratchHighWater() {
+  return arenaHighWater;
+}
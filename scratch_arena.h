@@ -0,0 +1,15 @@
+#ifndef SCRATCH_ARENA_H
+#define SCRATCH_ARENA_H
+
+#include "config.h"
+#include <stddef.h>
+
+// Bump allocator over one block reserved at startup. The upload task takes
+// its per-batch scratch from here and resets the arena between batches, so
+// uploads do not churn the heap. Not thread safe: upload task only.
+bool initializeScratchArena();
+void* scratchAlloc(size_t bytes);
+void scratchReset();
+size_t getScratchHighWater();
+
+#endif // SCRATCH_ARENA_H
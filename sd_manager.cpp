@@ -1,18 +1,202 @@
 #include "sd_manager.h"
+#include "upload_queue.h"
 #include "config.h"
+#include <SD.h>
+#include <SD_MMC.h>
+#include <SPI.h>
 #include <time.h>
+#include <string.h>
+#include <freertos/FreeRTOS.h>
+#include <freertos/semphr.h>
+
+#define PROBE_FILE "/.probe"
+#define PROBE_SIZE 1024
+
+typedef struct {
+  uint8_t backend;
+  uint32_t frequency;
+} storage_mode_t;
+
+// Tried in order at mount time; I/O errors step down to the next entry
+static const storage_mode_t storageModes[] = {
+#if STORAGE_BACKEND != STORAGE_BACKEND_SPI
+  { STORAGE_BACKEND, SDMMC_FREQ_KHZ },
+  { STORAGE_BACKEND, SDMMC_FREQ_DEFAULT },
+#endif
+#if STORAGE_BACKEND == STORAGE_BACKEND_SPI || STORAGE_FALLBACK_TO_SPI
+  { STORAGE_BACKEND_SPI, SD_SPI_FREQ_MAX },
+  { STORAGE_BACKEND_SPI, 10000000 },
+  { STORAGE_BACKEND_SPI, SD_SPI_FREQ },
+#endif
+};
 
 static bool sdInitialized = false;
+static int storageModeIndex = -1;
+static int storageErrors = 0;
+
+// Held across any stretch of card I/O that spans calls (the upload task
+// holds it for a whole batch); remounting takes it so the card is never
+// torn down underneath
+static SemaphoreHandle_t storageMutex = NULL;
+
+static bool isSPIMode() {
+  return storageModeIndex < 0 || storageModes[storageModeIndex].backend == STORAGE_BACKEND_SPI;
+}
+
+fs::FS& getStorage() {
+  if (isSPIMode()) {
+    return SD;
+  }
+  return SD_MMC;
+}
+
+const char* getStorageMountPoint() {
+  return isSPIMode() ? "/sd" : "/sdcard";
+}
+
+const char* getStorageModeName() {
+  if (storageModeIndex < 0) {
+    return "none";
+  }
+  
+  switch (storageModes[storageModeIndex].backend) {
+    case STORAGE_BACKEND_SDMMC_1BIT:
+      return "SDMMC 1-bit";
+    case STORAGE_BACKEND_SDMMC_4BIT:
+      return "SDMMC 4-bit";
+    default:
+      return "SPI";
+  }
+}
+
+static uint8_t storageCardType() {
+  return isSPIMode() ? SD.cardType() : SD_MMC.cardType();
+}
+
+static void unmountStorage() {
+  if (storageModeIndex < 0) {
+    return;
+  }
+  
+  if (isSPIMode()) {
+    SD.end();
+    SPI.end();
+  } else {
+    SD_MMC.end();
+  }
+  storageModeIndex = -1;
+}
+
+static bool mountStorageMode(int index) {
+  const storage_mode_t& mode = storageModes[index];
+  
+  if (mode.backend == STORAGE_BACKEND_SPI) {
+    SPI.begin(SD_SCK_PIN, SD_MISO_PIN, SD_MOSI_PIN, SD_CS_PIN);
+    if (!SD.begin(SD_CS_PIN, SPI, mode.frequency)) {
+      SPI.end();
+      return false;
+    }
+  } else {
+    bool oneBit = (mode.backend == STORAGE_BACKEND_SDMMC_1BIT);
+    if (oneBit) {
+      pinMode(SDMMC_D3_PIN, INPUT_PULLUP);
+      SD_MMC.setPins(SDMMC_CLK_PIN, SDMMC_CMD_PIN, SDMMC_D0_PIN);
+    } else {
+      SD_MMC.setPins(SDMMC_CLK_PIN, SDMMC_CMD_PIN, SDMMC_D0_PIN, SDMMC_D1_PIN, SDMMC_D2_PIN, SDMMC_D3_PIN);
+    }
+    if (!SD_MMC.begin("/sdcard", oneBit, false, mode.frequency)) {
+      return false;
+    }
+  }
+  
+  storageModeIndex = index;
+  return true;
+}
+
+// A write/read-back of a few sectors catches links that mount but corrupt data
+static bool probeStorage() {
+  static uint8_t pattern[PROBE_SIZE];
+  static uint8_t readback[PROBE_SIZE];
+  
+  for (int i = 0; i < PROBE_SIZE; i++) {
+    pattern[i] = (uint8_t)(i * 31 + 7);
+  }
+  
+  fs::FS& fs = getStorage();
+  File file = fs.open(PROBE_FILE, FILE_WRITE);
+  if (!file) {
+    return false;
+  }
+  size_t written = file.write(pattern, PROBE_SIZE);
+  file.close();
+  
+  file = fs.open(PROBE_FILE, FILE_READ);
+  if (!file) {
+    return false;
+  }
+  size_t readBytes = file.read(readback, PROBE_SIZE);
+  file.close();
+  fs.remove(PROBE_FILE);
+  
+  return written == PROBE_SIZE && readBytes == PROBE_SIZE &&
+         memcmp(pattern, readback, PROBE_SIZE) == 0;
+}
+
+static bool mountStorageFrom(int firstIndex) {
+  for (int i = firstIndex; i < (int)ARRAY_SIZE(storageModes); i++) {
+    unmountStorage();
+    
+    if (!mountStorageMode(i)) {
+      DEBUG_PRINTF("Storage mount failed (mode %d)\n", i);
+      continue;
+    }
+    
+    if (storageCardType() == CARD_NONE || !probeStorage()) {
+      DEBUG_PRINTF("Storage probe failed: %s @ %lu\n", getStorageModeName(), storageModes[i].frequency);
+      unmountStorage();
+      continue;
+    }
+    
+    storageErrors = 0;
+    DEBUG_PRINTF("Storage mounted: %s @ %lu\n", getStorageModeName(), storageModes[i].frequency);
+    return true;
+  }
+  
+  return false;
+}
+
+// Created on first use from setup(), before the upload task exists
+bool lockStorage(uint32_t timeoutMs) {
+  if (!storageMutex) {
+    storageMutex = xSemaphoreCreateRecursiveMutex();
+    if (!storageMutex) {
+      return false;
+    }
+  }
+  
+  TickType_t ticks = timeoutMs == UINT32_MAX ? portMAX_DELAY : pdMS_TO_TICKS(timeoutMs);
+  return xSemaphoreTakeRecursive(storageMutex, ticks) == pdTRUE;
+}
+
+void unlockStorage() {
+  if (storageMutex) {
+    xSemaphoreGiveRecursive(storageMutex);
+  }
+}
 
 bool initializeSDCard() {
-  SPI.begin(SD_SCK_PIN, SD_MISO_PIN, SD_MOSI_PIN, SD_CS_PIN);
+  bool locked = lockStorage(UINT32_MAX);
+  bool mounted = mountStorageFrom(0);
+  if (locked) {
+    unlockStorage();
+  }
   
-  if (!SD.begin(SD_CS_PIN, SPI, SD_SPI_FREQ)) {
+  if (!mounted) {
     DEBUG_PRINTLN("SD card initialization failed");
     return false;
   }
   
-  uint8_t cardType = SD.cardType();
+  uint8_t cardType = storageCardType();
   if (cardType == CARD_NONE) {
     DEBUG_PRINTLN("No SD card attached");
     return false;
@@ -29,7 +213,7 @@ bool initializeSDCard() {
     DEBUG_PRINTLN("UNKNOWN");
   }
   
-  uint64_t cardSize = SD.cardSize() / (1024 * 1024);
+  uint64_t cardSize = (isSPIMode() ? SD.cardSize() : SD_MMC.cardSize()) / (1024 * 1024);
   DEBUG_PRINTF("SD Card Size: %llu MB\n", cardSize);
   
   if (!createDirectoryStructure()) {
@@ -42,16 +226,71 @@ bool initializeSDCard() {
   return true;
 }
 
+// Warm boot: start at the mode that last worked and trust the directories
+// created before sleep; recordings create missing date directories anyway
+bool resumeSDCard(int storageMode) {
+  if (storageMode < 0 || storageMode >= (int)ARRAY_SIZE(storageModes)) {
+    return initializeSDCard();
+  }
+  
+  bool locked = lockStorage(UINT32_MAX);
+  bool mounted = mountStorageFrom(storageMode);
+  if (locked) {
+    unlockStorage();
+  }
+  
+  if (!mounted) {
+    DEBUG_PRINTLN("SD card resume failed");
+    return false;
+  }
+  
+  sdInitialized = true;
+  return true;
+}
+
+int getStorageModeIndex() {
+  return storageModeIndex;
+}
+
+void reportStorageError() {
+  storageErrors++;
+}
+
+// Steps down to the next slower mode once errors pile up. Must not be
+// called while recording; an upload holding the storage lock defers it.
+bool maintainStorage() {
+  if (!sdInitialized || storageErrors < STORAGE_ERROR_THRESHOLD) {
+    return true;
+  }
+  
+  if (!lockStorage(0)) {
+    return true;
+  }
+  
+  DEBUG_PRINTF("%d storage errors on %s, stepping down\n", storageErrors, getStorageModeName());
+  
+  // Everything slower failed too; retry the full list from the top
+  bool mounted = mountStorageFrom(storageModeIndex + 1) || mountStorageFrom(0);
+  if (!mounted) {
+    sdInitialized = false;
+  }
+  
+  unlockStorage();
+  return mounted;
+}
+
 bool createDirectoryStructure() {
-  if (!SD.mkdir(RECORDINGS_DIR)) {
-    if (!SD.exists(RECORDINGS_DIR)) {
+  fs::FS& fs = getStorage();
+  
+  if (!fs.mkdir(RECORDINGS_DIR)) {
+    if (!fs.exists(RECORDINGS_DIR)) {
       DEBUG_PRINTLN("Failed to create recordings directory");
       return false;
     }
   }
   
-  if (!SD.mkdir(UPLOADED_DIR)) {
-    if (!SD.exists(UPLOADED_DIR)) {
+  if (!fs.mkdir(UPLOADED_DIR)) {
+    if (!fs.exists(UPLOADED_DIR)) {
       DEBUG_PRINTLN("Failed to create uploaded directory");
       return false;
     }
@@ -68,8 +307,8 @@ bool createDirectoryStructure() {
            timeinfo->tm_mon + 1, 
            timeinfo->tm_mday);
   
-  if (!SD.mkdir(dateDir)) {
-    if (!SD.exists(dateDir)) {
+  if (!fs.mkdir(dateDir)) {
+    if (!fs.exists(dateDir)) {
       DEBUG_PRINTF("Failed to create date directory: %s\n", dateDir);
     }
   }
@@ -93,50 +332,65 @@ String generateRecordingFilename() {
   return String(filename);
 }
 
-bool markFileAsUploaded(const String& filename) {
+// /recordings/<date>/<file> moves to /uploaded/<date>/<file>
+bool markFileAsUploaded(const char* filename) {
   if (!sdInitialized) {
     return false;
   }
   
-  String uploadedPath = filename;
-  uploadedPath.replace(RECORDINGS_DIR, UPLOADED_DIR);
+  fs::FS& fs = getStorage();
+  size_t prefix = strlen(RECORDINGS_DIR);
+  upload_path_t uploadedPath;
+  
+  if (strncmp(filename, RECORDINGS_DIR, prefix) != 0 ||
+      snprintf(uploadedPath, sizeof(uploadedPath), "%s%s", UPLOADED_DIR, filename + prefix) >= (int)sizeof(uploadedPath)) {
+    DEBUG_PRINTF("Not a recording path: %s\n", filename);
+    return false;
+  }
   
-  String uploadedDir = uploadedPath.substring(0, uploadedPath.lastIndexOf('/'));
+  upload_path_t uploadedDir;
+  memcpy(uploadedDir, uploadedPath, sizeof(uploadedDir));
+  *strrchr(uploadedDir, '/') = '\0';
   
-  if (!SD.exists(uploadedDir)) {
+  if (!fs.exists(uploadedDir)) {
     if (!createDirectoryPath(uploadedDir)) {
-      DEBUG_PRINTF("Failed to create uploaded directory: %s\n", uploadedDir.c_str());
+      DEBUG_PRINTF("Failed to create uploaded directory: %s\n", uploadedDir);
       return false;
     }
   }
   
-  if (SD.rename(filename, uploadedPath)) {
-    DEBUG_PRINTF("File marked as uploaded: %s\n", uploadedPath.c_str());
+  if (fs.rename(filename, uploadedPath)) {
+    markQueuedFileUploaded(filename);
+    DEBUG_PRINTF("File marked as uploaded: %s\n", uploadedPath);
     return true;
   } else {
-    DEBUG_PRINTF("Failed to mark file as uploaded: %s\n", filename.c_str());
+    DEBUG_PRINTF("Failed to mark file as uploaded: %s\n", filename);
     return false;
   }
 }
 
-bool createDirectoryPath(const String& path) {
-  String currentPath = "";
-  int start = 0;
-  int end = path.indexOf('/', start + 1);
-  
-  while (end != -1) {
-    currentPath = path.substring(0, end);
-    if (!SD.exists(currentPath)) {
-      if (!SD.mkdir(currentPath)) {
-        return false;
-      }
-    }
-    start = end;
-    end = path.indexOf('/', start + 1);
+// Creates each missing level by cutting a copy of the path at every '/'
+bool createDirectoryPath(const char* path) {
+  fs::FS& fs = getStorage();
+  upload_path_t partial;
+  size_t length = strlen(path);
+  
+  if (length == 0 || length >= sizeof(partial)) {
+    return false;
   }
+  memcpy(partial, path, length + 1);
   
-  if (!SD.exists(path)) {
-    return SD.mkdir(path);
+  for (size_t i = 1; i <= length; i++) {
+    if (partial[i] != '/' && partial[i] != '\0') {
+      continue;
+    }
+    
+    char cut = partial[i];
+    partial[i] = '\0';
+    if (!fs.exists(partial) && !fs.mkdir(partial)) {
+      return false;
+    }
+    partial[i] = cut;
   }
   
   return true;
@@ -147,74 +401,40 @@ int getUnuploadedFileCount() {
     return 0;
   }
   
-  return countFilesInDirectory(RECORDINGS_DIR);
+  return getPendingUploadCount();
 }
 
-int countFilesInDirectory(const String& dirPath) {
-  File dir = SD.open(dirPath);
-  if (!dir || !dir.isDirectory()) {
-    return 0;
-  }
-  
-  int count = 0;
-  File file = dir.openNextFile();
-  
-  while (file) {
-    if (!file.isDirectory()) {
-      String filename = file.name();
-      if (filename.endsWith(".wav")) {
-        count++;
-      }
-    } else {
-      String subdirPath = String(dirPath) + "/" + String(file.name());
-      count += countFilesInDirectory(subdirPath);
-    }
-    file.close();
-    file = dir.openNextFile();
-  }
-  
-  dir.close();
-  return count;
-}
-
-bool getUnuploadedFiles(String* files, int maxFiles) {
+int getUnuploadedFiles(upload_path_t* files, uint32_t* sizes, int maxFiles) {
   if (!sdInitialized || !files) {
-    return false;
-  }
-  
-  int fileCount = 0;
-  return getFilesFromDirectory(RECORDINGS_DIR, files, maxFiles, &fileCount);
-}
-
-bool getFilesFromDirectory(const String& dirPath, String* files, int maxFiles, int* fileCount) {
-  File dir = SD.open(dirPath);
-  if (!dir || !dir.isDirectory()) {
-    return false;
+    return 0;
   }
   
-  File file = dir.openNextFile();
-  
-  while (file && *fileCount < maxFiles) {
-    if (!file.isDirectory()) {
-      String filename = file.name();
-      if (filename.endsWith(".wav")) {
-        files[*fileCount] = String(dirPath) + "/" + filename;
-        (*fileCount)++;
+  fs::FS& fs = getStorage();
+  int count = getPendingUploads(files, sizes, maxFiles);
+  int kept = 0;
+  
+  // A record can outlive its file if power was lost between the journal
+  // update and the rename; drop those instead of failing the upload
+  for (int i = 0; i < count; i++) {
+    if (fs.exists(files[i])) {
+      if (kept != i) {
+        memcpy(files[kept], files[i], sizeof(upload_path_t));
+        if (sizes) {
+          sizes[kept] = sizes[i];
+        }
       }
+      kept++;
     } else {
-      String subdirPath = String(dirPath) + "/" + String(file.name());
-      getFilesFromDirectory(subdirPath, files, maxFiles, fileCount);
+      DEBUG_PRINTF("Queued file missing, dropping: %s\n", files[i]);
+      markQueuedFileUploaded(files[i]);
     }
-    file.close();
-    file = dir.openNextFile();
   }
   
-  dir.close();
-  return true;
+  return kept;
 }
 
 bool isSDCardAvailable() {
-  return sdInitialized && SD.cardType() != CARD_NONE;
+  return sdInitialized && storageCardType() != CARD_NONE;
 }
 
 uint64_t getSDCardFreeSpace() {
@@ -222,138 +442,8 @@ uint64_t getSDCardFreeSpace() {
     return 0;
   }
   
-  return SD.totalBytes() - SD.usedBytes();
-}
-
-bool cleanupOldFiles() {
-  if (!sdInitialized) {
-    return false;
-  }
-  
-  uint64_t freeSpace = getSDCardFreeSpace();
-  uint64_t minFreeSpace = 100 * 1024 * 1024; // 100MB
-  
-  if (freeSpace > minFreeSpace) {
-    return true;
-  }
-  
-  DEBUG_PRINTLN("Low disk space, cleaning up old uploaded files");
-  
-  return deleteOldUploadedFiles();
-}
-
-bool createDirectoryPath(const String& path);
-int countFilesInDirectory(const String& dirPath);
-bool getFilesFromDirectory(const String& dirPath, String* files, int maxFiles, int* fileCount);
-bool deleteOldUploadedFiles();
-
-bool createDirectoryPath(const String& path) {
-  String currentPath = "";
-  int start = 0;
-  int end = path.indexOf('/', start + 1);
-  
-  while (end != -1) {
-    currentPath = path.substring(0, end);
-    if (!SD.exists(currentPath)) {
-      if (!SD.mkdir(currentPath)) {
-        return false;
-      }
-    }
-    start = end;
-    end = path.indexOf('/', start + 1);
-  }
-  
-  if (!SD.exists(path)) {
-    return SD.mkdir(path);
-  }
-  
-  return true;
-}
-
-int countFilesInDirectory(const String& dirPath) {
-  File dir = SD.open(dirPath);
-  if (!dir || !dir.isDirectory()) {
-    return 0;
-  }
-  
-  int count = 0;
-  File file = dir.openNextFile();
-  
-  while (file) {
-    if (!file.isDirectory()) {
-      String filename = file.name();
-      if (filename.endsWith(".wav")) {
-        count++;
-      }
-    } else {
-      String subdirPath = String(dirPath) + "/" + String(file.name());
-      count += countFilesInDirectory(subdirPath);
-    }
-    file.close();
-    file = dir.openNextFile();
+  if (isSPIMode()) {
+    return SD.totalBytes() - SD.usedBytes();
   }
-  
-  dir.close();
-  return count;
+  return SD_MMC.totalBytes() - SD_MMC.usedBytes();
 }
-
-bool getFilesFromDirectory(const String& dirPath, String* files, int maxFiles, int* fileCount) {
-  File dir = SD.open(dirPath);
-  if (!dir || !dir.isDirectory()) {
-    return false;
-  }
-  
-  File file = dir.openNextFile();
-  
-  while (file && *fileCount < maxFiles) {
-    if (!file.isDirectory()) {
-      String filename = file.name();
-      if (filename.endsWith(".wav")) {
-        files[*fileCount] = String(dirPath) + "/" + filename;
-        (*fileCount)++;
-      }
-    } else {
-      String subdirPath = String(dirPath) + "/" + String(file.name());
-      getFilesFromDirectory(subdirPath, files, maxFiles, fileCount);
-    }
-    file.close();
-    file = dir.openNextFile();
-  }
-  
-  dir.close();
-  return true;
-}
-
-bool deleteOldUploadedFiles() {
-  File dir = SD.open(UPLOADED_DIR);
-  if (!dir || !dir.isDirectory()) {
-    return false;
-  }
-  
-  String oldestFile = "";
-  time_t oldestTime = LONG_MAX;
-  
-  File file = dir.openNextFile();
-  while (file) {
-    if (!file.isDirectory()) {
-      time_t fileTime = file.getLastWrite();
-      if (fileTime < oldestTime) {
-        oldestTime = fileTime;
-        oldestFile = String(UPLOADED_DIR) + "/" + String(file.name());
-      }
-    }
-    file.close();
-    file = dir.openNextFile();
-  }
-  
-  dir.close();
-  
-  if (oldestFile.length() > 0) {
-    if (SD.remove(oldestFile)) {
-      DEBUG_PRINTF("Deleted old file: %s\n", oldestFile.c_str());
-      return true;
-    }
-  }
-  
-  return false;
-}
\ No newline at end of file
@@ -2,17 +2,27 @@
 #define SD_MANAGER_H
 
 #include "config.h"
-#include <SD.h>
+#include "upload_queue_record.h"
+#include <FS.h>
 
 bool initializeSDCard();
+bool resumeSDCard(int storageMode);
+int getStorageModeIndex();
+fs::FS& getStorage();
+const char* getStorageMountPoint();
+const char* getStorageModeName();
+void reportStorageError();
+bool lockStorage(uint32_t timeoutMs);
+void unlockStorage();
+bool maintainStorage();
 String generateRecordingFilename();
 bool createDirectoryStructure();
-bool markFileAsUploaded(const String& filename);
+bool createDirectoryPath(const char* path);
+bool markFileAsUploaded(const char* filename);
 bool deleteUploadedFiles();
-bool getUnuploadedFiles(String* files, int maxFiles);
+int getUnuploadedFiles(upload_path_t* files, uint32_t* sizes, int maxFiles);
 int getUnuploadedFileCount();
 bool isSDCardAvailable();
 uint64_t getSDCardFreeSpace();
-bool cleanupOldFiles();
 
-#endif // SD_MANAGER_H
\ No newline at end of file
+#endif // SD_MANAGER_H
@@ -0,0 +1,232 @@
+#include "sd_writer.h"
+#include "sd_manager.h"
+#include "power_management.h"
+#include "metrics.h"
+#include "config.h"
+#include <atomic>
+#include <freertos/FreeRTOS.h>
+#include <freertos/queue.h>
+#include <freertos/task.h>
+#include <esp_heap_caps.h>
+#include <esp_timer.h>
+
+static_assert(SD_WRITE_BUFFER_SIZE % 512 == 0, "SD_WRITE_BUFFER_SIZE must be a multiple of the sector size");
+
+// Two buffers ping-pong between the recorder (filling) and the writer task
+// (draining). Only full buffers are written while recording, so every write
+// lands on a buffer-aligned file offset; the tail goes out in sdWriterFinish().
+static uint8_t* buffers[2] = { NULL, NULL };
+static size_t bufferFill[2] = { 0, 0 };
+static std::atomic<bool> bufferInFlight[2];
+static int activeBuffer = 0;
+
+static File* targetFile = NULL;
+static QueueHandle_t writeQueue = NULL;
+static TaskHandle_t writerTaskHandle = NULL;
+static volatile bool writeError = false;
+static bool writerInitialized = false;
+
+static uint32_t lastFlushTime = 0;
+static uint32_t bytesSinceFlush = 0;
+
+static uint32_t statWrites = 0;
+static uint32_t statBytes = 0;
+static uint64_t statTotalWriteUs = 0;
+static uint32_t statMaxWriteUs = 0;
+static uint32_t statFlushes = 0;
+static uint32_t statMaxFlushUs = 0;
+static uint32_t statBufferWaits = 0;
+
+static void flushTarget() {
+  int64_t start = esp_timer_get_time();
+  targetFile->flush();
+  uint32_t elapsed = (uint32_t)(esp_timer_get_time() - start);
+
+  statFlushes++;
+  statMaxFlushUs = MAX(statMaxFlushUs, elapsed);
+  bytesSinceFlush = 0;
+  lastFlushTime = millis();
+}
+
+static void writerTask(void* param) {
+  for (;;) {
+    int index;
+    if (xQueueReceive(writeQueue, &index, portMAX_DELAY) != pdTRUE) {
+      continue;
+    }
+
+    if (!writeError && targetFile) {
+      acquirePowerLock(POWER_LOCK_SD_WRITE);
+      int64_t start = esp_timer_get_time();
+      size_t written = targetFile->write(buffers[index], bufferFill[index]);
+      uint32_t elapsed = (uint32_t)(esp_timer_get_time() - start);
+
+      statWrites++;
+      statBytes += written;
+      statTotalWriteUs += elapsed;
+      statMaxWriteUs = MAX(statMaxWriteUs, elapsed);
+      recordMetric(METRIC_SD_WRITE, elapsed);
+
+      if (written != bufferFill[index]) {
+        DEBUG_PRINTF("SD write short: %u of %u bytes\n", written, bufferFill[index]);
+        writeError = true;
+        reportStorageError();
+      } else {
+        bytesSinceFlush += written;
+        if (bytesSinceFlush >= SD_FLUSH_BYTES || millis() - lastFlushTime >= SD_FLUSH_INTERVAL_MS) {
+          flushTarget();
+        }
+      }
+      releasePowerLock(POWER_LOCK_SD_WRITE);
+    }
+
+    bufferFill[index] = 0;
+    bufferInFlight[index].store(false, std::memory_order_release);
+  }
+}
+
+static void submitBuffer(int index) {
+  bufferInFlight[index].store(true, std::memory_order_release);
+  xQueueSend(writeQueue, &index, portMAX_DELAY);
+}
+
+bool initializeSDWriter() {
+  if (writerInitialized) {
+    return true;
+  }
+
+  for (int i = 0; i < 2; i++) {
+    buffers[i] = (uint8_t*)heap_caps_malloc(SD_WRITE_BUFFER_SIZE, MALLOC_CAP_DMA | MALLOC_CAP_8BIT);
+    if (!buffers[i]) {
+      DEBUG_PRINTF("Failed to allocate %d byte SD write buffer\n", SD_WRITE_BUFFER_SIZE);
+      return false;
+    }
+    bufferFill[i] = 0;
+    bufferInFlight[i].store(false, std::memory_order_relaxed);
+  }
+
+  writeQueue = xQueueCreate(2, sizeof(int));
+  if (!writeQueue) {
+    DEBUG_PRINTLN("Failed to create SD write queue");
+    return false;
+  }
+
+  BaseType_t created = xTaskCreatePinnedToCore(writerTask, "sd_writer",
+                                               SD_WRITER_TASK_STACK_SIZE, NULL,
+                                               SD_WRITER_TASK_PRIORITY, &writerTaskHandle,
+                                               SD_WRITER_TASK_CORE);
+  if (created != pdPASS) {
+    DEBUG_PRINTLN("Failed to create SD writer task");
+    return false;
+  }
+
+  writerInitialized = true;
+  DEBUG_PRINTF("SD writer initialized (2 x %d bytes)\n", SD_WRITE_BUFFER_SIZE);
+  return true;
+}
+
+bool sdWriterBegin(File* file) {
+  if (!writerInitialized || !file) {
+    return false;
+  }
+
+  activeBuffer = 0;
+  bufferFill[0] = 0;
+  bufferFill[1] = 0;
+  bytesSinceFlush = 0;
+  lastFlushTime = millis();
+  writeError = false;
+  targetFile = file;
+  return true;
+}
+
+size_t sdWriterFreeSpace() {
+  if (!targetFile || bufferInFlight[activeBuffer].load(std::memory_order_acquire)) {
+    return 0;
+  }
+
+  size_t space = SD_WRITE_BUFFER_SIZE - bufferFill[activeBuffer];
+  if (!bufferInFlight[activeBuffer ^ 1].load(std::memory_order_acquire)) {
+    space += SD_WRITE_BUFFER_SIZE;
+  }
+
+  return space;
+}
+
+bool sdWriterAppend(const uint8_t* data, size_t length) {
+  if (!targetFile || writeError) {
+    return false;
+  }
+
+  while (length > 0) {
+    if (bufferInFlight[activeBuffer].load(std::memory_order_acquire)) {
+      // Callers size appends with sdWriterFreeSpace(), so this means both
+      // buffers are still queued behind a slow card
+      statBufferWaits++;
+      return false;
+    }
+
+    size_t chunk = MIN(length, SD_WRITE_BUFFER_SIZE - bufferFill[activeBuffer]);
+    memcpy(buffers[activeBuffer] + bufferFill[activeBuffer], data, chunk);
+    bufferFill[activeBuffer] += chunk;
+    data += chunk;
+    length -= chunk;
+
+    if (bufferFill[activeBuffer] == SD_WRITE_BUFFER_SIZE) {
+      submitBuffer(activeBuffer);
+      activeBuffer ^= 1;
+    }
+  }
+
+  return true;
+}
+
+bool sdWriterFinish() {
+  if (!targetFile) {
+    return false;
+  }
+
+  if (!bufferInFlight[activeBuffer].load(std::memory_order_acquire) && bufferFill[activeBuffer] > 0) {
+    submitBuffer(activeBuffer);
+  }
+
+  while (bufferInFlight[0].load(std::memory_order_acquire) ||
+         bufferInFlight[1].load(std::memory_order_acquire)) {
+    delay(1);
+  }
+
+  if (!writeError) {
+    flushTarget();
+  }
+
+  targetFile = NULL;
+  return !writeError;
+}
+
+bool sdWriterHasError() {
+  return writeError;
+}
+
+void getSDWriteStats(sd_write_stats_t* stats) {
+  if (!stats) {
+    return;
+  }
+
+  stats->writes = statWrites;
+  stats->bytes = statBytes;
+  stats->avgWriteUs = statWrites > 0 ? (uint32_t)(statTotalWriteUs / statWrites) : 0;
+  stats->maxWriteUs = statMaxWriteUs;
+  stats->flushes = statFlushes;
+  stats->maxFlushUs = statMaxFlushUs;
+  stats->bufferWaits = statBufferWaits;
+}
+
+void resetSDWriteStats() {
+  statWrites = 0;
+  statBytes = 0;
+  statTotalWriteUs = 0;
+  statMaxWriteUs = 0;
+  statFlushes = 0;
+  statMaxFlushUs = 0;
+  statBufferWaits = 0;
+}
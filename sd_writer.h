@@ -0,0 +1,26 @@
+#ifndef SD_WRITER_H
+#define SD_WRITER_H
+
+#include "config.h"
+#include <FS.h>
+
+typedef struct {
+  uint32_t writes;
+  uint32_t bytes;
+  uint32_t avgWriteUs;
+  uint32_t maxWriteUs;
+  uint32_t flushes;
+  uint32_t maxFlushUs;
+  uint32_t bufferWaits;
+} sd_write_stats_t;
+
+bool initializeSDWriter();
+bool sdWriterBegin(File* file);
+size_t sdWriterFreeSpace();
+bool sdWriterAppend(const uint8_t* data, size_t length);
+bool sdWriterFinish();
+bool sdWriterHasError();
+void getSDWriteStats(sd_write_stats_t* stats);
+void resetSDWriteStats();
+
+#endif // SD_WRITER_H
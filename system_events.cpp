@@ -0,0 +1,100 @@
+#include "system_events.h"
+#include "power_management.h"
+#include "config.h"
+#include <atomic>
+#include <freertos/FreeRTOS.h>
+#include <freertos/event_groups.h>
+#include <freertos/timers.h>
+
+static EventGroupHandle_t systemEvents = NULL;
+static TimerHandle_t housekeepingTimer = NULL;
+static TimerHandle_t usbTimer = NULL;
+static TimerHandle_t recoveryTimer = NULL;
+
+static std::atomic<bool> usbPresent(false);
+static bool usbCandidate = false;
+static int usbAgreeing = 0;
+
+static void housekeepingCallback(TimerHandle_t timer) {
+  postSystemEvents(SYSTEM_EVENT_HOUSEKEEPING);
+}
+
+// GPIO21 doubles as the SD CS line, so an edge interrupt would fire on
+// every card transaction. It is sampled instead, and a change only counts
+// once USB_DEBOUNCE_SAMPLES reads in a row agree.
+static void usbCallback(TimerHandle_t timer) {
+  bool connected = isUSBConnected();
+  
+  if (connected != usbCandidate) {
+    usbCandidate = connected;
+    usbAgreeing = 1;
+    return;
+  }
+  
+  if (usbAgreeing < USB_DEBOUNCE_SAMPLES && ++usbAgreeing == USB_DEBOUNCE_SAMPLES &&
+      connected != usbPresent.load()) {
+    usbPresent.store(connected);
+    postSystemEvents(SYSTEM_EVENT_USB_CHANGED);
+  }
+}
+
+static void recoveryCallback(TimerHandle_t timer) {
+  postSystemEvents(SYSTEM_EVENT_RECOVERY);
+}
+
+// Safe to call again from error recovery; everything is created once
+bool initializeSystemEvents() {
+  if (systemEvents) {
+    return true;
+  }
+  
+  usbCandidate = isUSBConnected();
+  usbAgreeing = USB_DEBOUNCE_SAMPLES;
+  usbPresent.store(usbCandidate);
+  
+  systemEvents = xEventGroupCreate();
+  housekeepingTimer = xTimerCreate("housekeeping", pdMS_TO_TICKS(HOUSEKEEPING_INTERVAL_MS), pdTRUE, NULL, housekeepingCallback);
+  usbTimer = xTimerCreate("usb_detect", pdMS_TO_TICKS(USB_DEBOUNCE_INTERVAL_MS), pdTRUE, NULL, usbCallback);
+  recoveryTimer = xTimerCreate("recovery", pdMS_TO_TICKS(ERROR_RECOVERY_INTERVAL_MS), pdFALSE, NULL, recoveryCallback);
+  
+  if (!systemEvents || !housekeepingTimer || !usbTimer || !recoveryTimer ||
+      xTimerStart(housekeepingTimer, 0) != pdPASS || xTimerStart(usbTimer, 0) != pdPASS) {
+    DEBUG_PRINTLN("Failed to create system event timers, loop() will poll");
+    return false;
+  }
+  
+  DEBUG_PRINTLN("System events initialized");
+  return true;
+}
+
+void postSystemEvents(uint32_t events) {
+  if (systemEvents) {
+    xEventGroupSetBits(systemEvents, events);
+  }
+}
+
+// Returns the requested bits that were set, clearing them. Without an
+// event group every bit but recovery, which needs its timer, is reported
+// after a short delay, so loop() degrades to the old polling.
+uint32_t waitForSystemEvents(uint32_t events, uint32_t timeoutMs) {
+  if (!systemEvents) {
+    delay(10);
+    return events & ~SYSTEM_EVENT_RECOVERY;
+  }
+  
+  TickType_t ticks = timeoutMs == UINT32_MAX ? portMAX_DELAY : pdMS_TO_TICKS(timeoutMs);
+  return xEventGroupWaitBits(systemEvents, events, pdTRUE, pdFALSE, ticks) & events;
+}
+
+// Restarts the one-shot if it is already pending
+bool scheduleRecoveryEvent(uint32_t delayMs) {
+  if (!recoveryTimer) {
+    return false;
+  }
+  
+  return xTimerChangePeriod(recoveryTimer, pdMS_TO_TICKS(delayMs), 0) == pdPASS;
+}
+
+bool isUSBPresent() {
+  return systemEvents ? usbPresent.load() : isUSBConnected();
+}
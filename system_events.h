@@ -0,0 +1,21 @@
+#ifndef SYSTEM_EVENTS_H
+#define SYSTEM_EVENTS_H
+
+#include "config.h"
+
+// Wake reasons for loop(); each source sets its bit and loop() blocks in
+// waitForSystemEvents() until one it cares about is set
+#define SYSTEM_EVENT_AUDIO_BLOCK   (1u << 0)  // Capture published a block
+#define SYSTEM_EVENT_USB_CHANGED   (1u << 1)  // Debounced USB state flipped
+#define SYSTEM_EVENT_SEGMENT       (1u << 2)  // Recorder closed a segment mid-take
+#define SYSTEM_EVENT_HOUSEKEEPING  (1u << 3)  // Every HOUSEKEEPING_INTERVAL_MS
+#define SYSTEM_EVENT_RECOVERY      (1u << 4)  // Error recovery is due
+#define SYSTEM_EVENT_ALL           0x1Fu
+
+bool initializeSystemEvents();
+void postSystemEvents(uint32_t events);
+uint32_t waitForSystemEvents(uint32_t events, uint32_t timeoutMs);
+bool scheduleRecoveryEvent(uint32_t delayMs);
+bool isUSBPresent();
+
+#endif // SYSTEM_EVENTS_H
@@ -0,0 +1,501 @@
+#include "upload_queue.h"
+#include "sd_manager.h"
+#include "config.h"
+#include <stddef.h>
+#include <string.h>
+#include <freertos/FreeRTOS.h>
+#include <freertos/semphr.h>
+
+#define RECORD_SIZE sizeof(upload_queue_record_t)
+
+static uint32_t recordCount = 0;
+static uint32_t pendingCount = 0;
+static uint32_t cursor = 0;          // No pending record before this index
+static bool queueReady = false;
+static bool rescanPending = false;   // A recording was committed without its record
+
+// The recorder appends from loop() while the upload service reads and
+// updates records from its own task
+static SemaphoreHandle_t queueMutex = NULL;
+
+struct QueueLock {
+  QueueLock() {
+    if (queueMutex) {
+      xSemaphoreTakeRecursive(queueMutex, portMAX_DELAY);
+    }
+  }
+  ~QueueLock() {
+    if (queueMutex) {
+      xSemaphoreGiveRecursive(queueMutex);
+    }
+  }
+};
+
+static bool readRecord(File& file, uint32_t index, upload_queue_record_t* record) {
+  if (!file.seek(index * RECORD_SIZE)) {
+    return false;
+  }
+  return file.read((uint8_t*)record, RECORD_SIZE) == RECORD_SIZE && isQueueRecordValid(record);
+}
+
+static bool appendRecord(const char* filename, uint32_t fileSize, const uint8_t* contentHash) {
+  upload_queue_record_t record;
+  if (!initQueueRecord(&record, filename, fileSize, contentHash)) {
+    DEBUG_PRINTF("Queue path too long: %s\n", filename);
+    return false;
+  }
+  
+  File file = getStorage().open(UPLOAD_QUEUE_FILE, FILE_APPEND);
+  if (!file) {
+    reportStorageError();
+    return false;
+  }
+  
+  bool written = file.write((const uint8_t*)&record, RECORD_SIZE) == RECORD_SIZE;
+  file.close();
+  
+  if (!written) {
+    reportStorageError();
+    return false;
+  }
+  
+  recordCount++;
+  pendingCount++;
+  return true;
+}
+
+static void advanceCursor(File& file) {
+  upload_queue_record_t record;
+  while (cursor < recordCount && readRecord(file, cursor, &record) &&
+         record.status != QUEUE_STATUS_PENDING) {
+    cursor++;
+  }
+}
+
+// Uploads go out in queue order, so the match is almost always at the cursor
+static bool findPendingRecord(File& file, const char* filename, uint32_t* index,
+                              upload_queue_record_t* record) {
+  for (uint32_t i = cursor; i < recordCount; i++) {
+    if (!readRecord(file, i, record)) {
+      return false;
+    }
+    if (record->status == QUEUE_STATUS_PENDING && strcmp(filename, record->path) == 0) {
+      *index = i;
+      return true;
+    }
+  }
+  return false;
+}
+
+// Once everything has been uploaded the journal carries no information, so
+// it is dropped instead of growing forever
+static void compactIfDrained() {
+  if (pendingCount > 0 || recordCount < UPLOAD_QUEUE_COMPACT_RECORDS) {
+    return;
+  }
+  
+  if (getStorage().remove(UPLOAD_QUEUE_FILE)) {
+    DEBUG_PRINTF("Upload queue compacted (%lu records)\n", recordCount);
+    recordCount = 0;
+    cursor = 0;
+  }
+}
+
+// The RIFF size covers what was recorded even when the file kept its pool
+// length, so rebuilt records get the same size the writer journaled
+static uint32_t recordedSizeOf(File& file) {
+  uint8_t riff[8];
+  uint32_t size = file.size();
+  if (file.read(riff, sizeof(riff)) == sizeof(riff) && memcmp(riff, "RIFF", 4) == 0) {
+    uint32_t chunkSize;
+    memcpy(&chunkSize, riff + 4, sizeof(chunkSize));
+    if (chunkSize <= size - sizeof(riff)) {
+      return chunkSize + sizeof(riff);
+    }
+  }
+  return size;
+}
+
+// path holds the directory being scanned; entry names are appended in place
+// and cut off again, so the walk builds no strings
+static void scanDirectory(char* path, size_t length) {
+  File dir = getStorage().open(path);
+  if (!dir || !dir.isDirectory()) {
+    return;
+  }
+  
+  File file = dir.openNextFile();
+  while (file) {
+    int added = snprintf(path + length, MAX_FILENAME_LENGTH - length, "/%s", file.name());
+    if (added > 0 && length + added < MAX_FILENAME_LENGTH) {
+      if (!file.isDirectory()) {
+        if (added > 4 && strcmp(path + length + added - 4, ".wav") == 0) {
+          appendRecord(path, recordedSizeOf(file), NULL);
+        }
+      } else {
+        scanDirectory(path, length + added);
+      }
+    } else {
+      DEBUG_PRINTF("Path too long, skipped: %s/%s\n", path, file.name());
+    }
+    path[length] = '\0';
+    file.close();
+    file = dir.openNextFile();
+  }
+  
+  dir.close();
+}
+
+// Recovery path: every WAV still under RECORDINGS_DIR is pending by definition
+bool rebuildUploadQueue() {
+  QueueLock lock;
+  
+  fs::FS& fs = getStorage();
+  unsigned long startTime = millis();
+  
+  if (fs.exists(UPLOAD_QUEUE_FILE) && !fs.remove(UPLOAD_QUEUE_FILE)) {
+    DEBUG_PRINTLN("Failed to remove upload queue");
+    return false;
+  }
+  
+  recordCount = 0;
+  pendingCount = 0;
+  cursor = 0;
+  upload_path_t path = RECORDINGS_DIR;
+  scanDirectory(path, strlen(path));
+  
+  queueReady = true;
+  DEBUG_PRINTF("Upload queue rebuilt: %lu pending (%lu ms)\n", pendingCount, millis() - startTime);
+  return true;
+}
+
+bool initializeUploadQueue() {
+  if (!queueMutex) {
+    queueMutex = xSemaphoreCreateRecursiveMutex();
+  }
+  QueueLock lock;
+  
+  File file = getStorage().open(UPLOAD_QUEUE_FILE, FILE_READ);
+  if (!file) {
+    DEBUG_PRINTLN("No upload queue found, scanning recordings");
+    return rebuildUploadQueue();
+  }
+  
+  if (!getQueueRecordCount(file.size(), &recordCount)) {
+    // Power was lost mid-append
+    file.close();
+    DEBUG_PRINTLN("Upload queue truncated, rebuilding");
+    return rebuildUploadQueue();
+  }
+  
+  pendingCount = 0;
+  cursor = recordCount;
+  
+  upload_queue_record_t record;
+  for (uint32_t i = 0; i < recordCount; i++) {
+    if (!readRecord(file, i, &record)) {
+      file.close();
+      DEBUG_PRINTLN("Upload queue corrupt, rebuilding");
+      return rebuildUploadQueue();
+    }
+    if (record.status == QUEUE_STATUS_PENDING) {
+      pendingCount++;
+      cursor = MIN(cursor, i);
+    }
+  }
+  
+  file.close();
+  queueReady = true;
+  DEBUG_PRINTF("Upload queue loaded: %lu records, %lu pending\n", recordCount, pendingCount);
+  return true;
+}
+
+// Warm boot: the journal is only trusted when its length still matches the
+// saved record count, which skips reading every record back
+bool resumeUploadQueue(const upload_queue_cursor_t* saved) {
+  if (!queueMutex) {
+    queueMutex = xSemaphoreCreateRecursiveMutex();
+  }
+  QueueLock lock;
+  
+  File file = getStorage().open(UPLOAD_QUEUE_FILE, FILE_READ);
+  uint32_t records = 0;
+  bool matches = file && getQueueRecordCount(file.size(), &records) && records == saved->records &&
+                 saved->pending <= records && saved->cursor <= records;
+  if (file) {
+    file.close();
+  }
+  
+  if (!matches) {
+    DEBUG_PRINTLN("Upload queue changed while asleep, reloading");
+    return initializeUploadQueue();
+  }
+  
+  recordCount = saved->records;
+  pendingCount = saved->pending;
+  cursor = saved->cursor;
+  queueReady = true;
+  DEBUG_PRINTF("Upload queue resumed: %lu records, %lu pending\n", recordCount, pendingCount);
+  return true;
+}
+
+bool getUploadQueueCursor(upload_queue_cursor_t* saved) {
+  QueueLock lock;
+  
+  saved->records = recordCount;
+  saved->pending = pendingCount;
+  saved->cursor = cursor;
+  return queueReady;
+}
+
+bool queueRecording(const char* filename, uint32_t fileSize, const uint8_t* contentHash) {
+  QueueLock lock;
+  
+  // The recording is committed either way, so a missed record is recovered
+  // by the next maintainUploadQueue() rescan
+  if (!queueReady || !appendRecord(filename, fileSize, contentHash)) {
+    DEBUG_PRINTF("Failed to queue recording, rescan pending: %s\n", filename);
+    rescanPending = true;
+    return false;
+  }
+  
+  return true;
+}
+
+// Rebuilds the journal after a failed append; only call while not
+// recording, since the scan would pick up an open fallback file
+bool maintainUploadQueue() {
+  QueueLock lock;
+  
+  if (!rescanPending) {
+    return true;
+  }
+  
+  rescanPending = !rebuildUploadQueue();
+  return !rescanPending;
+}
+
+bool markQueuedFileUploaded(const char* filename) {
+  QueueLock lock;
+  
+  if (!queueReady || pendingCount == 0) {
+    return false;
+  }
+  
+  File file = getStorage().open(UPLOAD_QUEUE_FILE, "r+");
+  if (!file) {
+    reportStorageError();
+    return false;
+  }
+  
+  upload_queue_record_t record;
+  uint32_t index;
+  bool found = false;
+  if (findPendingRecord(file, filename, &index, &record)) {
+    uint8_t status = QUEUE_STATUS_UPLOADED;
+    found = file.seek(index * RECORD_SIZE + offsetof(upload_queue_record_t, status)) &&
+            file.write(&status, 1) == 1;
+  }
+  
+  if (found) {
+    pendingCount--;
+    advanceCursor(file);
+  }
+  
+  file.close();
+  
+  if (found) {
+    compactIfDrained();
+  }
+  
+  return found;
+}
+
+bool getQueuedUploadState(const char* filename, uint32_t* offset, char uploadUrl[UPLOAD_URL_LENGTH]) {
+  QueueLock lock;
+  
+  *offset = 0;
+  uploadUrl[0] = '\0';
+  
+  if (!queueReady || pendingCount == 0) {
+    return false;
+  }
+  
+  File file = getStorage().open(UPLOAD_QUEUE_FILE, FILE_READ);
+  if (!file) {
+    reportStorageError();
+    return false;
+  }
+  
+  upload_queue_record_t record;
+  uint32_t index;
+  bool found = findPendingRecord(file, filename, &index, &record);
+  file.close();
+  
+  if (found) {
+    record.uploadUrl[UPLOAD_URL_LENGTH - 1] = '\0';
+    *offset = record.uploadOffset;
+    memcpy(uploadUrl, record.uploadUrl, UPLOAD_URL_LENGTH);
+  }
+  
+  return found;
+}
+
+// False for records without a hash, e.g. files found by a rebuild scan
+// Uploads send this rather than file.size(): a pool file whose truncate
+// failed is still at its preallocated length
+bool getQueuedFileSize(const char* filename, uint32_t* fileSize) {
+  QueueLock lock;
+  
+  if (!queueReady || pendingCount == 0) {
+    return false;
+  }
+  
+  File file = getStorage().open(UPLOAD_QUEUE_FILE, FILE_READ);
+  if (!file) {
+    reportStorageError();
+    return false;
+  }
+  
+  upload_queue_record_t record;
+  uint32_t index;
+  bool found = findPendingRecord(file, filename, &index, &record);
+  file.close();
+  
+  if (found) {
+    *fileSize = record.fileSize;
+  }
+  
+  return found;
+}
+
+bool getQueuedContentHash(const char* filename, uint8_t hash[UPLOAD_HASH_LENGTH], bool* attempted) {
+  QueueLock lock;
+  
+  *attempted = false;
+  if (!queueReady || pendingCount == 0) {
+    return false;
+  }
+  
+  File file = getStorage().open(UPLOAD_QUEUE_FILE, FILE_READ);
+  if (!file) {
+    reportStorageError();
+    return false;
+  }
+  
+  upload_queue_record_t record;
+  uint32_t index;
+  bool found = findPendingRecord(file, filename, &index, &record) && (record.flags & QUEUE_FLAG_HASHED);
+  file.close();
+  
+  if (found) {
+    memcpy(hash, record.contentHash, UPLOAD_HASH_LENGTH);
+    *attempted = (record.flags & QUEUE_FLAG_ATTEMPTED) != 0;
+  }
+  
+  return found;
+}
+
+// Set before the first byte is sent, so after a lost response the next
+// attempt knows to ask the server first. Only the flags byte is rewritten.
+bool markQueuedUploadAttempt(const char* filename) {
+  QueueLock lock;
+  
+  if (!queueReady || pendingCount == 0) {
+    return false;
+  }
+  
+  File file = getStorage().open(UPLOAD_QUEUE_FILE, "r+");
+  if (!file) {
+    reportStorageError();
+    return false;
+  }
+  
+  upload_queue_record_t record;
+  uint32_t index;
+  bool saved = false;
+  if (findPendingRecord(file, filename, &index, &record)) {
+    saved = (record.flags & QUEUE_FLAG_ATTEMPTED) != 0;
+    if (!saved) {
+      uint8_t flags = record.flags | QUEUE_FLAG_ATTEMPTED;
+      saved = file.seek(index * RECORD_SIZE + offsetof(upload_queue_record_t, flags)) &&
+              file.write(&flags, 1) == 1;
+    }
+  }
+  
+  file.close();
+  return saved;
+}
+
+// Rewrites only the offset and URL fields of the record
+bool setQueuedUploadState(const char* filename, uint32_t offset, const char* uploadUrl) {
+  QueueLock lock;
+  
+  if (!queueReady || strlen(uploadUrl) >= UPLOAD_URL_LENGTH) {
+    return false;
+  }
+  
+  File file = getStorage().open(UPLOAD_QUEUE_FILE, "r+");
+  if (!file) {
+    reportStorageError();
+    return false;
+  }
+  
+  upload_queue_record_t record;
+  uint32_t index;
+  bool found = findPendingRecord(file, filename, &index, &record);
+  bool saved = false;
+  if (found) {
+    record.uploadOffset = offset;
+    memset(record.uploadUrl, 0, sizeof(record.uploadUrl));
+    strncpy(record.uploadUrl, uploadUrl, sizeof(record.uploadUrl) - 1);
+    
+    size_t start = offsetof(upload_queue_record_t, uploadOffset);
+    size_t length = RECORD_SIZE - start;
+    saved = file.seek(index * RECORD_SIZE + start) &&
+            file.write((const uint8_t*)&record + start, length) == length;
+  }
+  
+  file.close();
+  
+  if (found && !saved) {
+    reportStorageError();
+  }
+  return saved;
+}
+
+// sizes, when given, receives each file's committed size from its record
+int getPendingUploads(upload_path_t* files, uint32_t* sizes, int maxFiles) {
+  QueueLock lock;
+  
+  if (!queueReady || !files || pendingCount == 0) {
+    return 0;
+  }
+  
+  File file = getStorage().open(UPLOAD_QUEUE_FILE, FILE_READ);
+  if (!file) {
+    reportStorageError();
+    return 0;
+  }
+  
+  upload_queue_record_t record;
+  int found = 0;
+  for (uint32_t i = cursor; i < recordCount && found < maxFiles; i++) {
+    if (!readRecord(file, i, &record)) {
+      break;
+    }
+    if (record.status == QUEUE_STATUS_PENDING) {
+      if (sizes) {
+        sizes[found] = record.fileSize;
+      }
+      memcpy(files[found++], record.path, sizeof(upload_path_t));
+    }
+  }
+  
+  file.close();
+  return found;
+}
+
+int getPendingUploadCount() {
+  return queueReady ? pendingCount : 0;
+}
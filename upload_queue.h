@@ -0,0 +1,29 @@
+#ifndef UPLOAD_QUEUE_H
+#define UPLOAD_QUEUE_H
+
+#include "config.h"
+#include "upload_queue_record.h"
+#include <FS.h>
+
+typedef struct {
+  uint32_t records;
+  uint32_t pending;
+  uint32_t cursor;
+} upload_queue_cursor_t;
+
+bool initializeUploadQueue();
+bool resumeUploadQueue(const upload_queue_cursor_t* saved);
+bool getUploadQueueCursor(upload_queue_cursor_t* saved);
+bool rebuildUploadQueue();
+bool queueRecording(const char* filename, uint32_t fileSize, const uint8_t* contentHash);
+bool maintainUploadQueue();
+bool markQueuedFileUploaded(const char* filename);
+bool getQueuedUploadState(const char* filename, uint32_t* offset, char uploadUrl[UPLOAD_URL_LENGTH]);
+bool setQueuedUploadState(const char* filename, uint32_t offset, const char* uploadUrl);
+bool getQueuedFileSize(const char* filename, uint32_t* fileSize);
+bool getQueuedContentHash(const char* filename, uint8_t hash[UPLOAD_HASH_LENGTH], bool* attempted);
+bool markQueuedUploadAttempt(const char* filename);
+int getPendingUploads(upload_path_t* files, uint32_t* sizes, int maxFiles);
+int getPendingUploadCount();
+
+#endif // UPLOAD_QUEUE_H
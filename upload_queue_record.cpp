@@ -0,0 +1,46 @@
+#include "upload_queue_record.h"
+#include <string.h>
+
+// Paths that do not fit are rejected rather than truncated, since a
+// truncated path would never match the file again. contentHash may be NULL
+// for files found on the card rather than written by the recorder.
+bool initQueueRecord(upload_queue_record_t* record, const char* path, uint32_t fileSize,
+                     const uint8_t* contentHash) {
+  if (strlen(path) >= sizeof(record->path)) {
+    return false;
+  }
+  
+  memset(record, 0, sizeof(*record));
+  record->magic = QUEUE_RECORD_MAGIC;
+  record->status = QUEUE_STATUS_PENDING;
+  record->fileSize = fileSize;
+  strncpy(record->path, path, sizeof(record->path) - 1);
+  if (contentHash) {
+    memcpy(record->contentHash, contentHash, UPLOAD_HASH_LENGTH);
+    record->flags |= QUEUE_FLAG_HASHED;
+  }
+  return true;
+}
+
+bool isQueueRecordValid(const upload_queue_record_t* record) {
+  return record->magic == QUEUE_RECORD_MAGIC &&
+         (record->status == QUEUE_STATUS_PENDING || record->status == QUEUE_STATUS_UPLOADED) &&
+         memchr(record->path, '\0', sizeof(record->path)) != NULL &&
+         memchr(record->uploadUrl, '\0', sizeof(record->uploadUrl)) != NULL;
+}
+
+// False when the journal ends in a partial record (power lost mid-append)
+bool getQueueRecordCount(size_t journalBytes, uint32_t* count) {
+  *count = journalBytes / sizeof(upload_queue_record_t);
+  return journalBytes % sizeof(upload_queue_record_t) == 0;
+}
+
+// Lower-case hex, as sent in the X-Audio-SHA256 header
+void formatContentHash(const uint8_t hash[UPLOAD_HASH_LENGTH], char text[UPLOAD_HASH_LENGTH * 2 + 1]) {
+  static const char digits[] = "0123456789abcdef";
+  for (int i = 0; i < UPLOAD_HASH_LENGTH; i++) {
+    text[i * 2] = digits[hash[i] >> 4];
+    text[i * 2 + 1] = digits[hash[i] & 0x0F];
+  }
+  text[UPLOAD_HASH_LENGTH * 2] = '\0';
+}
@@ -0,0 +1,37 @@
+#ifndef UPLOAD_QUEUE_RECORD_H
+#define UPLOAD_QUEUE_RECORD_H
+
+#include "config.h"
+#include <stddef.h>
+#include <stdint.h>
+
+#define QUEUE_RECORD_MAGIC 0x5553       // Bumped when the record layout changes
+#define UPLOAD_URL_LENGTH 128
+#define UPLOAD_HASH_LENGTH 32           // SHA-256
+#define QUEUE_STATUS_PENDING 0x01
+#define QUEUE_STATUS_UPLOADED 0x00
+#define QUEUE_FLAG_HASHED 0x01          // contentHash is set
+#define QUEUE_FLAG_ATTEMPTED 0x02       // A send started; the server may already have it
+
+// Paths are handled in fixed buffers of the journal's path length
+typedef char upload_path_t[MAX_FILENAME_LENGTH];
+
+// Fixed-size journal record; the status byte is rewritten in place
+typedef struct {
+  uint16_t magic;
+  uint8_t status;
+  uint8_t flags;
+  uint32_t fileSize;
+  uint32_t uploadOffset;             // Bytes the server has acknowledged (resumable mode)
+  char path[MAX_FILENAME_LENGTH];
+  char uploadUrl[UPLOAD_URL_LENGTH]; // Server-side upload resource, empty until created
+  uint8_t contentHash[UPLOAD_HASH_LENGTH];  // Of everything after the data chunk header
+} upload_queue_record_t;
+
+bool initQueueRecord(upload_queue_record_t* record, const char* path, uint32_t fileSize,
+                     const uint8_t* contentHash);
+bool isQueueRecordValid(const upload_queue_record_t* record);
+bool getQueueRecordCount(size_t journalBytes, uint32_t* count);
+void formatContentHash(const uint8_t hash[UPLOAD_HASH_LENGTH], char text[UPLOAD_HASH_LENGTH * 2 + 1]);
+
+#endif // UPLOAD_QUEUE_RECORD_H
@@ -0,0 +1,293 @@
+#include "upload_streamer.h"
+#include "sd_manager.h"
+#include "config.h"
+#include <atomic>
+#include <freertos/FreeRTOS.h>
+#include <freertos/queue.h>
+#include <freertos/task.h>
+#include <esp_heap_caps.h>
+#include <esp_timer.h>
+
+typedef struct {
+  int index;
+  size_t length;
+} filled_buffer_t;
+
+static uint8_t* buffers[UPLOAD_STREAM_DEPTH];
+static QueueHandle_t freeQueue = NULL;
+static QueueHandle_t filledQueue = NULL;
+static TaskHandle_t readerTaskHandle = NULL;
+static bool streamerInitialized = false;
+
+static File* sourceFile = NULL;
+static uint32_t sourceOffset = 0;
+static size_t sourceLength = 0;
+static std::atomic<bool> readerActive(false);
+static std::atomic<bool> abortRead(false);
+static volatile bool readFailed = false;
+static volatile uint32_t rateLimitKBps = 0;
+
+static uint32_t statReadUs = 0;
+static uint32_t statSendStalls = 0;
+static uint32_t statBytes = 0;
+static unsigned long streamStart = 0;
+static uint32_t lastElapsedMs = 0;
+
+static void readerTask(void* param) {
+  for (;;) {
+    ulTaskNotifyTake(pdTRUE, portMAX_DELAY);
+    
+    size_t remaining = sourceLength;
+    bool ok = sourceFile->seek(sourceOffset);
+    int64_t windowStart = esp_timer_get_time();
+    size_t windowBytes = 0;
+    uint32_t windowLimit = rateLimitKBps;
+    
+    while (ok && remaining > 0 && !abortRead.load(std::memory_order_acquire)) {
+      int index;
+      if (xQueueReceive(freeQueue, &index, pdMS_TO_TICKS(UPLOAD_STREAM_WAIT_MS)) != pdTRUE) {
+        continue;
+      }
+      
+      size_t want = MIN(remaining, (size_t)UPLOAD_STREAM_BUFFER_SIZE);
+      int64_t start = esp_timer_get_time();
+      size_t got = sourceFile->read(buffers[index], want);
+      statReadUs += (uint32_t)(esp_timer_get_time() - start);
+      
+      if (got != want) {
+        ok = false;
+      }
+      
+      filled_buffer_t filled = { index, got };
+      xQueueSend(filledQueue, &filled, portMAX_DELAY);
+      remaining -= got;
+      
+      // Hold the average SD read rate to the budget (bytes / (KB/s) = ms).
+      // A budget change restarts the averaging window.
+      uint32_t limit = rateLimitKBps;
+      if (limit != windowLimit) {
+        windowStart = esp_timer_get_time();
+        windowBytes = 0;
+        windowLimit = limit;
+      }
+      windowBytes += got;
+      
+      if (limit > 0) {
+        int64_t dueUs = (int64_t)windowBytes * 1000 / limit;
+        int64_t aheadUs = dueUs - (esp_timer_get_time() - windowStart);
+        if (aheadUs > 1000) {
+          vTaskDelay(pdMS_TO_TICKS(aheadUs / 1000));
+        }
+      }
+    }
+    
+    if (!ok) {
+      readFailed = true;
+      reportStorageError();
+    }
+    readerActive.store(false, std::memory_order_release);
+  }
+}
+
+// HTTPClient pulls the payload through available()/readBytes(). available()
+// returns -1 on a read error, which makes sendRequest() abort the request.
+class ReadAheadStream : public Stream {
+public:
+  void reset() {
+    current = -1;
+    position = 0;
+    length = 0;
+    delivered = 0;
+  }
+  
+  int available() override {
+    if (!fill()) {
+      return readFailed ? -1 : 0;
+    }
+    return (int)(length - position);
+  }
+  
+  int read() override {
+    if (!fill()) {
+      return -1;
+    }
+    delivered++;
+    return buffers[current][position++];
+  }
+  
+  int peek() override {
+    if (!fill()) {
+      return -1;
+    }
+    return buffers[current][position];
+  }
+  
+  size_t readBytes(char* out, size_t count) override {
+    size_t copied = 0;
+    while (copied < count && fill()) {
+      size_t chunk = MIN(count - copied, length - position);
+      memcpy(out + copied, buffers[current] + position, chunk);
+      position += chunk;
+      copied += chunk;
+    }
+    delivered += copied;
+    return copied;
+  }
+  
+  size_t write(uint8_t) override {
+    return 0;
+  }
+  
+  void flush() override {
+  }
+  
+  void release() {
+    if (current >= 0) {
+      xQueueSend(freeQueue, &current, 0);
+      current = -1;
+    }
+  }
+  
+  size_t deliveredBytes() const {
+    return delivered;
+  }
+  
+private:
+  bool fill() {
+    if (current >= 0 && position < length) {
+      return true;
+    }
+    if (delivered >= sourceLength) {
+      return false;
+    }
+    
+    release();
+    
+    filled_buffer_t filled;
+    if (xQueueReceive(filledQueue, &filled, 0) != pdTRUE) {
+      statSendStalls++;
+      if (xQueueReceive(filledQueue, &filled, pdMS_TO_TICKS(UPLOAD_STREAM_WAIT_MS)) != pdTRUE) {
+        return false;
+      }
+    }
+    
+    current = filled.index;
+    position = 0;
+    length = filled.length;
+    
+    if (length == 0) {
+      release();
+      return false;
+    }
+    return true;
+  }
+  
+  int current;
+  size_t position;
+  size_t length;
+  size_t delivered;
+};
+
+static ReadAheadStream stream;
+
+bool initializeUploadStreamer() {
+  if (streamerInitialized) {
+    return true;
+  }
+  
+  freeQueue = xQueueCreate(UPLOAD_STREAM_DEPTH, sizeof(int));
+  filledQueue = xQueueCreate(UPLOAD_STREAM_DEPTH, sizeof(filled_buffer_t));
+  if (!freeQueue || !filledQueue) {
+    DEBUG_PRINTLN("Failed to create upload stream queues");
+    return false;
+  }
+  
+  for (int i = 0; i < UPLOAD_STREAM_DEPTH; i++) {
+    // Internal DMA memory lets the SD driver read straight into the buffer
+    buffers[i] = (uint8_t*)heap_caps_malloc(UPLOAD_STREAM_BUFFER_SIZE, MALLOC_CAP_DMA | MALLOC_CAP_8BIT);
+    if (!buffers[i]) {
+      buffers[i] = (uint8_t*)heap_caps_malloc(UPLOAD_STREAM_BUFFER_SIZE, MALLOC_CAP_SPIRAM | MALLOC_CAP_8BIT);
+    }
+    if (!buffers[i]) {
+      DEBUG_PRINTF("Failed to allocate %d byte upload buffer\n", UPLOAD_STREAM_BUFFER_SIZE);
+      return false;
+    }
+    xQueueSend(freeQueue, &i, 0);
+  }
+  
+  BaseType_t created = xTaskCreatePinnedToCore(readerTask, "upload_reader",
+                                               UPLOAD_READER_TASK_STACK_SIZE, NULL,
+                                               UPLOAD_READER_TASK_PRIORITY, &readerTaskHandle,
+                                               UPLOAD_READER_TASK_CORE);
+  if (created != pdPASS) {
+    DEBUG_PRINTLN("Failed to create upload reader task");
+    return false;
+  }
+  
+  streamerInitialized = true;
+  DEBUG_PRINTF("Upload streamer initialized (%d x %d bytes)\n", UPLOAD_STREAM_DEPTH, UPLOAD_STREAM_BUFFER_SIZE);
+  return true;
+}
+
+Stream* beginUploadStream(File* file, uint32_t offset, size_t length) {
+  if (!streamerInitialized || !file || readerActive.load(std::memory_order_acquire)) {
+    return NULL;
+  }
+  
+  sourceFile = file;
+  sourceOffset = offset;
+  sourceLength = length;
+  readFailed = false;
+  abortRead.store(false, std::memory_order_relaxed);
+  
+  stream.reset();
+  statReadUs = 0;
+  statSendStalls = 0;
+  streamStart = millis();
+  
+  readerActive.store(true, std::memory_order_release);
+  xTaskNotifyGive(readerTaskHandle);
+  return &stream;
+}
+
+// Stops the reader (if the send ended early) and returns every buffer to the
+// free queue so the next stream starts with the full window
+void endUploadStream() {
+  if (!streamerInitialized) {
+    return;
+  }
+  
+  abortRead.store(true, std::memory_order_release);
+  stream.release();
+  
+  filled_buffer_t filled;
+  while (readerActive.load(std::memory_order_acquire)) {
+    if (xQueueReceive(filledQueue, &filled, pdMS_TO_TICKS(10)) == pdTRUE) {
+      xQueueSend(freeQueue, &filled.index, 0);
+    }
+  }
+  while (xQueueReceive(filledQueue, &filled, 0) == pdTRUE) {
+    xQueueSend(freeQueue, &filled.index, 0);
+  }
+  
+  statBytes = stream.deliveredBytes();
+  lastElapsedMs = millis() - streamStart;
+  sourceFile = NULL;
+}
+
+// 0 = unlimited; takes effect from the next buffer of a running stream
+void setUploadStreamRateLimit(uint32_t kbytesPerSecond) {
+  rateLimitKBps = kbytesPerSecond;
+}
+
+void getUploadStreamStats(upload_stream_stats_t* stats) {
+  if (!stats) {
+    return;
+  }
+  
+  stats->bytes = statBytes;
+  stats->elapsedMs = lastElapsedMs;
+  stats->kbytesPerSecond = lastElapsedMs > 0 ? statBytes / lastElapsedMs : 0;
+  stats->readUs = statReadUs;
+  stats->sendStalls = statSendStalls;
+}
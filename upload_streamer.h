@@ -0,0 +1,21 @@
+#ifndef UPLOAD_STREAMER_H
+#define UPLOAD_STREAMER_H
+
+#include "config.h"
+#include <FS.h>
+
+typedef struct {
+  uint32_t bytes;
+  uint32_t elapsedMs;
+  uint32_t kbytesPerSecond;
+  uint32_t readUs;          // Time the reader spent in SD reads
+  uint32_t sendStalls;      // Times the sender found no buffer ready
+} upload_stream_stats_t;
+
+bool initializeUploadStreamer();
+Stream* beginUploadStream(File* file, uint32_t offset, size_t length);
+void endUploadStream();
+void setUploadStreamRateLimit(uint32_t kbytesPerSecond);
+void getUploadStreamStats(upload_stream_stats_t* stats);
+
+#endif // UPLOAD_STREAMER_H
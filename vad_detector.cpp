@@ -0,0 +1,96 @@
+#include "vad_detector.h"
+
+#define NOISE_FLOOR_MIN ((uint32_t)VAD_NOISE_FLOOR * VAD_NOISE_FLOOR)
+#define SENSITIVITY_SQUARED_Q8 ((uint32_t)(VAD_SENSITIVITY * VAD_SENSITIVITY * 256))
+#define RMS_THRESHOLD_SQUARED ((uint32_t)VAD_RMS_THRESHOLD * VAD_RMS_THRESHOLD)
+#define NOISE_UPDATE_INTERVAL_MS 100
+
+void vadDetectorReset(vad_detector_t* detector, uint32_t nowMs) {
+  detector->noiseFloor = NOISE_FLOOR_MIN;
+  detector->runningAverage = 0;
+  detector->lastNoiseUpdateMs = nowMs;
+  detector->speechRun = 0;
+  detector->hangoverLeft = 0;
+}
+
+static void updateNoiseFloor(vad_detector_t* detector, uint32_t variance, uint32_t nowMs) {
+  if (nowMs - detector->lastNoiseUpdateMs < NOISE_UPDATE_INTERVAL_MS) {
+    return;
+  }
+  
+  // Same 0.95 / 0.99 smoothing as before, applied to squared levels
+  detector->runningAverage = detector->runningAverage - detector->runningAverage / 20 + variance / 20;
+  
+  // 1.5x in amplitude is 2.25x in energy
+  if ((uint64_t)variance * 4 < (uint64_t)detector->noiseFloor * 9) {
+    detector->noiseFloor = detector->noiseFloor - detector->noiseFloor / 100 + variance / 100;
+  }
+  
+  detector->noiseFloor = MAX(detector->noiseFloor, NOISE_FLOOR_MIN);
+  detector->lastNoiseUpdateMs = nowMs;
+}
+
+// The FFT only runs on windows that already pass the energy gate, so quiet
+// rooms cost the same as energy mode
+static bool applySpectralGate(vad_detector_t* detector, const int16_t* samples, size_t count,
+                              bool energyVoice, vad_decision_t* decision) {
+  bool speech = false;
+  
+  if (energyVoice) {
+    computeSpectralFeatures(samples, count, &decision->features);
+    decision->spectralChecked = true;
+    speech = decision->features.bandRatio >= VAD_SPECTRAL_BAND_RATIO &&
+             decision->features.flatness <= VAD_SPECTRAL_FLATNESS_MAX;
+  }
+  
+  if (speech) {
+    detector->speechRun++;
+    if (detector->speechRun >= VAD_ONSET_WINDOWS) {
+      detector->hangoverLeft = VAD_HANGOVER_WINDOWS;
+    }
+  } else {
+    detector->speechRun = 0;
+    if (detector->hangoverLeft > 0) {
+      detector->hangoverLeft--;
+    }
+  }
+  
+  return detector->hangoverLeft > 0;
+}
+
+bool vadDetectorAnalyze(vad_detector_t* detector, const int16_t* samples, size_t count,
+                        uint32_t nowMs, vad_decision_t* decision) {
+  decision->spectralChecked = false;
+  if (count == VAD_SAMPLE_WINDOW) {
+    computeVADWindowStatsFixed<VAD_SAMPLE_WINDOW>(samples, &decision->stats);
+  } else {
+    computeVADWindowStats(samples, count, &decision->stats);
+  }
+  uint32_t variance = decision->stats.variance;
+  
+  updateNoiseFloor(detector, variance, nowMs);
+  
+  uint32_t threshold = (uint32_t)(((uint64_t)detector->noiseFloor * SENSITIVITY_SQUARED_Q8) >> 8);
+  decision->threshold = MAX(threshold, (uint32_t)VAD_VARIANCE_MIN);
+  
+  // Test 6 measured RMS with DC removed, so RMS squared is the variance
+  bool voiceDetected = (variance > RMS_THRESHOLD_SQUARED) && (variance > decision->threshold);
+  
+  // The spectral gate replaces the variance ceiling as the loud-noise filter
+  if (VAD_MODE == VAD_MODE_SPECTRAL) {
+    return applySpectralGate(detector, samples, count, voiceDetected, decision);
+  }
+  
+  return voiceDetected && (variance < VAD_VARIANCE_MAX);
+}
+
+void vadDetectorCalibrate(vad_detector_t* detector, uint32_t averageVariance) {
+  // 1.2x headroom in amplitude
+  detector->noiseFloor = MAX((uint32_t)((uint64_t)averageVariance * 144 / 100), NOISE_FLOOR_MIN);
+}
+
+// Levels saved from an earlier run; the floor keeps its lower bound
+void vadDetectorRestore(vad_detector_t* detector, uint32_t noiseFloor, uint32_t runningAverage) {
+  detector->noiseFloor = MAX(noiseFloor, NOISE_FLOOR_MIN);
+  detector->runningAverage = runningAverage;
+}
@@ -0,0 +1,34 @@
+#ifndef VAD_DETECTOR_H
+#define VAD_DETECTOR_H
+
+#include "config.h"
+#include "vad_kernel.h"
+#include "vad_spectral.h"
+#include <stddef.h>
+#include <stdint.h>
+
+// Per-window voice decision with no hardware dependencies; time is passed
+// in so the same code runs on the device and against recorded audio.
+// Levels are squared values (variance of the mean-removed signal).
+typedef struct {
+  uint32_t noiseFloor;
+  uint32_t runningAverage;
+  uint32_t lastNoiseUpdateMs;
+  int speechRun;             // Consecutive speech windows (spectral mode)
+  int hangoverLeft;          // Windows still held on after speech ends
+} vad_detector_t;
+
+typedef struct {
+  vad_window_stats_t stats;
+  uint32_t threshold;
+  bool spectralChecked;      // features is only filled when this is set
+  vad_spectral_features_t features;
+} vad_decision_t;
+
+void vadDetectorReset(vad_detector_t* detector, uint32_t nowMs);
+bool vadDetectorAnalyze(vad_detector_t* detector, const int16_t* samples, size_t count,
+                        uint32_t nowMs, vad_decision_t* decision);
+void vadDetectorCalibrate(vad_detector_t* detector, uint32_t averageVariance);
+void vadDetectorRestore(vad_detector_t* detector, uint32_t noiseFloor, uint32_t runningAverage);
+
+#endif // VAD_DETECTOR_H
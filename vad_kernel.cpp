@@ -0,0 +1,20 @@
+#include "vad_kernel.h"
+
+// Partial windows at the end of a short block take the runtime-length path
+void computeVADWindowStats(const int16_t* samples, size_t count, vad_window_stats_t* stats) {
+  if (count == 0) {
+    stats->mean = 0;
+    stats->meanSquare = 0;
+    stats->variance = 0;
+    return;
+  }
+
+  vad_window_sums_t sums = accumulateVADWindow(samples, count);
+  for (size_t i = count & ~(size_t)3; i < count; i++) {
+    int32_t s = samples[i];
+    sums.sum += s;
+    sums.squares += (uint32_t)(s * s);
+  }
+
+  finishVADWindowStats(sums, count, stats);
+}
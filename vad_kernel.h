@@ -0,0 +1,65 @@
+#ifndef VAD_KERNEL_H
+#define VAD_KERNEL_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+// All energies stay squared so the decision needs no sqrt
+typedef struct {
+  int32_t mean;
+  uint32_t meanSquare;
+  uint32_t variance;
+} vad_window_stats_t;
+
+typedef struct {
+  int64_t sum;
+  uint64_t squares;
+} vad_window_sums_t;
+
+// One pass over the window produces sum and sum of squares; variance follows
+// from n*sum(x^2) - sum(x)^2. Two independent accumulator pairs let the core
+// overlap the multiplies. A pair of squared int16 samples fits in 32 bits, so
+// only the running sums of squares need 64-bit adds. Samples past the last
+// multiple of 4 are left to the caller.
+static inline vad_window_sums_t accumulateVADWindow(const int16_t* samples, size_t count) {
+  int32_t sumA = 0;
+  int32_t sumB = 0;
+  uint64_t squaresA = 0;
+  uint64_t squaresB = 0;
+
+  for (size_t i = 0; i + 4 <= count; i += 4) {
+    int32_t s0 = samples[i];
+    int32_t s1 = samples[i + 1];
+    int32_t s2 = samples[i + 2];
+    int32_t s3 = samples[i + 3];
+
+    sumA += s0 + s1;
+    sumB += s2 + s3;
+    squaresA += (uint32_t)(s0 * s0) + (uint32_t)(s1 * s1);
+    squaresB += (uint32_t)(s2 * s2) + (uint32_t)(s3 * s3);
+  }
+
+  vad_window_sums_t sums = { (int64_t)sumA + sumB, squaresA + squaresB };
+  return sums;
+}
+
+static inline void finishVADWindowStats(const vad_window_sums_t& sums, size_t count, vad_window_stats_t* stats) {
+  uint64_t n = count;
+  uint64_t spread = n * sums.squares - (uint64_t)(sums.sum * sums.sum);
+
+  stats->mean = (int32_t)(sums.sum / (int64_t)n);
+  stats->meanSquare = (uint32_t)(sums.squares / n);
+  stats->variance = (uint32_t)(spread / (n * n));
+}
+
+void computeVADWindowStats(const int16_t* samples, size_t count, vad_window_stats_t* stats);
+
+// Full windows have their length fixed at compile time, so the loop has a
+// constant trip count and the divisions by n fold into shifts
+template <size_t N>
+inline void computeVADWindowStatsFixed(const int16_t* samples, vad_window_stats_t* stats) {
+  static_assert(N >= 4 && N % 4 == 0, "Fixed VAD windows must be a multiple of 4 samples");
+  finishVADWindowStats(accumulateVADWindow(samples, N), N, stats);
+}
+
+#endif // VAD_KERNEL_H
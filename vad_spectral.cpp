@@ -0,0 +1,128 @@
+#include "vad_spectral.h"
+#include <math.h>
+#include <string.h>
+
+#define FFT_SIZE VAD_SAMPLE_WINDOW
+#define FFT_BINS (FFT_SIZE / 2)
+
+static_assert((FFT_SIZE & (FFT_SIZE - 1)) == 0 && FFT_SIZE >= 64, "VAD_SAMPLE_WINDOW must be a power of two for the spectral VAD");
+
+// Bin k covers k * SAMPLE_RATE / FFT_SIZE Hz (62.5 Hz at 16 kHz / 256)
+#define BAND_LOW_BIN ((VAD_SPEECH_BAND_LOW_HZ * FFT_SIZE + SAMPLE_RATE / 2) / SAMPLE_RATE)
+#define BAND_HIGH_BIN ((VAD_SPEECH_BAND_HIGH_HZ * FFT_SIZE + SAMPLE_RATE / 2) / SAMPLE_RATE)
+
+static_assert(BAND_LOW_BIN >= 1 && BAND_HIGH_BIN < FFT_BINS && BAND_LOW_BIN < BAND_HIGH_BIN, "Speech band must fit inside the FFT");
+
+static float window[FFT_SIZE];
+static float twiddleCos[FFT_BINS];
+static float twiddleSin[FFT_BINS];
+static uint16_t bitReverse[FFT_SIZE];
+static float re[FFT_SIZE];
+static float im[FFT_SIZE];
+static bool tablesReady = false;
+
+bool initializeSpectralVAD() {
+  if (tablesReady) {
+    return true;
+  }
+
+  int bits = 0;
+  while ((1 << bits) < FFT_SIZE) {
+    bits++;
+  }
+
+  for (int i = 0; i < FFT_SIZE; i++) {
+    window[i] = 0.5f - 0.5f * cosf(2.0f * (float)M_PI * i / (FFT_SIZE - 1));
+
+    uint16_t reversed = 0;
+    for (int b = 0; b < bits; b++) {
+      if (i & (1 << b)) {
+        reversed |= 1 << (bits - 1 - b);
+      }
+    }
+    bitReverse[i] = reversed;
+  }
+
+  for (int i = 0; i < FFT_BINS; i++) {
+    twiddleCos[i] = cosf(2.0f * (float)M_PI * i / FFT_SIZE);
+    twiddleSin[i] = -sinf(2.0f * (float)M_PI * i / FFT_SIZE);
+  }
+
+  tablesReady = true;
+  return true;
+}
+
+// In-place iterative radix-2 FFT over re/im
+static void runFFT() {
+  for (int len = 2; len <= FFT_SIZE; len <<= 1) {
+    int half = len >> 1;
+    int stride = FFT_SIZE / len;
+
+    for (int start = 0; start < FFT_SIZE; start += len) {
+      for (int k = 0; k < half; k++) {
+        float wr = twiddleCos[k * stride];
+        float wi = twiddleSin[k * stride];
+        int a = start + k;
+        int b = a + half;
+
+        float tr = re[b] * wr - im[b] * wi;
+        float ti = re[b] * wi + im[b] * wr;
+        re[b] = re[a] - tr;
+        im[b] = im[a] - ti;
+        re[a] += tr;
+        im[a] += ti;
+      }
+    }
+  }
+}
+
+void computeSpectralFeatures(const int16_t* samples, size_t count, vad_spectral_features_t* features) {
+  features->bandRatio = 0.0f;
+  features->flatness = 1.0f;
+
+  if (!tablesReady || count == 0) {
+    return;
+  }
+
+  count = count < FFT_SIZE ? count : FFT_SIZE;
+
+  int32_t sum = 0;
+  for (size_t i = 0; i < count; i++) {
+    sum += samples[i];
+  }
+  float mean = (float)sum / count;
+
+  // Short windows are zero padded; the Hann taper and mean removal keep the
+  // PDM DC offset out of the low bins
+  for (int i = 0; i < FFT_SIZE; i++) {
+    int j = bitReverse[i];
+    re[j] = i < (int)count ? ((float)samples[i] - mean) * window[i] : 0.0f;
+    im[j] = 0.0f;
+  }
+
+  runFFT();
+
+  float totalEnergy = 0.0f;
+  float bandEnergy = 0.0f;
+  float logSum = 0.0f;
+
+  for (int k = 1; k < FFT_BINS; k++) {
+    float power = re[k] * re[k] + im[k] * im[k];
+    totalEnergy += power;
+
+    if (k >= BAND_LOW_BIN && k <= BAND_HIGH_BIN) {
+      bandEnergy += power;
+      logSum += logf(power + 1e-3f);
+    }
+  }
+
+  if (totalEnergy <= 0.0f) {
+    return;
+  }
+
+  const int bandBins = BAND_HIGH_BIN - BAND_LOW_BIN + 1;
+  float arithmeticMean = bandEnergy / bandBins;
+
+  features->bandRatio = bandEnergy / totalEnergy;
+  features->flatness = arithmeticMean > 0.0f ? expf(logSum / bandBins) / arithmeticMean : 1.0f;
+}
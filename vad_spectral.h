@@ -0,0 +1,16 @@
+#ifndef VAD_SPECTRAL_H
+#define VAD_SPECTRAL_H
+
+#include "config.h"
+#include <stddef.h>
+#include <stdint.h>
+
+typedef struct {
+  float bandRatio;   // Share of AC energy inside the speech band
+  float flatness;    // In-band geometric / arithmetic mean, 1.0 = white noise
+} vad_spectral_features_t;
+
+bool initializeSpectralVAD();
+void computeSpectralFeatures(const int16_t* samples, size_t count, vad_spectral_features_t* features);
+
+#endif // VAD_SPECTRAL_H
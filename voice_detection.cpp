@@ -1,51 +1,76 @@
 #include "voice_detection.h"
+#include "audio_pipeline.h"
+#include "vad_detector.h"
+#include "metrics.h"
 #include "config.h"
 #include <math.h>
+#include <esp_timer.h>
 
-static float noiseFloor = VAD_NOISE_FLOOR;
-static float currentAudioLevel = 0.0;
-static int16_t vadBuffer[VAD_SAMPLE_WINDOW];
+// Whole blocks split into full windows, which take the fixed-length kernel
+static_assert(PIPELINE_BLOCK_SAMPLES % VAD_SAMPLE_WINDOW == 0, "Pipeline blocks must hold whole VAD windows");
+
+static vad_detector_t detector;
+static uint32_t currentVariance = 0;
 static bool vadInitialized = false;
-static unsigned long lastNoiseUpdate = 0;
-static float runningAverage = 0.0;
-static int sampleCount = 0;
-
-void initializeVAD() {
-  noiseFloor = VAD_NOISE_FLOOR;
-  currentAudioLevel = 0.0;
-  runningAverage = 0.0;
-  sampleCount = 0;
-  lastNoiseUpdate = millis();
+static bool lastVoiceDetected = false;
+
+static uint32_t statBlocks = 0;
+static uint64_t statTotalBlockUs = 0;
+static uint32_t statMaxBlockUs = 0;
+static uint32_t statOverBudget = 0;
+static unsigned long lastStatsReport = 0;
+
+// Window-level debug output, at most once per VAD_DEBUG_INTERVAL_MS
+static bool debugDue = false;
+static unsigned long lastDebugPrint = 0;
+
+// saved skips the 3 s calibration, e.g. on a warm boot
+void initializeVAD(const vad_calibration_t* saved) {
+  vadDetectorReset(&detector, millis());
+  currentVariance = 0;
+  lastVoiceDetected = false;
+  
+  if (VAD_MODE == VAD_MODE_SPECTRAL && !initializeSpectralVAD()) {
+    DEBUG_PRINTLN("Spectral VAD unavailable");
+    return;
+  }
+  
   vadInitialized = true;
   
-  DEBUG_PRINTLN("VAD initialized");
+  DEBUG_PRINTF("VAD initialized (%s mode)\n", VAD_MODE == VAD_MODE_SPECTRAL ? "spectral" : "energy");
+  
+  if (saved) {
+    vadDetectorRestore(&detector, saved->noiseFloor, saved->runningAverage);
+    DEBUG_PRINTF("VAD calibration restored. Noise floor: %lu (variance)\n", detector.noiseFloor);
+    return;
+  }
   
   calibrateVAD();
 }
 
-float calculateRMS(int16_t* samples, int count) {
-  if (count <= 0) return 0.0;
-  
-  float sum = 0.0;
-  for (int i = 0; i < count; i++) {
-    float sample = (float)samples[i];
-    sum += sample * sample;
-  }
-  
-  return sqrt(sum / count);
+void getVADCalibration(vad_calibration_t* calibration) {
+  calibration->noiseFloor = detector.noiseFloor;
+  calibration->runningAverage = detector.runningAverage;
 }
 
-float calculateZeroCrossingRate(int16_t* samples, int count) {
-  if (count <= 1) return 0.0;
-  
-  int crossings = 0;
-  for (int i = 1; i < count; i++) {
-    if ((samples[i-1] >= 0 && samples[i] < 0) || (samples[i-1] < 0 && samples[i] >= 0)) {
-      crossings++;
+static bool analyzeWindow(const int16_t* samples, size_t count) {
+  vad_decision_t decision;
+  bool voiceDetected = vadDetectorAnalyze(&detector, samples, count, millis(), &decision);
+  currentVariance = decision.stats.variance;
+  
+  if (debugDue) {
+    if (decision.spectralChecked) {
+      DEBUG_PRINTF("VAD - Band ratio: %.2f, Flatness: %.2f\n",
+                   decision.features.bandRatio, decision.features.flatness);
     }
+    DEBUG_PRINTF("VAD - Variance: %lu, Mean: %ld, Noise: %lu, Threshold: %lu, Voice: %s\n", 
+                 decision.stats.variance, decision.stats.mean, detector.noiseFloor,
+                 decision.threshold, voiceDetected ? "YES" : "NO");
+    debugDue = false;
+    lastDebugPrint = millis();
   }
   
-  return (float)crossings / (count - 1);
+  return voiceDetected;
 }
 
 bool detectVoiceActivity() {
@@ -53,85 +78,113 @@ bool detectVoiceActivity() {
     return false;
   }
 
-  size_t bytesRead = 0;
-  esp_err_t err = i2s_read(I2S_PORT, vadBuffer, sizeof(vadBuffer), &bytesRead, 0);
-  
-  if (err != ESP_OK || bytesRead == 0) {
-    return false;
+  audio_block_t block;
+  bool analyzed = false;
+  bool voiceDetected = false;
+  debugDue = DEBUG_ENABLED && millis() - lastDebugPrint >= VAD_DEBUG_INTERVAL_MS;
+
+  while (acquireAudioBlock(PIPELINE_CONSUMER_VAD, &block)) {
+    int64_t start = esp_timer_get_time();
+    
+    for (size_t offset = 0; offset < block.sampleCount; offset += VAD_SAMPLE_WINDOW) {
+      size_t count = MIN((size_t)VAD_SAMPLE_WINDOW, block.sampleCount - offset);
+      uint32_t windowStart = metricsCycleCount();
+      if (analyzeWindow(block.samples + offset, count)) {
+        voiceDetected = true;
+      }
+      recordMetricCycles(METRIC_VAD_WINDOW, windowStart);
+    }
+    releaseAudioBlock(PIPELINE_CONSUMER_VAD, &block);
+    analyzed = true;
+    
+    uint32_t elapsed = (uint32_t)(esp_timer_get_time() - start);
+    statBlocks++;
+    statTotalBlockUs += elapsed;
+    statMaxBlockUs = MAX(statMaxBlockUs, elapsed);
+    if (elapsed > VAD_BLOCK_BUDGET_US) {
+      statOverBudget++;
+    }
+  }
+
+  // No new audio since the last call: keep reporting the previous decision
+  if (analyzed) {
+    lastVoiceDetected = voiceDetected;
   }
   
-  int sampleCount = bytesRead / sizeof(int16_t);
-  
-  float rms = calculateRMS(vadBuffer, sampleCount);
-  float zcr = calculateZeroCrossingRate(vadBuffer, sampleCount);
-  
-  currentAudioLevel = rms;
-  
-  updateNoiseFloor();
-  
-  float threshold = noiseFloor * VAD_SENSITIVITY;
-  
-  bool voiceDetected = (rms > threshold) && (zcr > 0.1) && (zcr < 0.8);
-  
-  if (DEBUG_ENABLED && millis() % 1000 == 0) {
-    DEBUG_PRINTF("VAD - RMS: %.2f, ZCR: %.3f, Noise: %.2f, Threshold: %.2f, Voice: %s\n", 
-                 rms, zcr, noiseFloor, threshold, voiceDetected ? "YES" : "NO");
+  if (DEBUG_ENABLED && millis() - lastStatsReport >= 10000) {
+    DEBUG_PRINTF("VAD CPU: %lu blocks, avg %lu us, max %lu us, over budget %lu\n",
+                 statBlocks, (uint32_t)(statBlocks > 0 ? statTotalBlockUs / statBlocks : 0),
+                 statMaxBlockUs, statOverBudget);
+    resetVADCpuStats();
+    lastStatsReport = millis();
   }
   
-  return voiceDetected;
+  return lastVoiceDetected;
 }
 
-void updateNoiseFloor() {
-  if (millis() - lastNoiseUpdate < 100) {
+void getVADCpuStats(vad_cpu_stats_t* stats) {
+  if (!stats) {
     return;
   }
   
-  runningAverage = (runningAverage * 0.95) + (currentAudioLevel * 0.05);
-  
-  if (currentAudioLevel < noiseFloor * 1.5) {
-    noiseFloor = (noiseFloor * 0.99) + (currentAudioLevel * 0.01);
-  }
-  
-  noiseFloor = MAX(noiseFloor, VAD_NOISE_FLOOR);
-  
-  lastNoiseUpdate = millis();
-  sampleCount++;
+  stats->blocks = statBlocks;
+  stats->avgBlockUs = statBlocks > 0 ? (uint32_t)(statTotalBlockUs / statBlocks) : 0;
+  stats->maxBlockUs = statMaxBlockUs;
+  stats->overBudget = statOverBudget;
+}
+
+void resetVADCpuStats() {
+  statBlocks = 0;
+  statTotalBlockUs = 0;
+  statMaxBlockUs = 0;
+  statOverBudget = 0;
 }
 
 float getAudioLevel() {
-  return currentAudioLevel;
+  return sqrtf((float)currentVariance);
+}
+
+static bool waitForAudioBlock(audio_block_t* block, unsigned long timeoutMs) {
+  unsigned long waitStart = millis();
+  
+  while (!acquireAudioBlock(PIPELINE_CONSUMER_VAD, block)) {
+    if (millis() - waitStart > timeoutMs) {
+      return false;
+    }
+    delay(1);
+  }
+  
+  return true;
 }
 
 void calibrateVAD() {
   DEBUG_PRINTLN("Calibrating VAD - please remain quiet for 3 seconds...");
   
-  float samples[30];
+  uint64_t sum = 0;
   int sampleIndex = 0;
   
   for (int i = 0; i < 30; i++) {
-    size_t bytesRead = 0;
-    esp_err_t err = i2s_read(I2S_PORT, vadBuffer, sizeof(vadBuffer), &bytesRead, portMAX_DELAY);
+    syncConsumerToLatest(PIPELINE_CONSUMER_VAD);
     
-    if (err == ESP_OK && bytesRead > 0) {
-      int count = bytesRead / sizeof(int16_t);
-      float rms = calculateRMS(vadBuffer, count);
-      samples[sampleIndex++] = rms;
+    audio_block_t block;
+    if (waitForAudioBlock(&block, CAPTURE_READ_TIMEOUT_MS)) {
+      vad_window_stats_t stats;
+      computeVADWindowStats(block.samples, MIN(VAD_SAMPLE_WINDOW, (int)block.sampleCount), &stats);
+      if (releaseAudioBlock(PIPELINE_CONSUMER_VAD, &block)) {
+        sum += stats.variance;
+        sampleIndex++;
+      }
     }
     
     delay(100);
   }
   
+  syncConsumerToLatest(PIPELINE_CONSUMER_VAD);
+  
   if (sampleIndex > 0) {
-    float sum = 0.0;
-    for (int i = 0; i < sampleIndex; i++) {
-      sum += samples[i];
-    }
-    
-    float averageNoise = sum / sampleIndex;
-    noiseFloor = MAX(averageNoise * 1.2, VAD_NOISE_FLOOR);
-    
-    DEBUG_PRINTF("VAD calibration complete. Noise floor: %.2f\n", noiseFloor);
+    vadDetectorCalibrate(&detector, (uint32_t)(sum / sampleIndex));
+    DEBUG_PRINTF("VAD calibration complete. Noise floor: %lu (variance)\n", detector.noiseFloor);
   } else {
     DEBUG_PRINTLN("VAD calibration failed, using default values");
   }
-}
\ No newline at end of file
+}
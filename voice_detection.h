@@ -2,12 +2,26 @@
 #define VOICE_DETECTION_H
 
 #include "config.h"
-#include <driver/i2s.h>
 
-void initializeVAD();
+// Time spent analysing each pipeline block, against VAD_BLOCK_BUDGET_US
+typedef struct {
+  uint32_t blocks;
+  uint32_t avgBlockUs;
+  uint32_t maxBlockUs;
+  uint32_t overBudget;
+} vad_cpu_stats_t;
+
+typedef struct {
+  uint32_t noiseFloor;
+  uint32_t runningAverage;
+} vad_calibration_t;
+
+void initializeVAD(const vad_calibration_t* saved);
+void getVADCalibration(vad_calibration_t* calibration);
 bool detectVoiceActivity();
-void updateNoiseFloor();
 float getAudioLevel();
 void calibrateVAD();
+void getVADCpuStats(vad_cpu_stats_t* stats);
+void resetVADCpuStats();
 
 #endif // VOICE_DETECTION_H
\ No newline at end of file
@@ -0,0 +1,46 @@
+#include "warm_boot.h"
+#include "sd_manager.h"
+#include <esp_attr.h>
+#include <esp_sleep.h>
+
+// Bump when warm_boot_state_t changes so an old layout is never read
+#define WARM_BOOT_MAGIC 0x57424F31
+
+static RTC_DATA_ATTR warm_boot_state_t warmState;
+static bool warmBoot = false;
+
+// Call once at the top of setup(), before anything reads the state
+bool detectWarmBoot() {
+  warmBoot = WARM_BOOT_ENABLED && warmState.magic == WARM_BOOT_MAGIC &&
+             esp_sleep_get_wakeup_cause() == ESP_SLEEP_WAKEUP_TIMER;
+  
+  if (warmBoot) {
+    warmState.wakeCount++;
+  } else {
+    warmState.wakeCount = 0;
+  }
+  
+  // Spent either way: a reset before the next sleep must not reuse it
+  warmState.magic = 0;
+  return warmBoot;
+}
+
+bool isWarmBoot() {
+  return warmBoot;
+}
+
+const warm_boot_state_t* getWarmBootState() {
+  return &warmState;
+}
+
+// Right before deep sleep, once nothing else is touching the card
+void saveWarmBootState() {
+  if (!WARM_BOOT_ENABLED) {
+    return;
+  }
+  
+  warmState.storageMode = getStorageModeIndex();
+  getVADCalibration(&warmState.vad);
+  warmState.queueValid = getUploadQueueCursor(&warmState.queue);
+  warmState.magic = WARM_BOOT_MAGIC;
+}
@@ -0,0 +1,25 @@
+#ifndef WARM_BOOT_H
+#define WARM_BOOT_H
+
+#include "config.h"
+#include "voice_detection.h"
+#include "upload_queue.h"
+
+// What a wake from our own deep sleep can reuse instead of recomputing.
+// Lives in RTC slow memory, so only a timer wakeup trusts it; any other
+// reset starts cold.
+typedef struct {
+  uint32_t magic;
+  uint32_t wakeCount;
+  int storageMode;                // Last SD mode that mounted and probed clean
+  vad_calibration_t vad;
+  bool queueValid;
+  upload_queue_cursor_t queue;
+} warm_boot_state_t;
+
+bool detectWarmBoot();
+bool isWarmBoot();
+const warm_boot_state_t* getWarmBootState();
+void saveWarmBootState();
+
+#endif // WARM_BOOT_H
@@ -0,0 +1,34 @@
+#include "wav_header.h"
+#include <string.h>
+
+wav_header_t createWAVHeader(uint32_t dataSize) {
+  return makeWAVHeader<device_audio_format>(dataSize);
+}
+
+wav_adpcm_header_t createADPCMWAVHeader(uint32_t dataSize, uint32_t sampleFrames) {
+  return makeADPCMWAVHeader<device_audio_format>(dataSize, sampleFrames);
+}
+
+// trailingBytes covers chunks written after the audio data
+size_t fillWAVHeader(uint8_t* buffer, uint32_t dataSize, uint32_t sampleFrames, uint32_t trailingBytes) {
+#if AUDIO_CODEC == CODEC_PCM
+  wav_header_t header = createWAVHeader(dataSize);
+#else
+  wav_adpcm_header_t header = createADPCMWAVHeader(dataSize, sampleFrames);
+#endif
+  header.chunkSize += trailingBytes;
+  memcpy(buffer, &header, sizeof(header));
+  return sizeof(header);
+}
+
+// RIFF chunks start on even offsets, so a chunk written after odd-length
+// data is preceded by a zero pad byte (not counted in the data size)
+size_t fillTrailingChunkHeader(uint8_t* buffer, const char id[4], uint32_t dataSize, uint32_t payloadSize) {
+  size_t length = 0;
+  if (dataSize & 1) {
+    buffer[length++] = 0;
+  }
+  memcpy(buffer + length, id, 4);
+  memcpy(buffer + length + 4, &payloadSize, sizeof(payloadSize));
+  return length + 8;
+}
@@ -0,0 +1,81 @@
+#ifndef WAV_HEADER_H
+#define WAV_HEADER_H
+
+#include "config.h"
+#include "audio_format.h"
+#include "audio_encoder.h"
+#include <stddef.h>
+#include <stdint.h>
+
+typedef struct {
+  char chunkID[4];
+  uint32_t chunkSize;
+  char format[4];
+  char subchunk1ID[4];
+  uint32_t subchunk1Size;
+  uint16_t audioFormat;
+  uint16_t numChannels;
+  uint32_t sampleRate;
+  uint32_t byteRate;
+  uint16_t blockAlign;
+  uint16_t bitsPerSample;
+  char subchunk2ID[4];
+  uint32_t subchunk2Size;
+} wav_header_t;
+
+// IMA-ADPCM needs the extended fmt chunk and a fact chunk with the sample count
+typedef struct {
+  char chunkID[4];
+  uint32_t chunkSize;
+  char format[4];
+  char subchunk1ID[4];
+  uint32_t subchunk1Size;
+  uint16_t audioFormat;
+  uint16_t numChannels;
+  uint32_t sampleRate;
+  uint32_t byteRate;
+  uint16_t blockAlign;
+  uint16_t bitsPerSample;
+  uint16_t extraSize;
+  uint16_t samplesPerBlock;
+  char factID[4];
+  uint32_t factSize;
+  uint32_t sampleLength;
+  char subchunk2ID[4];
+  uint32_t subchunk2Size;
+} wav_adpcm_header_t;
+
+// Everything but the two sizes is fixed by the format, so headers for a known
+// format and length fold to constants
+template <typename Format>
+constexpr wav_header_t makeWAVHeader(uint32_t dataSize) {
+  return {
+    {'R', 'I', 'F', 'F'}, 36 + dataSize, {'W', 'A', 'V', 'E'},
+    {'f', 'm', 't', ' '}, 16, 1, Format::channels, Format::sampleRate,
+    Format::byteRate, Format::frameBytes, Format::bitsPerSample,
+    {'d', 'a', 't', 'a'}, dataSize
+  };
+}
+
+template <typename Format>
+constexpr wav_adpcm_header_t makeADPCMWAVHeader(uint32_t dataSize, uint32_t sampleFrames) {
+  static_assert(Format::channels == 1, "The ADPCM encoder is mono");
+  return {
+    {'R', 'I', 'F', 'F'}, (uint32_t)(sizeof(wav_adpcm_header_t) - 8 + dataSize), {'W', 'A', 'V', 'E'},
+    {'f', 'm', 't', ' '}, 20, 0x11, Format::channels, Format::sampleRate,
+    (uint32_t)((uint64_t)Format::sampleRate * ADPCM_BLOCK_ALIGN / ADPCM_SAMPLES_PER_BLOCK),
+    ADPCM_BLOCK_ALIGN, 4, 2, ADPCM_SAMPLES_PER_BLOCK,
+    {'f', 'a', 'c', 't'}, 4, sampleFrames,
+    {'d', 'a', 't', 'a'}, dataSize
+  };
+}
+
+wav_header_t createWAVHeader(uint32_t dataSize);
+wav_adpcm_header_t createADPCMWAVHeader(uint32_t dataSize, uint32_t sampleFrames);
+size_t fillWAVHeader(uint8_t* buffer, uint32_t dataSize, uint32_t sampleFrames, uint32_t trailingBytes);
+
+// RIFF pad byte (after odd-length data) plus an 8-byte chunk header
+#define WAV_TRAILING_CHUNK_HEADER_MAX 9
+size_t fillTrailingChunkHeader(uint8_t* buffer, const char id[4], uint32_t dataSize, uint32_t payloadSize);
+
+#endif // WAV_HEADER_H
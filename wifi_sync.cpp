@@ -1,46 +1,254 @@
 #include "wifi_sync.h"
 #include "sd_manager.h"
+#include "upload_queue.h"
+#include "upload_streamer.h"
+#include "audio_encoder.h"
+#include "metrics.h"
+#include "scratch_arena.h"
+#include "recording_name.h"
 #include "config.h"
+#include <WiFiClientSecure.h>
+#include <Preferences.h>
+#include <mbedtls/base64.h>
+#include <atomic>
+#include <ctype.h>
+#include <string.h>
+#include <freertos/FreeRTOS.h>
+#include <freertos/task.h>
+#include <freertos/event_groups.h>
+
+#define TUS_VERSION "1.0.0"
+#define BATCH_BOUNDARY "----echolog-batch-7d3f1a"
+#define MAX_BATCH_FILES 10
+#define MAX_UPLOAD_FILES 10
 
 static bool wifiConnected = false;
 static unsigned long lastUploadAttempt = 0;
 static int uploadRetryCount = 0;
-static String currentUploadFile = "";
+static char deviceId[13] = "";
+static char responseBody[UPLOAD_RESPONSE_MAX_BYTES];
 
-bool connectToWiFi() {
-  if (wifiConnected) {
-    return true;
+// One client and one HTTPClient for the life of the WiFi connection. With
+// reuse on, http.end() leaves a keep-alive socket open and the next begin()
+// picks it up, so a batch pays for a single TLS handshake.
+static WiFiClientSecure secureClient;
+static WiFiClient plainClient;
+static HTTPClient http;
+static bool uploadSessionReady = false;
+
+static TaskHandle_t uploadTaskHandle = NULL;
+static std::atomic<bool> uploadsEnabled(false);
+static std::atomic<bool> uploadActive(false);
+
+static WiFiClient& uploadClient() {
+  if (strncmp(API_ENDPOINT, "https", 5) == 0) {
+    return secureClient;
+  }
+  return plainClient;
+}
+
+static void beginUploadSession() {
+  if (uploadSessionReady) {
+    return;
   }
   
-  DEBUG_PRINTF("Connecting to WiFi: %s\n", WIFI_SSID);
+#ifdef API_CA_CERT
+  secureClient.setCACert(API_CA_CERT);
+#else
+  secureClient.setInsecure();
+#endif
+  
+  http.setReuse(true);
+  http.setTimeout(API_TIMEOUT_MS);
+  
+  uint8_t mac[6];
+  WiFi.macAddress(mac);
+  snprintf(deviceId, sizeof(deviceId), "%02X%02X%02X%02X%02X%02X",
+           mac[0], mac[1], mac[2], mac[3], mac[4], mac[5]);
+  
+  if (!initializeUploadStreamer()) {
+    DEBUG_PRINTLN("Upload streamer unavailable, sending straight from the file");
+  }
+  
+  uploadSessionReady = true;
+}
+
+static void closeUploadSession() {
+  if (!uploadSessionReady) {
+    return;
+  }
+  
+  http.setReuse(false);
+  http.end();
+  uploadClient().stop();
+  uploadSessionReady = false;
+}
+
+// Last good association, kept in RTC memory across sleep and in NVS across
+// power loss. The SSID hash drops it when the configured network changes.
+typedef struct {
+  uint32_t magic;
+  uint32_t ssidHash;
+  uint8_t bssid[6];
+  uint8_t channel;
+  uint32_t ip;
+  uint32_t gateway;
+  uint32_t subnet;
+  uint32_t dns;
+} wifi_cache_t;
+
+#define WIFI_CACHE_MAGIC 0x57464331
+#define WIFI_GOT_IP_BIT BIT0
+#define WIFI_DISCONNECTED_BIT BIT1
+
+static RTC_DATA_ATTR wifi_cache_t wifiCache;
+static EventGroupHandle_t wifiEvents = NULL;
+
+static uint32_t hashSSID(const char* ssid) {
+  uint32_t hash = 2166136261u;
+  while (*ssid) {
+    hash = (hash ^ (uint8_t)*ssid++) * 16777619u;
+  }
+  return hash;
+}
+
+static void onWiFiEvent(WiFiEvent_t event, WiFiEventInfo_t info) {
+  if (event == ARDUINO_EVENT_WIFI_STA_GOT_IP) {
+    xEventGroupSetBits(wifiEvents, WIFI_GOT_IP_BIT);
+  } else if (event == ARDUINO_EVENT_WIFI_STA_DISCONNECTED) {
+    xEventGroupSetBits(wifiEvents, WIFI_DISCONNECTED_BIT);
+  }
+}
+
+static bool loadWiFiCache() {
+  if (wifiCache.magic != WIFI_CACHE_MAGIC) {
+    Preferences prefs;
+    if (prefs.begin("wifi", true)) {
+      if (prefs.getBytes("cache", &wifiCache, sizeof(wifiCache)) != sizeof(wifiCache)) {
+        wifiCache.magic = 0;
+      }
+      prefs.end();
+    }
+  }
+  return wifiCache.magic == WIFI_CACHE_MAGIC && wifiCache.ssidHash == hashSSID(WIFI_SSID);
+}
+
+// NVS is only written when the association actually changed
+static void saveWiFiCache() {
+  wifi_cache_t cache;
+  memset(&cache, 0, sizeof(cache));
+  cache.magic = WIFI_CACHE_MAGIC;
+  cache.ssidHash = hashSSID(WIFI_SSID);
+  memcpy(cache.bssid, WiFi.BSSID(), sizeof(cache.bssid));
+  cache.channel = (uint8_t)WiFi.channel();
+  cache.ip = (uint32_t)WiFi.localIP();
+  cache.gateway = (uint32_t)WiFi.gatewayIP();
+  cache.subnet = (uint32_t)WiFi.subnetMask();
+  cache.dns = (uint32_t)WiFi.dnsIP();
+  
+  if (memcmp(&cache, &wifiCache, sizeof(cache)) == 0) {
+    return;
+  }
   
-  // ESP32S3 specific WiFi initialization
+  wifiCache = cache;
+  Preferences prefs;
+  if (prefs.begin("wifi", false)) {
+    prefs.putBytes("cache", &wifiCache, sizeof(wifiCache));
+    prefs.end();
+  }
+}
+
+// Waits on the event group rather than polling the status
+static bool waitForConnection(uint32_t timeoutMs) {
+  EventBits_t bits = xEventGroupWaitBits(wifiEvents, WIFI_GOT_IP_BIT | WIFI_DISCONNECTED_BIT,
+                                         pdTRUE, pdFALSE, pdMS_TO_TICKS(timeoutMs));
+  return (bits & WIFI_GOT_IP_BIT) && WiFi.status() == WL_CONNECTED;
+}
+
+// Straight to the cached AP and channel: no scan, and no DHCP round trip
+// when the last lease is reused
+static bool fastConnect() {
   WiFi.mode(WIFI_STA);
-  WiFi.disconnect();
-  delay(100);
+  if (WIFI_FAST_CONNECT_STATIC_IP && wifiCache.ip != 0) {
+    WiFi.config(IPAddress(wifiCache.ip), IPAddress(wifiCache.gateway),
+                IPAddress(wifiCache.subnet), IPAddress(wifiCache.dns));
+  }
   
+  xEventGroupClearBits(wifiEvents, WIFI_GOT_IP_BIT | WIFI_DISCONNECTED_BIT);
+  WiFi.begin(WIFI_SSID, WIFI_PASSWORD, wifiCache.channel, wifiCache.bssid, true);
+  return waitForConnection(WIFI_FAST_CONNECT_TIMEOUT_MS);
+}
+
+// A failed attempt can leave the driver stuck (scan error -2), so start from
+// a full reset; see KEY_FINDINGS.md, test 8/9
+static bool fullConnect() {
+  WiFi.disconnect(true);
+  WiFi.mode(WIFI_OFF);
+  delay(100);
   WiFi.mode(WIFI_STA);
+  if (WIFI_FAST_CONNECT_STATIC_IP) {
+    WiFi.config(INADDR_NONE, INADDR_NONE, INADDR_NONE);
+  }
+  
+  xEventGroupClearBits(wifiEvents, WIFI_GOT_IP_BIT | WIFI_DISCONNECTED_BIT);
   WiFi.begin(WIFI_SSID, WIFI_PASSWORD);
   
+  // The first disconnect events of a scan are retries, not failure
   unsigned long startTime = millis();
-  while (WiFi.status() != WL_CONNECTED && millis() - startTime < WIFI_TIMEOUT_MS) {
-    delay(500);
-    DEBUG_PRINT(".");
+  for (;;) {
+    uint32_t elapsed = millis() - startTime;
+    if (elapsed >= WIFI_TIMEOUT_MS) {
+      return WiFi.status() == WL_CONNECTED;
+    }
+    if (waitForConnection(WIFI_TIMEOUT_MS - elapsed)) {
+      return true;
+    }
   }
-  DEBUG_PRINTLN();
-  
-  if (WiFi.status() == WL_CONNECTED) {
-    wifiConnected = true;
-    DEBUG_PRINTF("WiFi connected! IP: %s\n", WiFi.localIP().toString().c_str());
-    DEBUG_PRINTF("Signal strength: %d dBm\n", WiFi.RSSI());
+}
+
+bool connectToWiFi() {
+  if (wifiConnected) {
     return true;
-  } else {
+  }
+  
+  if (!wifiEvents) {
+    wifiEvents = xEventGroupCreate();
+    if (!wifiEvents) {
+      return false;
+    }
+    WiFi.persistent(false);
+    WiFi.onEvent(onWiFiEvent);
+  }
+  
+  DEBUG_PRINTF("Connecting to WiFi: %s\n", WIFI_SSID);
+  unsigned long startTime = millis();
+  
+  bool fast = WIFI_FAST_CONNECT && loadWiFiCache();
+  bool connected = fast && fastConnect();
+  if (fast && !connected) {
+    DEBUG_PRINTLN("Fast connect failed, scanning");
+  }
+  if (!connected) {
+    fast = false;
+    connected = fullConnect();
+  }
+  
+  if (!connected) {
     DEBUG_PRINTLN("WiFi connection failed");
     return false;
   }
+  
+  wifiConnected = true;
+  saveWiFiCache();
+  DEBUG_PRINTF("WiFi connected in %lu ms (%s)! IP: %s\n", millis() - startTime,
+               fast ? "cached AP" : "scan", WiFi.localIP().toString().c_str());
+  DEBUG_PRINTF("Signal strength: %d dBm\n", WiFi.RSSI());
+  return true;
 }
 
 void disconnectWiFi() {
+  closeUploadSession();
+  
   if (wifiConnected) {
     WiFi.disconnect();
     wifiConnected = false;
@@ -54,6 +262,7 @@ bool isWiFiConnected() {
     wifiConnected = connected;
     if (!connected) {
       DEBUG_PRINTLN("WiFi connection lost");
+      closeUploadSession();
     }
   }
   return connected;
@@ -72,6 +281,76 @@ bool shouldStartUpload() {
   return fileCount > 0;
 }
 
+// Leading files whose combined size fits one batch request; sizes come
+// from the journal, so nothing is opened to decide
+static int countBatchableFiles(const uint32_t* sizes, int count) {
+  uint32_t total = 0;
+  int batchable = 0;
+  
+  while (batchable < count && batchable < MAX_BATCH_FILES) {
+    if (total + sizes[batchable] > UPLOAD_BATCH_MAX_BYTES) {
+      break;
+    }
+    total += sizes[batchable];
+    batchable++;
+  }
+  
+  return MAX(batchable, 1);
+}
+
+static bool getContentHashText(const char* filename, char text[UPLOAD_HASH_LENGTH * 2 + 1], bool* attempted) {
+  uint8_t hash[UPLOAD_HASH_LENGTH];
+  bool known = UPLOAD_DEDUP_ENABLED && getQueuedContentHash(filename, hash, attempted);
+  if (known) {
+    formatContentHash(hash, text);
+  }
+  return known;
+}
+
+// 200 means the server already holds this content, 404 that it doesn't;
+// anything else is treated as unknown and the file is sent
+static bool isStoredOnServer(const char* hashText) {
+  if (!http.begin(uploadClient(), UPLOAD_EXISTS_ENDPOINT)) {
+    return false;
+  }
+  http.addHeader("X-Device-ID", deviceId);
+  http.addHeader("X-Audio-SHA256", hashText);
+  
+  int httpCode = http.sendRequest("HEAD");
+  http.end();
+  if (httpCode < 0) {
+    uploadClient().stop();
+  }
+  return httpCode == 200;
+}
+
+// Files whose last send started but never got an answer may already be
+// stored; one HEAD each settles it before paying for the transfer again.
+// Stored files are marked uploaded and dropped from the list.
+static int skipStoredUploads(upload_path_t* files, uint32_t* sizes, int* count) {
+  int kept = 0;
+  int skipped = 0;
+  
+  for (int i = 0; i < *count; i++) {
+    char hashText[UPLOAD_HASH_LENGTH * 2 + 1];
+    bool attempted = false;
+    if (getContentHashText(files[i], hashText, &attempted) && attempted && isStoredOnServer(hashText)) {
+      DEBUG_PRINTF("Already on server, skipped: %s\n", files[i]);
+      markFileAsUploaded(files[i]);
+      skipped++;
+      continue;
+    }
+    if (kept != i) {
+      memcpy(files[kept], files[i], sizeof(upload_path_t));
+      sizes[kept] = sizes[i];
+    }
+    kept++;
+  }
+  
+  *count = kept;
+  return skipped;
+}
+
 bool performUpload() {
   if (!isWiFiConnected()) {
     if (!connectToWiFi()) {
@@ -79,37 +358,83 @@ bool performUpload() {
     }
   }
   
-  String files[10];
-  if (!getUnuploadedFiles(files, 10)) {
+  // Everything a batch needs beyond the stack comes from the scratch arena
+  scratchReset();
+  upload_path_t* files = (upload_path_t*)scratchAlloc(sizeof(upload_path_t) * MAX_UPLOAD_FILES);
+  uint32_t* sizes = (uint32_t*)scratchAlloc(sizeof(uint32_t) * MAX_UPLOAD_FILES);
+  if (!files || !sizes) {
+    DEBUG_PRINTLN("Upload scratch arena unavailable");
+    return false;
+  }
+  
+  int fileCount = getUnuploadedFiles(files, sizes, MAX_UPLOAD_FILES);
+  if (fileCount == 0) {
     DEBUG_PRINTLN("No files to upload");
     return true;
   }
   
+  beginUploadSession();
+  unsigned long batchStart = millis();
+  int uploaded = skipStoredUploads(files, sizes, &fileCount);
+  
   bool allUploaded = true;
-  for (int i = 0; i < 10 && files[i].length() > 0; i++) {
-    DEBUG_PRINTF("Uploading file %d: %s\n", i + 1, files[i].c_str());
+  bool retriesLeft = true;
+  int i = 0;
+  while (i < fileCount && retriesLeft) {
+    if (!uploadsEnabled.load()) {
+      DEBUG_PRINTLN("Uploads disabled, stopping batch");
+      allUploaded = false;
+      break;
+    }
     
-    if (uploadFile(files[i])) {
-      if (markFileAsUploaded(files[i])) {
-        DEBUG_PRINTF("Successfully uploaded: %s\n", files[i].c_str());
-      } else {
-        DEBUG_PRINTF("Upload succeeded but failed to mark as uploaded: %s\n", files[i].c_str());
-      }
+    int batchCount = UPLOAD_BATCH_ENABLED ? countBatchableFiles(sizes + i, fileCount - i) : 1;
+    bool accepted[MAX_BATCH_FILES];
+    
+    for (int j = 0; j < batchCount; j++) {
+      markQueuedUploadAttempt(files[i + j]);
+    }
+    
+    if (batchCount > 1) {
+      DEBUG_PRINTF("Uploading files %d-%d as one batch\n", i + 1, i + batchCount);
+      uploadFileBatch(files + i, batchCount, accepted);
     } else {
-      DEBUG_PRINTF("Failed to upload: %s\n", files[i].c_str());
-      allUploaded = false;
+      DEBUG_PRINTF("Uploading file %d: %s\n", i + 1, files[i]);
+      accepted[0] = UPLOAD_MODE == UPLOAD_MODE_RESUMABLE ? uploadFileResumable(files[i]) : uploadFile(files[i]);
+    }
+    
+    bool requestFailed = false;
+    for (int j = 0; j < batchCount; j++) {
+      const char* file = files[i + j];
       
+      if (accepted[j]) {
+        uploaded++;
+        if (markFileAsUploaded(file)) {
+          DEBUG_PRINTF("Successfully uploaded: %s\n", file);
+        } else {
+          DEBUG_PRINTF("Upload succeeded but failed to mark as uploaded: %s\n", file);
+        }
+      } else {
+        DEBUG_PRINTF("Failed to upload: %s\n", file);
+        allUploaded = false;
+        requestFailed = true;
+      }
+    }
+    
+    // A rejected batch counts as one failed attempt, not one per item
+    if (requestFailed) {
       uploadRetryCount++;
+      incrementMetricCounter(METRIC_UPLOAD_RETRIES);
       if (uploadRetryCount >= MAX_UPLOAD_RETRIES) {
         DEBUG_PRINTLN("Max upload retries reached, giving up");
-        break;
+        retriesLeft = false;
       }
     }
     
-    delay(1000);
+    i += batchCount;
   }
   
   lastUploadAttempt = millis();
+  DEBUG_PRINTF("Upload batch: %d files in %lu ms\n", uploaded, millis() - batchStart);
   
   if (allUploaded) {
     resetUploadRetryCount();
@@ -118,55 +443,698 @@ bool performUpload() {
   return allUploaded;
 }
 
-bool uploadFile(const String& filename) {
-  if (!SD.exists(filename)) {
-    DEBUG_PRINTF("File does not exist: %s\n", filename.c_str());
+// Compact metrics summary so the server sees device health with every upload
+static void addTelemetryHeader() {
+  if (!METRICS_TELEMETRY_ENABLED) {
+    return;
+  }
+  
+  char summary[METRICS_SUMMARY_LENGTH];
+  if (formatMetricsSummary(summary, sizeof(summary)) > 0) {
+    http.addHeader("X-Telemetry", summary);
+  }
+}
+
+// Sends length bytes of file starting at offset, through the read-ahead
+// streamer when it is available
+static int sendFileRange(const char* method, File& file, uint32_t offset, size_t length) {
+  Stream* body = beginUploadStream(&file, offset, length);
+  if (!body) {
+    if (!file.seek(offset)) {
+      return HTTPC_ERROR_SEND_PAYLOAD_FAILED;
+    }
+    return http.sendRequest(method, &file, length);
+  }
+  
+  int httpCode = http.sendRequest(method, body, length);
+  endUploadStream();
+  
+  upload_stream_stats_t stats;
+  getUploadStreamStats(&stats);
+  DEBUG_PRINTF("Upload stream: %lu bytes in %lu ms (%lu KB/s), SD read %lu ms, stalls %lu\n",
+               stats.bytes, stats.elapsedMs, stats.kbytesPerSecond, stats.readUs / 1000, stats.sendStalls);
+  if (httpCode > 0) {
+    recordMetric(METRIC_UPLOAD_THROUGHPUT, stats.kbytesPerSecond);
+  }
+  return httpCode;
+}
+
+static const char* basenameOf(const char* path) {
+  const char* slash = strrchr(path, '/');
+  return slash ? slash + 1 : path;
+}
+
+// Segment names carry the session and sequence the server stitches by
+static void addSegmentHeaders(const char* filename) {
+  uint32_t session;
+  uint32_t segment;
+  if (!parseSegmentName(filename, &session, &segment)) {
+    return;
+  }
+  
+  char number[12];
+  snprintf(number, sizeof(number), "%08lX", (unsigned long)session);
+  http.addHeader("X-Session-ID", number);
+  snprintf(number, sizeof(number), "%lu", (unsigned long)segment);
+  http.addHeader("X-Segment", number);
+}
+
+// Lets the server dedupe by content rather than by name
+static void addContentHashHeader(const char* filename) {
+  char hashText[UPLOAD_HASH_LENGTH * 2 + 1];
+  bool attempted;
+  if (getContentHashText(filename, hashText, &attempted)) {
+    http.addHeader("X-Audio-SHA256", hashText);
+  }
+}
+
+// The journaled size, capped at the file: a pool file whose truncate failed
+// keeps its preallocated length past the recording
+static size_t uploadSizeOf(const char* filename, File& file) {
+  uint32_t recorded;
+  if (getQueuedFileSize(filename, &recorded) && recorded <= file.size()) {
+    return recorded;
+  }
+  return file.size();
+}
+
+// Fixed-capacity sink for http.writeToStream(): keeps the first
+// capacity - 1 bytes and accepts the rest unseen, so the whole body is
+// consumed without growing a String to its size
+class BoundedBodySink : public Stream {
+public:
+  BoundedBodySink(char* buffer, size_t capacity) : buffer(buffer), capacity(capacity), kept(0) {
+    buffer[0] = '\0';
+  }
+  
+  size_t write(uint8_t c) override {
+    return write(&c, 1);
+  }
+  
+  size_t write(const uint8_t* data, size_t size) override {
+    size_t keep = MIN(size, capacity - 1 - kept);
+    memcpy(buffer + kept, data, keep);
+    kept += keep;
+    buffer[kept] = '\0';
+    return size;
+  }
+  
+  int available() override {
+    return 0;
+  }
+  
+  int read() override {
+    return -1;
+  }
+  
+  int peek() override {
+    return -1;
+  }
+  
+  size_t length() const {
+    return kept;
+  }
+  
+private:
+  char* buffer;
+  size_t capacity;
+  size_t kept;
+};
+
+// Stands in for http.getString(). writeToStream() decodes chunked framing
+// and waits up to the client timeout (API_TIMEOUT_MS) for the closing
+// chunk, so a complete reply leaves the keep-alive connection reusable.
+// Replies that carry no body are not read at all.
+static size_t readResponseBody(int httpCode, char* buffer, size_t capacity) {
+  BoundedBodySink sink(buffer, capacity);
+  if (httpCode < 200 || httpCode == 204 || httpCode == 304) {
+    return 0;
+  }
+  
+  if (http.writeToStream(&sink) < 0) {
+    uploadClient().stop();
+  }
+  return sink.length();
+}
+
+bool uploadFile(const char* filename) {
+  fs::FS& fs = getStorage();
+  
+  if (!fs.exists(filename)) {
+    DEBUG_PRINTF("File does not exist: %s\n", filename);
     return false;
   }
   
-  File file = SD.open(filename, FILE_READ);
+  File file = fs.open(filename, FILE_READ);
   if (!file) {
-    DEBUG_PRINTF("Failed to open file: %s\n", filename.c_str());
+    DEBUG_PRINTF("Failed to open file: %s\n", filename);
+    reportStorageError();
     return false;
   }
   
-  size_t fileSize = file.size();
+  size_t fileSize = uploadSizeOf(filename, file);
   DEBUG_PRINTF("File size: %zu bytes\n", fileSize);
   
-  HTTPClient http;
-  http.begin(API_ENDPOINT);
-  http.addHeader("Content-Type", "audio/wav");
-  http.addHeader("Content-Length", String(fileSize));
+  beginUploadSession();
+  if (!http.begin(uploadClient(), API_ENDPOINT)) {
+    DEBUG_PRINTLN("Failed to start HTTP request");
+    file.close();
+    return false;
+  }
   
-  String deviceId = WiFi.macAddress();
-  deviceId.replace(":", "");
+  char number[12];
+  http.addHeader("Content-Type", encoderContentType(AUDIO_CODEC));
+  snprintf(number, sizeof(number), "%u", (unsigned)fileSize);
+  http.addHeader("Content-Length", number);
   http.addHeader("X-Device-ID", deviceId);
+  snprintf(number, sizeof(number), "%lu", millis());
+  http.addHeader("X-Timestamp", number);
+  http.addHeader("X-Filename", basenameOf(filename));
+  addSegmentHeaders(filename);
+  addContentHashHeader(filename);
+  addTelemetryHeader();
   
-  String timestamp = String(millis());
-  http.addHeader("X-Timestamp", timestamp);
+  int httpCode = sendFileRange("POST", file, 0, fileSize);
   
-  String basename = filename.substring(filename.lastIndexOf('/') + 1);
-  http.addHeader("X-Filename", basename);
+  file.close();
   
-  http.setTimeout(API_TIMEOUT_MS);
+  // Reading the whole body keeps the connection in a reusable state
+  readResponseBody(httpCode, responseBody, sizeof(responseBody));
+  http.end();
+  
+  if (httpCode < 0) {
+    // Transport error: start the next request on a fresh connection
+    uploadClient().stop();
+  }
+  
+  handleUploadResponse(httpCode, responseBody);
+  
+  return (httpCode >= 200 && httpCode < 300);
+}
+
+static void addUploadHeaders(const char* filename) {
+  http.addHeader("X-Device-ID", deviceId);
+  http.addHeader("X-Filename", basenameOf(filename));
+  addSegmentHeaders(filename);
+  addContentHashHeader(filename);
+  addTelemetryHeader();
+}
+
+// Location may come back relative to the endpoint's host
+static bool resolveUploadUrl(const char* location, char url[UPLOAD_URL_LENGTH]) {
+  int written;
+  
+  url[0] = '\0';
+  if (location[0] == '\0') {
+    return false;
+  }
+  
+  if (strncmp(location, "http", 4) == 0) {
+    written = snprintf(url, UPLOAD_URL_LENGTH, "%s", location);
+  } else {
+    const char* endpoint = API_ENDPOINT;
+    const char* host = strstr(endpoint, "//");
+    const char* hostEnd = strchr(host ? host + 2 : endpoint, '/');
+    int originLength = hostEnd ? (int)(hostEnd - endpoint) : (int)strlen(endpoint);
+    written = snprintf(url, UPLOAD_URL_LENGTH, "%.*s%s%s", originLength, endpoint,
+                       location[0] == '/' ? "" : "/", location);
+  }
+  
+  if (written < 0 || written >= UPLOAD_URL_LENGTH) {
+    DEBUG_PRINTF("Upload URL too long: %s\n", location);
+    return false;
+  }
+  return true;
+}
+
+static bool beginTusRequest(const char* url) {
+  if (!http.begin(uploadClient(), url)) {
+    DEBUG_PRINTLN("Failed to start HTTP request");
+    return false;
+  }
+  
+  static const char* responseHeaders[] = { "Location", "Upload-Offset" };
+  http.collectHeaders(responseHeaders, 2);
+  http.addHeader("Tus-Resumable", TUS_VERSION);
+  return true;
+}
+
+// Appends base64 of text to out; false if it does not fit
+static bool appendBase64(char* out, size_t capacity, size_t* used, const char* text) {
+  size_t written = 0;
+  int err = mbedtls_base64_encode((unsigned char*)out + *used, capacity - *used, &written,
+                                  (const unsigned char*)text, strlen(text));
+  *used += written;
+  return err == 0;
+}
+
+static bool createTusUpload(const char* filename, size_t fileSize, char url[UPLOAD_URL_LENGTH]) {
+  char metadata[192];
+  size_t used = snprintf(metadata, sizeof(metadata), "filename ");
+  bool fits = appendBase64(metadata, sizeof(metadata), &used, basenameOf(filename));
+  used += snprintf(metadata + used, sizeof(metadata) - used, ",filetype ");
+  fits = fits && used < sizeof(metadata) &&
+         appendBase64(metadata, sizeof(metadata), &used, encoderContentType(AUDIO_CODEC));
+  if (!fits) {
+    DEBUG_PRINTF("Upload metadata too long: %s\n", filename);
+    return false;
+  }
+  
+  if (!beginTusRequest(API_ENDPOINT)) {
+    return false;
+  }
+  
+  char length[12];
+  snprintf(length, sizeof(length), "%u", (unsigned)fileSize);
+  http.addHeader("Upload-Length", length);
+  http.addHeader("Upload-Metadata", metadata);
+  addUploadHeaders(filename);
+  
+  int httpCode = http.sendRequest("POST", (uint8_t*)NULL, 0);
+  bool created = httpCode == 201 && resolveUploadUrl(http.header("Location").c_str(), url);
+  http.end();
+  
+  if (!created) {
+    handleUploadResponse(httpCode, "");
+    return false;
+  }
+  
+  return true;
+}
+
+// Returns the server's offset, or -1 if the upload resource is gone
+static int64_t queryTusOffset(const char* url) {
+  if (!beginTusRequest(url)) {
+    return -1;
+  }
+  
+  int httpCode = http.sendRequest("HEAD");
+  int64_t offset = http.hasHeader("Upload-Offset") ? http.header("Upload-Offset").toInt() : -1;
+  http.end();
+  
+  if (httpCode != 200 || offset < 0) {
+    DEBUG_PRINTF("Upload offset query failed - Code: %d\n", httpCode);
+    return -1;
+  }
+  
+  return offset;
+}
+
+// tus-style upload: the server resource is created once, then fixed-size
+// PATCH chunks are acknowledged one by one. The acknowledged offset is kept
+// in the upload queue so a dropped link or a reboot resumes mid-file.
+bool uploadFileResumable(const char* filename) {
+  fs::FS& fs = getStorage();
+  
+  File file = fs.open(filename, FILE_READ);
+  if (!file) {
+    DEBUG_PRINTF("Failed to open file: %s\n", filename);
+    reportStorageError();
+    return false;
+  }
+  
+  size_t fileSize = uploadSizeOf(filename, file);
+  beginUploadSession();
+  
+  uint32_t offset = 0;
+  char uploadUrl[UPLOAD_URL_LENGTH];
+  getQueuedUploadState(filename, &offset, uploadUrl);
+  
+  if (uploadUrl[0] != '\0') {
+    int64_t serverOffset = queryTusOffset(uploadUrl);
+    if (serverOffset < 0 || serverOffset > (int64_t)fileSize) {
+      uploadUrl[0] = '\0';
+    } else {
+      offset = (uint32_t)serverOffset;
+    }
+  }
+  
+  if (uploadUrl[0] == '\0') {
+    if (!createTusUpload(filename, fileSize, uploadUrl)) {
+      file.close();
+      return false;
+    }
+    offset = 0;
+    setQueuedUploadState(filename, offset, uploadUrl);
+  }
   
-  int httpCode = http.sendRequest("POST", &file, fileSize);
+  if (offset > 0) {
+    DEBUG_PRINTF("Resuming %s at %lu of %zu bytes\n", filename, offset, fileSize);
+  }
+  
+  while (offset < fileSize) {
+    size_t chunk = MIN((size_t)UPLOAD_CHUNK_SIZE, fileSize - offset);
+    
+    if (!beginTusRequest(uploadUrl)) {
+      file.close();
+      return false;
+    }
+    
+    char offsetHeader[12];
+    snprintf(offsetHeader, sizeof(offsetHeader), "%lu", offset);
+    http.addHeader("Content-Type", "application/offset+octet-stream");
+    http.addHeader("Upload-Offset", offsetHeader);
+    
+    int httpCode = sendFileRange("PATCH", file, offset, chunk);
+    int64_t acknowledged = http.hasHeader("Upload-Offset") ? http.header("Upload-Offset").toInt() : -1;
+    http.end();
+    
+    if (httpCode != 204 || acknowledged < 0) {
+      handleUploadResponse(httpCode, "");
+      if (httpCode < 0) {
+        uploadClient().stop();
+      }
+      file.close();
+      return false;
+    }
+    
+    uint32_t newOffset = (uint32_t)acknowledged;
+    if (newOffset <= offset) {
+      DEBUG_PRINTF("Server did not advance the upload offset (%lu)\n", newOffset);
+      file.close();
+      return false;
+    }
+    
+    offset = newOffset;
+    setQueuedUploadState(filename, offset, uploadUrl);
+  }
   
   file.close();
+  DEBUG_PRINTF("Resumable upload complete: %s\n", filename);
+  return true;
+}
+
+// multipart/form-data body over several files, produced on the fly so
+// nothing larger than HTTPClient's send buffer is held in RAM. The part
+// preambles live in the scratch arena for the length of the batch. File
+// data goes through the read-ahead streamer one part at a time, so batches
+// get the same SD rate limit as single uploads.
+#define BATCH_CLOSING "--" BATCH_BOUNDARY "--\r\n"
+
+class MultipartStream : public Stream {
+public:
+  bool begin(const upload_path_t* paths, int count) {
+    fs::FS& fs = getStorage();
+    partCount = 0;
+    totalLength = 0;
+    
+    for (int i = 0; i < count; i++) {
+      parts[i] = fs.open(paths[i], FILE_READ);
+      if (!parts[i]) {
+        close();
+        return false;
+      }
+      partCount++;
+      partSizes[i] = uploadSizeOf(paths[i], parts[i]);
+      
+      if (!formatPreamble(i, paths[i])) {
+        DEBUG_PRINTLN("Upload scratch arena full");
+        close();
+        return false;
+      }
+      totalLength += preambleLengths[i] + partSizes[i] + 2;
+    }
+    
+    totalLength += strlen(BATCH_CLOSING);
+    
+    part = 0;
+    section = 0;
+    position = 0;
+    produced = 0;
+    return true;
+  }
+  
+  void close() {
+    endPartData();
+    for (int i = 0; i < partCount; i++) {
+      parts[i].close();
+    }
+    partCount = 0;
+  }
+  
+  size_t length() const {
+    return totalLength;
+  }
+  
+  // -1 aborts the request when the part reader hit an SD error
+  int available() override {
+    if (partData && partData->available() < 0) {
+      return -1;
+    }
+    return (int)(totalLength - produced);
+  }
+  
+  int read() override {
+    char c;
+    return readBytes(&c, 1) == 1 ? (uint8_t)c : -1;
+  }
+  
+  int peek() override {
+    return -1;
+  }
+  
+  // Walks preamble -> file data -> CRLF for each part, then the closing boundary
+  size_t readBytes(char* out, size_t count) override {
+    size_t copied = 0;
+    
+    while (copied < count && part <= partCount) {
+      if (part == partCount) {
+        copied += copyString(BATCH_CLOSING, strlen(BATCH_CLOSING), out + copied, count - copied);
+        if (position >= strlen(BATCH_CLOSING)) {
+          part++;
+        }
+        continue;
+      }
+      
+      if (section == 0) {
+        copied += copyString(preambles[part], preambleLengths[part], out + copied, count - copied);
+        if (position >= preambleLengths[part]) {
+          section = 1;
+          position = 0;
+        }
+      } else if (section == 1) {
+        size_t remaining = partSizes[part] - partSent;
+        if (remaining == 0) {
+          endPartData();
+          section = 2;
+          position = 0;
+          continue;
+        }
+        
+        if (!partData) {
+          beginPartData();
+        }
+        
+        // Nothing yet means the reader is behind (or failed, which
+        // available() reports); hand back what we have
+        size_t got = partData->readBytes(out + copied, MIN(count - copied, remaining));
+        if (got == 0) {
+          break;
+        }
+        partSent += got;
+        copied += got;
+      } else {
+        copied += copyString("\r\n", 2, out + copied, count - copied);
+        if (position >= 2) {
+          part++;
+          section = 0;
+          position = 0;
+        }
+      }
+    }
+    
+    produced += copied;
+    return copied;
+  }
+  
+  size_t write(uint8_t) override {
+    return 0;
+  }
+  
+  void flush() override {
+  }
+  
+private:
+  // Falls back to reading the File directly if the streamer is busy or absent
+  void beginPartData() {
+    partData = beginUploadStream(&parts[part], 0, partSizes[part]);
+    partStreamed = partData != NULL;
+    if (!partData) {
+      parts[part].seek(0);
+      partData = &parts[part];
+    }
+  }
+  
+  void endPartData() {
+    if (partStreamed) {
+      endUploadStream();
+    }
+    partData = NULL;
+    partStreamed = false;
+    partSent = 0;
+  }
+  
+  // X-Recorded-At is the file's last write (its close) in Unix seconds,
+  // per part, since the request's X-Timestamp only says when it was sent
+  bool formatPreamble(int index, const char* path) {
+    static const char format[] =
+      "--" BATCH_BOUNDARY "\r\n"
+      "Content-Disposition: form-data; name=\"file\"; filename=\"%s\"\r\n"
+      "Content-Type: %s\r\n"
+      "X-Recorded-At: %lu\r\n%s%s%s\r\n";
+    const char* basename = basenameOf(path);
+    const char* contentType = encoderContentType(AUDIO_CODEC);
+    unsigned long recordedAt = (unsigned long)parts[index].getLastWrite();
+    
+    // The part carries the same content hash header a single upload would
+    char hashText[UPLOAD_HASH_LENGTH * 2 + 1];
+    bool attempted;
+    bool hashed = getContentHashText(path, hashText, &attempted);
+    const char* hashName = hashed ? "X-Audio-SHA256: " : "";
+    const char* hashValue = hashed ? hashText : "";
+    const char* hashEnd = hashed ? "\r\n" : "";
+    
+    int length = snprintf(NULL, 0, format, basename, contentType, recordedAt, hashName, hashValue, hashEnd);
+    char* text = length > 0 ? (char*)scratchAlloc(length + 1) : NULL;
+    if (!text) {
+      return false;
+    }
+    
+    snprintf(text, length + 1, format, basename, contentType, recordedAt, hashName, hashValue, hashEnd);
+    preambles[index] = text;
+    preambleLengths[index] = length;
+    return true;
+  }
+  
+  size_t copyString(const char* text, size_t length, char* out, size_t space) {
+    size_t chunk = MIN(space, length - position);
+    memcpy(out, text + position, chunk);
+    position += chunk;
+    return chunk;
+  }
+  
+  File parts[MAX_BATCH_FILES];
+  size_t partSizes[MAX_BATCH_FILES];
+  const char* preambles[MAX_BATCH_FILES];
+  size_t preambleLengths[MAX_BATCH_FILES];
+  int partCount = 0;
+  Stream* partData = NULL;
+  bool partStreamed = false;
+  size_t partSent = 0;
+  size_t totalLength = 0;
+  size_t produced = 0;
+  int part = 0;
+  int section = 0;
+  size_t position = 0;
+};
+
+// The server answers with one "<filename> <status>" line per item; only items
+// with a 2xx status are marked accepted. A 2xx answer with no item lines
+// accepts the whole batch. The response is split in place.
+static void parseBatchResponse(char* response, const upload_path_t* files, int count, bool* accepted) {
+  bool anyLine = false;
+  char* next = response;
+  
+  while (next && *next) {
+    char* line = next;
+    next = strchr(line, '\n');
+    if (next) {
+      *next++ = '\0';
+    }
+    
+    size_t length = strlen(line);
+    while (length > 0 && isspace((unsigned char)line[length - 1])) {
+      line[--length] = '\0';
+    }
+    
+    char* split = strrchr(line, ' ');
+    if (!split || split == line) {
+      continue;
+    }
+    
+    *split = '\0';
+    int status = atoi(split + 1);
+    
+    for (int i = 0; i < count; i++) {
+      if (strcmp(basenameOf(files[i]), line) == 0) {
+        accepted[i] = status >= 200 && status < 300;
+        anyLine = true;
+      }
+    }
+  }
+  
+  // An unparsable reply must not cost recordings: nothing is marked
+  if (!anyLine) {
+    DEBUG_PRINTLN("Batch reply listed no items, keeping all queued");
+  }
+}
+
+// Sends up to MAX_BATCH_FILES recordings in one multipart POST and fills
+// accepted[] per item. Returns the HTTP status of the request.
+int uploadFileBatch(const upload_path_t* files, int count, bool* accepted) {
+  static MultipartStream body;
+  
+  for (int i = 0; i < count; i++) {
+    accepted[i] = false;
+  }
+  
+  count = MIN(count, MAX_BATCH_FILES);
+  if (!body.begin(files, count)) {
+    DEBUG_PRINTLN("Failed to open batch files");
+    reportStorageError();
+    return HTTPC_ERROR_SEND_PAYLOAD_FAILED;
+  }
+  
+  beginUploadSession();
+  if (!http.begin(uploadClient(), UPLOAD_BATCH_ENDPOINT)) {
+    DEBUG_PRINTLN("Failed to start HTTP request");
+    body.close();
+    return HTTPC_ERROR_CONNECTION_REFUSED;
+  }
+  
+  static const char* responseHeaders[] = { "X-Batch-Accepted" };
+  http.collectHeaders(responseHeaders, 1);
+  
+  char number[12];
+  http.addHeader("Content-Type", "multipart/form-data; boundary=" BATCH_BOUNDARY);
+  http.addHeader("X-Device-ID", deviceId);
+  snprintf(number, sizeof(number), "%lu", millis());
+  http.addHeader("X-Timestamp", number);
+  snprintf(number, sizeof(number), "%d", count);
+  http.addHeader("X-Batch-Count", number);
+  addTelemetryHeader();
+  
+  int httpCode = http.sendRequest("POST", &body, body.length());
+  body.close();
   
-  String response = http.getString();
+  readResponseBody(httpCode, responseBody, sizeof(responseBody));
+  bool acceptAll = http.header("X-Batch-Accepted") == "all";
   http.end();
   
-  handleUploadResponse(httpCode, response);
+  if (httpCode < 0) {
+    uploadClient().stop();
+  }
+  
+  handleUploadResponse(httpCode, "");
   
-  return (httpCode >= 200 && httpCode < 300);
+  if (httpCode >= 200 && httpCode < 300) {
+    if (acceptAll) {
+      for (int i = 0; i < count; i++) {
+        accepted[i] = true;
+      }
+    } else {
+      parseBatchResponse(responseBody, files, count, accepted);
+    }
+  }
+  
+  return httpCode;
 }
 
-void handleUploadResponse(int httpCode, const String& response) {
+void handleUploadResponse(int httpCode, const char* response) {
   DEBUG_PRINTF("Upload response - Code: %d\n", httpCode);
   
-  if (response.length() > 0) {
-    DEBUG_PRINTF("Response body: %s\n", response.c_str());
+  if (response[0] != '\0') {
+    DEBUG_PRINTF("Response body: %s\n", response);
   }
   
   switch (httpCode) {
@@ -195,6 +1163,87 @@ void handleUploadResponse(int httpCode, const String& response) {
   }
 }
 
+// Runs batches on core 0 so loop() keeps listening and recording. Wakes on
+// requestUpload() or every UPLOAD_CHECK_INTERVAL_MS.
+static void uploadServiceTask(void* param) {
+  for (;;) {
+    ulTaskNotifyTake(pdTRUE, pdMS_TO_TICKS(UPLOAD_CHECK_INTERVAL_MS));
+    
+    if (!uploadsEnabled.load()) {
+      // WiFi is only worth its power draw while there is something to send
+      if (wifiConnected) {
+        disconnectWiFi();
+      }
+      continue;
+    }
+    
+    bool backingOff = lastUploadAttempt != 0 && getUploadRetryCount() > 0 &&
+                      millis() - lastUploadAttempt < UPLOAD_CHECK_INTERVAL_MS;
+    if (backingOff) {
+      continue;
+    }
+    
+    // From the first journal read to the last file closed, so a remount
+    // can't pull the card out from under the batch
+    lockStorage(UINT32_MAX);
+    if (getUnuploadedFileCount() > 0) {
+      uploadActive.store(true);
+      if (performUpload()) {
+        DEBUG_PRINTLN("Upload completed successfully");
+      } else {
+        DEBUG_PRINTLN("Upload failed, will retry later");
+      }
+      uploadActive.store(false);
+    }
+    unlockStorage();
+  }
+}
+
+bool startUploadService() {
+  if (uploadTaskHandle) {
+    return true;
+  }
+  
+  if (!initializeScratchArena()) {
+    return false;
+  }
+  
+  BaseType_t created = xTaskCreatePinnedToCore(uploadServiceTask, "upload",
+                                               UPLOAD_TASK_STACK_SIZE, NULL,
+                                               UPLOAD_TASK_PRIORITY, &uploadTaskHandle,
+                                               UPLOAD_TASK_CORE);
+  if (created != pdPASS) {
+    DEBUG_PRINTLN("Failed to create upload service task");
+    uploadTaskHandle = NULL;
+    return false;
+  }
+  
+  DEBUG_PRINTLN("Upload service started");
+  return true;
+}
+
+void setUploadsEnabled(bool enabled) {
+  bool wasEnabled = uploadsEnabled.exchange(enabled);
+  if (enabled && !wasEnabled) {
+    requestUpload();
+  }
+}
+
+// Recording owns the card; uploads only get a small share of SD reads
+void setUploadRecordingActive(bool recording) {
+  setUploadStreamRateLimit(recording ? UPLOAD_RECORDING_RATE_KBPS : UPLOAD_IDLE_RATE_KBPS);
+}
+
+void requestUpload() {
+  if (uploadTaskHandle) {
+    xTaskNotifyGive(uploadTaskHandle);
+  }
+}
+
+bool isUploadInProgress() {
+  return uploadActive.load();
+}
+
 int getUploadRetryCount() {
   return uploadRetryCount;
 }
@@ -2,6 +2,7 @@
 #define WIFI_SYNC_H
 
 #include "config.h"
+#include "upload_queue_record.h"
 #include <WiFi.h>
 #include <HTTPClient.h>
 
@@ -10,9 +11,15 @@ void disconnectWiFi();
 bool isWiFiConnected();
 bool shouldStartUpload();
 bool performUpload();
-bool uploadFile(const String& filename);
-bool uploadFileToAPI(const String& filename, const String& endpoint);
-void handleUploadResponse(int httpCode, const String& response);
+bool uploadFile(const char* filename);
+bool uploadFileResumable(const char* filename);
+int uploadFileBatch(const upload_path_t* files, int count, bool* accepted);
+void handleUploadResponse(int httpCode, const char* response);
+bool startUploadService();
+void setUploadsEnabled(bool enabled);
+void setUploadRecordingActive(bool recording);
+void requestUpload();
+bool isUploadInProgress();
 int getUploadRetryCount();
 void resetUploadRetryCount();
 